@@ -0,0 +1,82 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <time.h>
+#include "aqueue.h"
+#include "reclaim.h"
+
+// usage : aqueue_stress [producers] [consumers] [items per producer]
+// every producer enqueues its items while the consumers dequeue concurrently,
+// so nodes are retired and freed through the hazard pointers the whole run.
+
+static aqueue_t queue;
+static int items_per_producer = 1000000;
+static atomic_long consumed;
+static atomic_ullong checksum;
+static long total_items;
+
+static double now_seconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void *producer(void *arg)
+{
+    uintptr_t base = (uintptr_t)arg * items_per_producer;
+    for (int i = 0; i < items_per_producer; i++)
+    {
+        // +1 because NULL means empty
+        aqueue_enqueue(&queue, (void *)(base + i + 1));
+    }
+    return NULL;
+}
+
+static void *consumer(void *arg)
+{
+    (void)arg;
+    unsigned long long sum = 0;
+    while (atomic_load_explicit(&consumed, memory_order_relaxed) < total_items)
+    {
+        void *data = aqueue_dequeue(&queue);
+        if (data == NULL)
+            continue;
+        sum += (uintptr_t)data;
+        atomic_fetch_add_explicit(&consumed, 1, memory_order_relaxed);
+    }
+    atomic_fetch_add(&checksum, sum);
+    return NULL;
+}
+
+int main(int argc, char **argv)
+{
+    int producers = argc > 1 ? atoi(argv[1]) : 4;
+    int consumers = argc > 2 ? atoi(argv[2]) : 4;
+    if (argc > 3)
+        items_per_producer = atoi(argv[3]);
+    total_items = (long)producers * items_per_producer;
+
+    pthread_t *threads = malloc(sizeof(pthread_t) * (producers + consumers));
+    aqueue_init(&queue);
+
+    double start = now_seconds();
+    for (int i = 0; i < producers; i++)
+        pthread_create(&threads[i], NULL, producer, (void *)(uintptr_t)i);
+    for (int i = 0; i < consumers; i++)
+        pthread_create(&threads[producers + i], NULL, consumer, NULL);
+    for (int i = 0; i < producers + consumers; i++)
+        pthread_join(threads[i], NULL);
+    double elapsed = now_seconds() - start;
+
+    unsigned long long expected = (unsigned long long)total_items * (total_items + 1) / 2;
+    int ok = atomic_load(&checksum) == expected;
+    printf("producers=%d consumers=%d items=%ld seconds=%.3f mops=%.2f checksum=%s\n",
+           producers, consumers, total_items, elapsed, total_items / elapsed / 1e6, ok ? "ok" : "BAD");
+
+    reclaim_flush();
+    aqueue_destroy(&queue);
+    free(threads);
+    return ok ? 0 : 1;
+}
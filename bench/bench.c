@@ -0,0 +1,428 @@
+// sched_getcpu / pthread_setaffinity_np
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "aqueue.h"
+#include "mpmc.h"
+#include "reclaim.h"
+#include "segqueue.h"
+#include "semaphore.h"
+
+// usage : sync_bench [--json] [--quick] [mpmc|segqueue|aqueue|semaphore ...]
+// runs the sweep of every listed benchmark (all of them by default) and prints one record
+// per configuration, CSV unless --json. --quick runs a small sweep, used as a smoke test.
+//
+// ops_per_sec counts items moved through a queue, or acquire/release pairs for the semaphore.
+// latencies are the duration of single calls (send + recv, or acquire), sampled every
+// BENCH_SAMPLE_EVERY operations of every thread.
+
+#define BENCH_SAMPLE_EVERY 16
+#define BENCH_MAX_THREADS 64
+#define BENCH_MAX_ITEM 256
+
+typedef struct
+{
+    const char *bench;
+    const char *mode;
+    int producers; // threads for the semaphore
+    int consumers;
+    int item_size;
+    int capacity; // permits for the semaphore
+    int permits;  // permits per acquire
+    int pinned;
+    long ops;
+    double seconds;
+    uint64_t p50;
+    uint64_t p99;
+    uint64_t p999;
+} bench_result_t;
+
+typedef struct
+{
+    uint32_t *samples;
+    size_t count;
+    size_t cap;
+} bench_samples_t;
+
+typedef struct
+{
+    int index; // thread index, also used for pinning
+    int producer;
+    long ops;
+    bench_samples_t samples;
+} bench_thread_t;
+
+static int output_json = 0;
+static int records = 0;
+static long total_ops = 1 << 20;
+
+// current benchmark configuration, read by the worker threads
+static bench_result_t current;
+static mpmc_t mpmc;
+static segqueue_t segqueue;
+static aqueue_t aqueue;
+static semaphore_t semaphore;
+static atomic_long claimed;
+static atomic_int ready;
+static atomic_int go;
+
+static inline uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+static inline void bench_record(bench_samples_t *samples, uint64_t start)
+{
+    uint64_t elapsed = now_ns() - start;
+    if (samples->count < samples->cap)
+        samples->samples[samples->count++] = elapsed > UINT32_MAX ? UINT32_MAX : (uint32_t)elapsed;
+}
+static void bench_pin(int index)
+{
+#ifdef __linux__
+    cpu_set_t set;
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    CPU_ZERO(&set);
+    CPU_SET(index % (cpus > 0 ? cpus : 1), &set);
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#else
+    (void)index;
+#endif
+}
+// every thread waits here so the clock starts with all of them running
+static void bench_start(bench_thread_t *thread)
+{
+    if (current.pinned)
+        bench_pin(thread->index);
+    atomic_fetch_add(&ready, 1);
+    while (!atomic_load(&go))
+        sched_yield();
+}
+static int bench_blocking(void)
+{
+    return strcmp(current.mode, "block") == 0;
+}
+// consumers share one counter of items still to receive, so exactly `total` recvs happen
+static int bench_claim(void)
+{
+    return atomic_fetch_add_explicit(&claimed, 1, memory_order_relaxed) < current.ops;
+}
+
+static void *mpmc_worker(void *arg)
+{
+    bench_thread_t *thread = arg;
+    unsigned char item[BENCH_MAX_ITEM] = {0};
+    int block = bench_blocking();
+    bench_start(thread);
+    for (long i = 0; thread->producer ? i < thread->ops : bench_claim(); i++)
+    {
+        uint64_t start = (i % BENCH_SAMPLE_EVERY) == 0 ? now_ns() : 0;
+        if (thread->producer)
+        {
+            memcpy(item, &i, sizeof(i));
+            if (block)
+                mpmc_send_block(&mpmc, item);
+            else
+                while (mpmc_send(&mpmc, item) != MPMC_OK)
+                    sched_yield();
+        }
+        else
+        {
+            if (block)
+                mpmc_recv_block(&mpmc, item);
+            else
+                while (mpmc_recv(&mpmc, item) != MPMC_OK)
+                    sched_yield();
+        }
+        if (start != 0)
+            bench_record(&thread->samples, start);
+    }
+    return NULL;
+}
+static void *segqueue_worker(void *arg)
+{
+    bench_thread_t *thread = arg;
+    unsigned char item[BENCH_MAX_ITEM] = {0};
+    int block = bench_blocking();
+    bench_start(thread);
+    for (long i = 0; thread->producer ? i < thread->ops : bench_claim(); i++)
+    {
+        uint64_t start = (i % BENCH_SAMPLE_EVERY) == 0 ? now_ns() : 0;
+        if (thread->producer)
+        {
+            memcpy(item, &i, sizeof(i));
+            segqueue_send(&segqueue, item);
+        }
+        else
+        {
+            if (block)
+                segqueue_recv_block(&segqueue, item);
+            else
+                while (segqueue_recv(&segqueue, item) != MPMC_OK)
+                    sched_yield();
+        }
+        if (start != 0)
+            bench_record(&thread->samples, start);
+    }
+    return NULL;
+}
+static void *aqueue_worker(void *arg)
+{
+    bench_thread_t *thread = arg;
+    bench_start(thread);
+    for (long i = 0; thread->producer ? i < thread->ops : bench_claim(); i++)
+    {
+        uint64_t start = (i % BENCH_SAMPLE_EVERY) == 0 ? now_ns() : 0;
+        if (thread->producer)
+        {
+            // +1 because NULL means empty
+            aqueue_enqueue(&aqueue, (void *)(uintptr_t)(i + 1));
+        }
+        else
+        {
+            while (aqueue_dequeue(&aqueue) == NULL)
+                sched_yield();
+        }
+        if (start != 0)
+            bench_record(&thread->samples, start);
+    }
+    return NULL;
+}
+static void *semaphore_worker(void *arg)
+{
+    bench_thread_t *thread = arg;
+    bench_start(thread);
+    for (long i = 0; i < thread->ops; i++)
+    {
+        uint64_t start = (i % BENCH_SAMPLE_EVERY) == 0 ? now_ns() : 0;
+        semaphore_acquire_many_block(&semaphore, current.permits);
+        if (start != 0)
+            bench_record(&thread->samples, start);
+        semaphore_release_many(&semaphore, current.permits);
+    }
+    return NULL;
+}
+
+static int bench_compare(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *)a;
+    uint32_t y = *(const uint32_t *)b;
+    return (x > y) - (x < y);
+}
+static uint64_t bench_percentile(uint32_t *sorted, size_t count, double p)
+{
+    if (count == 0)
+        return 0;
+    size_t index = (size_t)(p * (count - 1));
+    return sorted[index];
+}
+
+static void bench_print(bench_result_t *r)
+{
+    double ops_per_sec = r->seconds > 0 ? r->ops / r->seconds : 0;
+    if (output_json)
+    {
+        printf("%s  {\"bench\": \"%s\", \"mode\": \"%s\", \"producers\": %d, \"consumers\": %d, "
+               "\"item_size\": %d, \"capacity\": %d, \"permits\": %d, \"pinned\": %d, \"ops\": %ld, "
+               "\"seconds\": %.6f, \"ops_per_sec\": %.0f, \"p50_ns\": %llu, \"p99_ns\": %llu, \"p999_ns\": %llu}",
+               records == 0 ? "" : ",\n", r->bench, r->mode, r->producers, r->consumers, r->item_size, r->capacity,
+               r->permits, r->pinned, r->ops, r->seconds, ops_per_sec, (unsigned long long)r->p50,
+               (unsigned long long)r->p99, (unsigned long long)r->p999);
+    }
+    else
+    {
+        if (records == 0)
+            printf("bench,mode,producers,consumers,item_size,capacity,permits,pinned,ops,seconds,ops_per_sec,p50_ns,p99_ns,p999_ns\n");
+        printf("%s,%s,%d,%d,%d,%d,%d,%d,%ld,%.6f,%.0f,%llu,%llu,%llu\n", r->bench, r->mode, r->producers,
+               r->consumers, r->item_size, r->capacity, r->permits, r->pinned, r->ops, r->seconds, ops_per_sec,
+               (unsigned long long)r->p50, (unsigned long long)r->p99, (unsigned long long)r->p999);
+    }
+    records++;
+    fflush(stdout);
+}
+
+// run `current` with `current.producers` producers and `current.consumers` consumers,
+// the producers split current.ops between them, then fill in the results and print them
+static void bench_run(void *(*worker)(void *))
+{
+    int threads = current.producers + current.consumers;
+    bench_thread_t thread[BENCH_MAX_THREADS];
+    // whole batches only, every producer does ops / producers
+    current.ops = (current.ops / current.producers) * current.producers;
+    pthread_t handles[BENCH_MAX_THREADS];
+    atomic_store(&claimed, 0);
+    atomic_store(&ready, 0);
+    atomic_store(&go, 0);
+    for (int i = 0; i < threads; i++)
+    {
+        thread[i].index = i;
+        thread[i].producer = i < current.producers;
+        thread[i].ops = current.ops / current.producers;
+        // a consumer may receive anything up to every item
+        thread[i].samples.cap = current.ops / BENCH_SAMPLE_EVERY + 1;
+        thread[i].samples.count = 0;
+        thread[i].samples.samples = malloc(thread[i].samples.cap * sizeof(uint32_t));
+        pthread_create(&handles[i], NULL, worker, &thread[i]);
+    }
+    while (atomic_load(&ready) < threads)
+        sched_yield();
+    uint64_t start = now_ns();
+    atomic_store(&go, 1);
+    for (int i = 0; i < threads; i++)
+        pthread_join(handles[i], NULL);
+    current.seconds = (now_ns() - start) / 1e9;
+
+    size_t count = 0;
+    for (int i = 0; i < threads; i++)
+        count += thread[i].samples.count;
+    uint32_t *all = malloc((count + 1) * sizeof(uint32_t));
+    count = 0;
+    for (int i = 0; i < threads; i++)
+    {
+        memcpy(all + count, thread[i].samples.samples, thread[i].samples.count * sizeof(uint32_t));
+        count += thread[i].samples.count;
+        free(thread[i].samples.samples);
+    }
+    qsort(all, count, sizeof(uint32_t), bench_compare);
+    current.p50 = bench_percentile(all, count, 0.50);
+    current.p99 = bench_percentile(all, count, 0.99);
+    current.p999 = bench_percentile(all, count, 0.999);
+    free(all);
+    bench_print(&current);
+}
+
+static const int pairs[][2] = {{1, 1}, {2, 2}, {4, 4}, {1, 4}, {4, 1}};
+static const int item_sizes[] = {8, 64, 256};
+static const int capacities[] = {64, 1024};
+static const char *modes[] = {"nonblock", "block"};
+static int quick = 0;
+
+#define COUNT(array) ((int)(sizeof(array) / sizeof((array)[0])))
+
+static void bench_mpmc(void)
+{
+    for (int pin = 0; pin <= (quick ? 0 : 1); pin++)
+        for (int p = 0; p < (quick ? 2 : COUNT(pairs)); p++)
+            for (int s = 0; s < (quick ? 1 : COUNT(item_sizes)); s++)
+                for (int c = 0; c < (quick ? 1 : COUNT(capacities)); c++)
+                    for (int m = 0; m < COUNT(modes); m++)
+                    {
+                        current = (bench_result_t){.bench = "mpmc", .mode = modes[m], .producers = pairs[p][0],
+                                                   .consumers = pairs[p][1], .item_size = item_sizes[s],
+                                                   .capacity = capacities[c], .pinned = pin, .ops = total_ops};
+                        if (mpmc_init(&mpmc, current.capacity, current.item_size) != MPMC_OK)
+                        {
+                            fprintf(stderr, "mpmc_init failed\n");
+                            exit(1);
+                        }
+                        bench_run(mpmc_worker);
+                        destroy_mpmc(&mpmc);
+                    }
+}
+static void bench_segqueue(void)
+{
+    for (int pin = 0; pin <= (quick ? 0 : 1); pin++)
+        for (int p = 0; p < (quick ? 2 : COUNT(pairs)); p++)
+            for (int s = 0; s < (quick ? 1 : COUNT(item_sizes)); s++)
+                for (int m = 0; m < COUNT(modes); m++)
+                {
+                    current = (bench_result_t){.bench = "segqueue", .mode = modes[m], .producers = pairs[p][0],
+                                               .consumers = pairs[p][1], .item_size = item_sizes[s],
+                                               .pinned = pin, .ops = total_ops};
+                    if (segqueue_init(&segqueue, current.item_size) != MPMC_OK)
+                    {
+                        fprintf(stderr, "segqueue_init failed\n");
+                        exit(1);
+                    }
+                    bench_run(segqueue_worker);
+                    segqueue_destroy(&segqueue);
+                }
+}
+static void bench_aqueue(void)
+{
+    for (int pin = 0; pin <= (quick ? 0 : 1); pin++)
+        for (int p = 0; p < (quick ? 2 : COUNT(pairs)); p++)
+        {
+            current = (bench_result_t){.bench = "aqueue", .mode = "nonblock", .producers = pairs[p][0],
+                                       .consumers = pairs[p][1], .item_size = sizeof(void *), .pinned = pin,
+                                       .ops = total_ops};
+            aqueue_init(&aqueue);
+            bench_run(aqueue_worker);
+            reclaim_flush();
+            aqueue_destroy(&aqueue);
+        }
+}
+static void bench_semaphore(void)
+{
+    static const int threads[] = {1, 2, 4, 8, 16, 32};
+    static const int per_acquire[] = {1, 4};
+    static const char *kinds[] = {"plain", "sharded"};
+    for (int pin = 0; pin <= (quick ? 0 : 1); pin++)
+        for (int k = 0; k < COUNT(kinds); k++)
+            for (int t = 0; t < (quick ? 3 : COUNT(threads)); t++)
+                for (int a = 0; a < COUNT(per_acquire); a++)
+                {
+                    // 8 permits, so from 8 (or 2 with 4 per acquire) threads on they contend
+                    current = (bench_result_t){.bench = "semaphore", .mode = kinds[k], .producers = threads[t],
+                                               .capacity = 8, .permits = per_acquire[a], .pinned = pin,
+                                               .ops = total_ops / 4};
+                    int result = k == 0 ? semaphore_init(&semaphore, current.capacity)
+                                        : semaphore_init_sharded(&semaphore, current.capacity, 0, wait_hybrid());
+                    if (result != SEMAPHORE_OK)
+                    {
+                        fprintf(stderr, "semaphore_init failed\n");
+                        exit(1);
+                    }
+                    bench_run(semaphore_worker);
+                    semaphore_destroy(&semaphore);
+                }
+}
+
+int main(int argc, char **argv)
+{
+    int selected = 0;
+    int run_mpmc = 0, run_segqueue = 0, run_aqueue = 0, run_semaphore = 0;
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--json") == 0)
+            output_json = 1;
+        else if (strcmp(argv[i], "--quick") == 0)
+            quick = 1;
+        else if (strcmp(argv[i], "mpmc") == 0)
+            run_mpmc = selected = 1;
+        else if (strcmp(argv[i], "segqueue") == 0)
+            run_segqueue = selected = 1;
+        else if (strcmp(argv[i], "aqueue") == 0)
+            run_aqueue = selected = 1;
+        else if (strcmp(argv[i], "semaphore") == 0)
+            run_semaphore = selected = 1;
+        else
+        {
+            fprintf(stderr, "usage : %s [--json] [--quick] [mpmc|segqueue|aqueue|semaphore ...]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (quick)
+        total_ops = 1 << 14;
+    if (output_json)
+        printf("[\n");
+    if (!selected || run_mpmc)
+        bench_mpmc();
+    if (!selected || run_segqueue)
+        bench_segqueue();
+    if (!selected || run_aqueue)
+        bench_aqueue();
+    if (!selected || run_semaphore)
+        bench_semaphore();
+    if (output_json)
+        printf("\n]\n");
+    return 0;
+}
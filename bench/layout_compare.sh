@@ -0,0 +1,48 @@
+#!/bin/sh
+# before/after throughput of the mpmc_t cache line layout.
+#
+# usage : bench/layout_compare.sh [before-rev [after-rev]]
+# builds bench/mpmc_layout.c against the mpmc.c of both revisions (by default the
+# parent of the commit that introduced MPMC_CACHE_LINE, and that commit), plus the
+# after revision with MPMC_CELL_PER_LINE, then prints the Mops/s of every run.
+# meant for a multi-core machine, with a single cpu there is no false sharing to remove.
+set -e
+
+root=$(git rev-parse --show-toplevel)
+layout=$(git -C "$root" log -S MPMC_CACHE_LINE --format=%H -- include/mpmc.h | tail -n 1)
+before=${1:-$layout^}
+after=${2:-$layout}
+runs=${RUNS:-3}
+work=$(mktemp -d)
+trap 'rm -rf "$work"' EXIT
+
+# the early trees include a <libc.h> that only exists on macOS
+mkdir "$work/shim"
+touch "$work/shim/libc.h"
+
+build() # name rev [cflags]
+{
+    mkdir "$work/$1"
+    git -C "$root" archive "$2" src/mpmc.c include | tar -x -C "$work/$1"
+    # and forget <string.h>
+    ${CC:-cc} -O2 -std=gnu11 $3 -include string.h -I"$work/$1/include" -I"$work/shim" \
+        -c "$work/$1/src/mpmc.c" -o "$work/$1/mpmc.o"
+    ${CC:-cc} -O2 -std=gnu11 $3 -I"$work/$1/include" -I"$work/shim" \
+        "$root/bench/mpmc_layout.c" "$work/$1/mpmc.o" -o "$work/$1/mpmc_layout" -lpthread
+}
+build before "$before"
+build after "$after"
+build per_line "$after" -DMPMC_CELL_PER_LINE
+
+echo "cpus,producers,consumers,capacity,variant,mops"
+for pair in "1 1" "2 2" "4 4" "1 4" "4 1"; do
+    set -- $pair
+    for capacity in 1024 1000; do
+        for variant in before after per_line; do
+            for run in $(seq "$runs"); do
+                mops=$("$work/$variant/mpmc_layout" "$1" "$2" "$capacity")
+                echo "$(nproc),$1,$2,$capacity,$variant,$mops"
+            done
+        done
+    done
+done
@@ -0,0 +1,88 @@
+// sched_getcpu / pthread_setaffinity_np
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include "mpmc.h"
+
+// usage : mpmc_layout producers consumers capacity [items]
+// runs producers and consumers that retry mpmc_send / mpmc_recv with 8 byte items (yielding
+// on a full or empty queue, like the nonblock mode of sync_bench), every thread pinned to
+// its own cpu (modulo the online cpus), and prints the throughput in Mops/s.
+// only the api mpmc_t had before the cache line layout is used, so layout_compare.sh can
+// build it against the mpmc.c of any revision.
+
+static mpmc_t queue;
+static long items_per_producer;
+static int producers, consumers;
+static atomic_long claimed;
+static atomic_int ready, go;
+
+static void pin(int index)
+{
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(index % sysconf(_SC_NPROCESSORS_ONLN), &set);
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+}
+static void *worker(void *arg)
+{
+    int index = (int)(long)arg;
+    long item = 0;
+    pin(index);
+    atomic_fetch_add(&ready, 1);
+    while (!atomic_load(&go))
+        sched_yield();
+    if (index < producers)
+    {
+        for (item = 0; item < items_per_producer; item++)
+            while (mpmc_send(&queue, &item) != 0)
+                sched_yield();
+    }
+    else
+    {
+        // consumers share the count of items still to receive
+        while (atomic_fetch_add_explicit(&claimed, 1, memory_order_relaxed) < items_per_producer * producers)
+            while (mpmc_recv(&queue, &item) != 0)
+                sched_yield();
+    }
+    return NULL;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 4)
+    {
+        fprintf(stderr, "usage : %s producers consumers capacity [items]\n", argv[0]);
+        return 1;
+    }
+    producers = atoi(argv[1]);
+    consumers = atoi(argv[2]);
+    int capacity = atoi(argv[3]);
+    long items = argc > 4 ? atol(argv[4]) : 1L << 22;
+    items_per_producer = items / producers;
+    pthread_t threads[producers + consumers];
+    if (producers <= 0 || consumers <= 0 || mpmc_init(&queue, capacity, sizeof(long)) != 0)
+    {
+        fprintf(stderr, "mpmc_init failed\n");
+        return 1;
+    }
+    for (long i = 0; i < producers + consumers; i++)
+        pthread_create(&threads[i], NULL, worker, (void *)i);
+    while (atomic_load(&ready) < producers + consumers)
+        sched_yield();
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    atomic_store(&go, 1);
+    for (int i = 0; i < producers + consumers; i++)
+        pthread_join(threads[i], NULL);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    printf("%.2f\n", items_per_producer * producers / seconds / 1e6);
+    destroy_mpmc(&queue);
+    return 0;
+}
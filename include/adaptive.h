@@ -0,0 +1,184 @@
+
+#ifndef ADAPTIVE_H
+#define ADAPTIVE_H
+
+#include <stdatomic.h>
+#include <sched.h>
+#include <time.h>
+#include "spin.h"
+#include "wait.h"
+
+/*
+ * adaptive_t : spin, then yield, then park.
+ *
+ * blocking calls first retry with the spin_t backoff, then yield the cpu a few times and
+ * only then go to sleep. the spin budget is learned per object from the recent waits, like
+ * glibc's adaptive mutex : a wait satisfied while spinning pulls it towards the rounds it took,
+ * a wait that needed to yield pushes it up, a wait that ended up parking decays it.
+ * on a single cpu spinning can't help (the thread we wait for isn't running), so we go
+ * straight to yielding, like go's sync.Mutex.
+ *
+ * that is the WAIT_HYBRID strategy, the other wait_strategy_t kinds (see wait.h) replace
+ * the three phases : busy spin, yield and timed park never return FALSE, park always does.
+ *
+ * usage :
+ *     if (!adaptive_spin(&adaptive, try_again, ctx))
+ *     {
+ *         park / wait on an eventcount ...
+ *         adaptive_parked(&adaptive);
+ *     }
+ */
+
+// spin rounds are clamped to [ADAPTIVE_SPIN_MIN, ADAPTIVE_SPIN_MAX], a round is one spin_next.
+// the rounds double up to SPIN_ROUND_MAX_NS, so the longest spin is about 10us
+#define ADAPTIVE_SPIN_MIN 4
+#define ADAPTIVE_SPIN_MAX 16
+#define ADAPTIVE_SPIN_POW 2
+#define ADAPTIVE_YIELDS 4
+// the budget moves by 1/ADAPTIVE_WEIGHT of the difference on every wait
+#define ADAPTIVE_WEIGHT 8
+
+/**
+ * @brief How many blocking waits ended in each phase.
+ */
+typedef struct
+{
+    unsigned long spin;  // satisfied while spinning
+    unsigned long yield; // satisfied after yielding the cpu
+    unsigned long park;  // had to sleep
+} adaptive_stats_t;
+
+typedef struct
+{
+    wait_strategy_t strategy;
+    atomic_int budget; // learned spin rounds
+    atomic_ulong spin;
+    atomic_ulong yield;
+    atomic_ulong park;
+} adaptive_t;
+
+// returns non zero once the caller's condition is met, the wait is then over
+typedef int (*adaptive_try_fn)(void *ctx);
+
+static inline void adaptive_init(adaptive_t *adaptive, wait_strategy_t strategy)
+{
+    adaptive->strategy = strategy;
+    atomic_store(&adaptive->budget, ADAPTIVE_SPIN_MIN);
+    atomic_store(&adaptive->spin, 0);
+    atomic_store(&adaptive->yield, 0);
+    atomic_store(&adaptive->park, 0);
+}
+// TRUE on a single cpu machine, the cpu count is read once per process (see adaptive.c)
+int adaptive_single_cpu(void);
+// NOTE : racy read-modify-write on purpose, a lost update only makes the average a bit less accurate
+static inline void adaptive_learn(adaptive_t *adaptive, int rounds)
+{
+    int budget = atomic_load_explicit(&adaptive->budget, memory_order_relaxed);
+    int diff = rounds - budget;
+    // round away from zero, a truncated step stops short of the bounds once the difference is under the weight
+    budget += (diff + (diff > 0 ? ADAPTIVE_WEIGHT - 1 : diff < 0 ? 1 - ADAPTIVE_WEIGHT : 0)) / ADAPTIVE_WEIGHT;
+    if (budget < ADAPTIVE_SPIN_MIN)
+        budget = ADAPTIVE_SPIN_MIN;
+    if (budget > ADAPTIVE_SPIN_MAX)
+        budget = ADAPTIVE_SPIN_MAX;
+    atomic_store_explicit(&adaptive->budget, budget, memory_order_relaxed);
+}
+// the strategies that never park, they only return once `try_fn` succeeded
+static inline void adaptive_busy_spin(adaptive_t *adaptive, adaptive_try_fn try_fn, void *ctx)
+{
+    while (!try_fn(ctx))
+        CPU_HINT_LOOP();
+    atomic_fetch_add_explicit(&adaptive->spin, 1, memory_order_relaxed);
+}
+static inline void adaptive_yield(adaptive_t *adaptive, adaptive_try_fn try_fn, void *ctx)
+{
+    spin_t spin = {.next = 1, .pow = ADAPTIVE_SPIN_POW, .max = adaptive->strategy.spins};
+    while (spin_next(&spin) == FALSE)
+    {
+        if (try_fn(ctx))
+        {
+            atomic_fetch_add_explicit(&adaptive->spin, 1, memory_order_relaxed);
+            return;
+        }
+    }
+    do
+        sched_yield();
+    while (!try_fn(ctx));
+    atomic_fetch_add_explicit(&adaptive->yield, 1, memory_order_relaxed);
+}
+static inline void adaptive_timed_park(adaptive_t *adaptive, adaptive_try_fn try_fn, void *ctx)
+{
+    struct timespec pause = {.tv_sec = adaptive->strategy.park_ns / 1000000000L,
+                             .tv_nsec = adaptive->strategy.park_ns % 1000000000L};
+    do
+        nanosleep(&pause, NULL);
+    while (!try_fn(ctx));
+    atomic_fetch_add_explicit(&adaptive->park, 1, memory_order_relaxed);
+}
+/**
+ * @brief Run the spin and yield phases, calling `try_fn(ctx)` between steps.
+ *
+ * @return TRUE if `try_fn` succeeded, FALSE if the caller should park.
+ */
+static inline int adaptive_spin(adaptive_t *adaptive, adaptive_try_fn try_fn, void *ctx)
+{
+    switch (adaptive->strategy.kind)
+    {
+    case WAIT_BUSY_SPIN:
+        adaptive_busy_spin(adaptive, try_fn, ctx);
+        return TRUE;
+    case WAIT_YIELD:
+        adaptive_yield(adaptive, try_fn, ctx);
+        return TRUE;
+    case WAIT_TIMED_PARK:
+        adaptive_timed_park(adaptive, try_fn, ctx);
+        return TRUE;
+    case WAIT_PARK:
+        return FALSE;
+    }
+    // spin up to twice the average, so a wait a bit longer than usual still spins it out
+    int limit = 2 * atomic_load_explicit(&adaptive->budget, memory_order_relaxed);
+    if (limit > ADAPTIVE_SPIN_MAX)
+        limit = ADAPTIVE_SPIN_MAX;
+    if (!adaptive_single_cpu())
+    {
+        spin_t spin = {.next = 1, .pow = ADAPTIVE_SPIN_POW, .max = limit};
+        while (spin_next(&spin) == FALSE)
+        {
+            if (try_fn(ctx))
+            {
+                adaptive_learn(adaptive, spin.next - 1);
+                atomic_fetch_add_explicit(&adaptive->spin, 1, memory_order_relaxed);
+                return TRUE;
+            }
+        }
+    }
+    for (int i = 0; i < ADAPTIVE_YIELDS; i++)
+    {
+        sched_yield();
+        if (try_fn(ctx))
+        {
+            // a bit more spinning would have done it
+            adaptive_learn(adaptive, ADAPTIVE_SPIN_MAX);
+            atomic_fetch_add_explicit(&adaptive->yield, 1, memory_order_relaxed);
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+/**
+ * @brief Record a wait that had to park, spinning was wasted so the budget decays.
+ */
+static inline void adaptive_parked(adaptive_t *adaptive)
+{
+    adaptive_learn(adaptive, 0);
+    atomic_fetch_add_explicit(&adaptive->park, 1, memory_order_relaxed);
+}
+static inline void adaptive_stats(adaptive_t *adaptive, adaptive_stats_t *stats)
+{
+    stats->spin = atomic_load_explicit(&adaptive->spin, memory_order_relaxed);
+    stats->yield = atomic_load_explicit(&adaptive->yield, memory_order_relaxed);
+    stats->park = atomic_load_explicit(&adaptive->park, memory_order_relaxed);
+}
+
+#endif
@@ -3,11 +3,22 @@
 #define A_QUEUE_H
 #include <stdalign.h>
 #include <stdatomic.h>
+#include <stddef.h>
+/**
+ * @brief Result codes returned by aqueue operations.
+ */
+typedef enum
+{
+    /// @brief Operation succeeded.
+    AQUEUE_OK = 0,
+
+    /// @brief A node could not be allocated, the queue itself is unbounded.
+    AQUEUE_NO_MEMORY = -1,
+} AQUEUE_RESULT;
 typedef struct aqueue_node_t aqueue_node_t;
 struct aqueue_node_t
 {
     _Atomic(aqueue_node_t *) next;
-    atomic_size_t refcount;
     void *data;
 } __attribute__((aligned(64)));
 
@@ -16,7 +27,35 @@ typedef struct
     _Atomic(aqueue_node_t *) head;
     _Atomic(aqueue_node_t *) tail;
 } aqueue_t;
-void aqueue_init(aqueue_t *list);
+/**
+ * @brief Initialize an empty queue.
+ *
+ * @return AQUEUE_OK on success, AQUEUE_NO_MEMORY if the dummy node could not be allocated.
+ */
+int aqueue_init(aqueue_t *list);
+/**
+ * @brief Initialize the queue and preallocate `nodes` nodes.
+ *
+ * Nodes come from a process wide pool of slab allocated nodes with a per thread
+ * cache, enqueue/dequeue only touch the heap when the pool runs dry.
+ * Preallocating up to the expected peak queue length makes the steady state
+ * allocation free from the start.
+ *
+ * @return AQUEUE_OK on success, AQUEUE_NO_MEMORY if the dummy node could not be allocated.
+ */
+int aqueue_init_prealloc(aqueue_t *list, size_t nodes);
 void *aqueue_dequeue(aqueue_t *list);
-void aqueue_enqueue(aqueue_t *list, void *data);
-#endif
\ No newline at end of file
+/**
+ * @brief Append `data` to the queue.
+ *
+ * @return AQUEUE_OK on success, AQUEUE_NO_MEMORY if a node could not be allocated.
+ */
+int aqueue_enqueue(aqueue_t *list, void *data);
+/**
+ * @brief Give the nodes still linked in the queue back to the node pool.
+ *
+ * @warning No thread may use the queue during or after this call, the data
+ *          pointers still queued are not freed.
+ */
+void aqueue_destroy(aqueue_t *list);
+#endif
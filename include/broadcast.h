@@ -0,0 +1,104 @@
+#ifndef BROADCAST_H
+#define BROADCAST_H
+
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include "mpmc.h"
+#include "parker.h"
+#include "adaptive.h"
+
+/**
+ * @file broadcast.h
+ * @brief Bounded broadcast channel, every subscribed receiver sees every message.
+ *
+ * The payload is stored once, in mpmc_cell_t cells, and every receiver keeps its
+ * own position in the ring. Senders never wait for receivers : once the ring is
+ * full the oldest message is overwritten, and a receiver that fell more than a lap
+ * behind gets BROADCAST_LAGGED with the number of messages it missed, then goes on
+ * from the oldest message still in the ring (like tokio's broadcast channel).
+ *
+ * The cell seq is a seqlock stamp : 2 * pos + 1 while message `pos` is written,
+ * 2 * (pos + 1) once it is complete. A receiver copies the message out and keeps it
+ * only if the stamp didn't move meanwhile.
+ */
+
+/// @brief The receiver missed messages, see broadcast_recv.
+#define BROADCAST_LAGGED -4
+
+typedef struct
+{
+    // read-only after init
+    alignas(MPMC_CACHE_LINE) unsigned char *buffer;
+    size_t item_size;
+    size_t stride; // bytes between cells, a multiple of MPMC_CELL_ALIGN
+    size_t mask;   // capacity - 1, the capacity is a power of two
+    int capacity;
+    // senders
+    alignas(MPMC_CACHE_LINE) atomic_size_t tail; // next position to write
+    // receivers
+    alignas(MPMC_CACHE_LINE) atomic_int subscribers;
+    // blocked receivers, every send wakes all of them
+    alignas(MPMC_CACHE_LINE) eventcount_t recv_event;
+    adaptive_t recv_wait;
+} broadcast_t;
+
+/**
+ * @brief A subscription, owned by a single thread at a time.
+ */
+typedef struct
+{
+    broadcast_t *channel;
+    size_t next; // position of the next message to receive
+} broadcast_receiver_t;
+
+/**
+ * @brief Initialize a channel that keeps the last `capacity` messages.
+ *
+ * @param capacity Number of cells, must be a power of two.
+ * @return MPMC_OK on success, MPMC_INIT_FAILED on allocation failure or bad arguments.
+ */
+int broadcast_init(broadcast_t *channel, int capacity, int item_size);
+/**
+ * @brief Send `message` to every current subscriber, never blocks.
+ *
+ * Overwrites the oldest message if the ring is full. Several threads may send at once.
+ *
+ * @return MPMC_OK.
+ */
+int broadcast_send(broadcast_t *channel, void *message);
+/**
+ * @brief Number of receivers currently subscribed.
+ */
+int broadcast_subscribers(broadcast_t *channel);
+/**
+ * @brief Subscribe `receiver`, it will see the messages sent from now on.
+ */
+void broadcast_subscribe(broadcast_t *channel, broadcast_receiver_t *receiver);
+/**
+ * @brief Leave the channel, `receiver` must not be used afterwards.
+ */
+void broadcast_unsubscribe(broadcast_receiver_t *receiver);
+/**
+ * @brief Receive the next message (non-blocking).
+ *
+ * @param lagged Receives the number of missed messages when BROADCAST_LAGGED is returned, may be NULL.
+ * @return MPMC_OK on success, MPMC_EMPTY if there is no new message,
+ *         BROADCAST_LAGGED if messages were overwritten before this receiver
+ *         read them, the next call returns the oldest message still in the ring.
+ */
+int broadcast_recv(broadcast_receiver_t *receiver, void *message, size_t *lagged);
+/**
+ * @brief Receive the next message, waiting while there is none.
+ *
+ * @return MPMC_OK or BROADCAST_LAGGED, see broadcast_recv.
+ */
+int broadcast_recv_block(broadcast_receiver_t *receiver, void *message, size_t *lagged);
+/**
+ * @brief Free the ring.
+ *
+ * @warning No thread may use the channel or its receivers during or after this call.
+ */
+void broadcast_destroy(broadcast_t *channel);
+
+#endif
@@ -0,0 +1,74 @@
+#ifndef DEQUE_H
+#define DEQUE_H
+
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include "mpmc.h"
+
+/**
+ * @file deque.h
+ * @brief Chase-Lev work-stealing deque of pointers.
+ *
+ * The owner thread pushes and pops at the bottom without any CAS unless a single item
+ * is left, other threads steal from the top with one CAS. Follows the C11 version of
+ * Lê, Pop, Cohen and Zappa Nardelli ("Correct and efficient work-stealing for weak
+ * memory models").
+ *
+ * The ring doesn't grow : growing needs the old arrays to be reclaimed once no thief
+ * reads them anymore, a full deque reports MPMC_FULL and the owner spills somewhere
+ * else instead (see executor.h).
+ */
+
+/// @brief deque_steal lost a race, the deque may still hold items.
+#define DEQUE_ABORT -5
+
+typedef struct
+{
+    // owner
+    alignas(MPMC_CACHE_LINE) _Atomic(int64_t) bottom;
+    // thieves
+    alignas(MPMC_CACHE_LINE) _Atomic(int64_t) top;
+    // read-only after init
+    alignas(MPMC_CACHE_LINE) _Atomic(void *) *items;
+    int64_t mask; // capacity - 1
+} deque_t;
+
+/**
+ * @brief Initialize an empty deque of `capacity` pointers.
+ *
+ * @param capacity Must be a power of two.
+ * @return MPMC_OK on success, MPMC_INIT_FAILED on allocation failure or bad arguments.
+ */
+int deque_init(deque_t *deque, int capacity);
+/**
+ * @brief Push `item` at the bottom, owner only.
+ *
+ * @return MPMC_OK on success, MPMC_FULL if the deque is full.
+ */
+int deque_push(deque_t *deque, void *item);
+/**
+ * @brief Pop the most recently pushed item, owner only.
+ *
+ * @return MPMC_OK on success, MPMC_EMPTY if the deque is empty.
+ */
+int deque_pop(deque_t *deque, void **item);
+/**
+ * @brief Steal the oldest item, any thread.
+ *
+ * @return MPMC_OK on success, MPMC_EMPTY if the deque is empty,
+ *         DEQUE_ABORT if another thread took the item first.
+ */
+int deque_steal(deque_t *deque, void **item);
+/**
+ * @brief Number of items, only a hint while other threads use the deque.
+ */
+int deque_size(deque_t *deque);
+/**
+ * @brief Free the ring.
+ *
+ * @warning No thread may use the deque during or after this call.
+ */
+void deque_destroy(deque_t *deque);
+
+#endif
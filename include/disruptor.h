@@ -0,0 +1,172 @@
+#ifndef DISRUPTOR_H
+#define DISRUPTOR_H
+
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include "mpmc.h"
+#include "parker.h"
+#include "adaptive.h"
+
+/**
+ * @file disruptor.h
+ * @brief Multicast ring buffer with sequence barriers (LMAX disruptor style).
+ *
+ * Every message is written once into an inline mpmc_cell_t and read by every
+ * consumer, instead of being copied into one queue per consumer. A consumer only
+ * moves its own cursor (no CAS) and drains everything published up to it in batches.
+ *
+ * Consumers can depend on other consumers : a dependent consumer only sees the
+ * messages all of its dependencies released, so stages can form pipelines and
+ * diamonds, and an upstream stage may annotate a message in place for the next ones.
+ * Producers are gated by the slowest consumer, a cell is reused only once every
+ * consumer released it.
+ *
+ * Sequences are unbounded positions, message `seq` lives in cell `seq & (capacity - 1)`.
+ */
+
+/// @brief Upper bound on the consumers of a ring.
+#define DISRUPTOR_MAX_CONSUMERS 16
+/// @brief Upper bound on the dependencies of a consumer.
+#define DISRUPTOR_MAX_DEPS 4
+
+typedef struct disruptor_t disruptor_t;
+typedef struct disruptor_consumer_t disruptor_consumer_t;
+
+/**
+ * @brief A consumer (a pipeline stage) of a ring.
+ *
+ * A consumer is owned by a single thread at a time, several threads that want
+ * every message each need their own consumer.
+ */
+struct disruptor_consumer_t
+{
+    // every message before it was released by this consumer
+    alignas(MPMC_CACHE_LINE) atomic_size_t cursor;
+    // read-only after disruptor_add_consumer
+    alignas(MPMC_CACHE_LINE) disruptor_t *ring;
+    disruptor_consumer_t *deps[DISRUPTOR_MAX_DEPS];
+    int dep_count;
+    int downstream; // another consumer depends on this one, releases must wake it
+};
+
+struct disruptor_t
+{
+    // read-only after init
+    alignas(MPMC_CACHE_LINE) unsigned char *buffer;
+    size_t item_size;
+    size_t stride; // bytes between cells, a multiple of MPMC_CELL_ALIGN
+    size_t mask;   // capacity - 1, the capacity is a power of two
+    int capacity;
+    int mode; // MPMC_MODE, only the producer side matters
+    disruptor_consumer_t *consumers[DISRUPTOR_MAX_CONSUMERS];
+    int consumer_count;
+    // producers
+    alignas(MPMC_CACHE_LINE) atomic_size_t claim; // next sequence to hand out
+    // slowest consumer cursor seen by a producer, recomputed only when it looks full
+    alignas(MPMC_CACHE_LINE) atomic_size_t gate;
+    // blocked consumers, woken by publishes and by the releases of their dependencies
+    alignas(MPMC_CACHE_LINE) eventcount_t consumer_event;
+    adaptive_t consumer_wait;
+    // blocked producers, woken by releases
+    alignas(MPMC_CACHE_LINE) eventcount_t producer_event;
+    adaptive_t producer_wait;
+};
+
+/**
+ * @brief Initialize a ring of `capacity` cells of `item_size` bytes.
+ *
+ * @param capacity Number of cells, must be a power of two.
+ * @param mode MPMC_MODE_MPMC, or MPMC_MODE_SPMC if a single thread publishes
+ *             (the claim is then a plain store instead of a CAS).
+ * @return MPMC_OK on success, MPMC_INIT_FAILED on allocation failure or bad arguments.
+ */
+int disruptor_init(disruptor_t *ring, int capacity, int item_size, int mode);
+/**
+ * @brief Register a consumer that sees the messages released by every consumer of `deps`.
+ *
+ * With no dependency the consumer sees every published message.
+ *
+ * @warning Consumers must be added before the first message is published.
+ *
+ * @param deps Consumers of the same ring that must release a message first, may be NULL if `dep_count` is 0.
+ * @return MPMC_OK, or MPMC_INIT_FAILED if there are too many consumers or dependencies.
+ */
+int disruptor_add_consumer(disruptor_t *ring, disruptor_consumer_t *consumer,
+                           disruptor_consumer_t **deps, int dep_count);
+
+/**
+ * @brief Claim up to `count` consecutive cells (non-blocking).
+ *
+ * @param seq Receives the sequence of the first claimed cell.
+ * @return Number of cells claimed, 0 if the slowest consumer holds every free cell.
+ */
+int disruptor_claim(disruptor_t *ring, int count, size_t *seq);
+/**
+ * @brief Claim between 1 and `count` consecutive cells, waiting while the ring is full.
+ *
+ * @return Number of cells claimed.
+ */
+int disruptor_claim_block(disruptor_t *ring, int count, size_t *seq);
+/**
+ * @brief Storage of message `seq`, ring->item_size bytes.
+ *
+ * Valid for a producer between the claim and the publish of `seq`,
+ * and for a consumer between the poll and the release of `seq`.
+ */
+static inline void *disruptor_get(disruptor_t *ring, size_t seq)
+{
+    return ((mpmc_cell_t *)(ring->buffer + (seq & ring->mask) * ring->stride))->data;
+}
+/**
+ * @brief Make `count` claimed cells starting at `seq` visible to the consumers.
+ *
+ * Claims of different producers may be published in any order, a consumer
+ * stops at the first cell that is not published yet.
+ */
+void disruptor_publish(disruptor_t *ring, size_t seq, int count);
+/**
+ * @brief Copy `message` into the next cell and publish it (non-blocking).
+ *
+ * @return MPMC_OK on success, MPMC_FULL if the ring is full.
+ */
+int disruptor_send(disruptor_t *ring, void *message);
+/**
+ * @brief Copy `message` into the next cell and publish it, waiting while the ring is full.
+ *
+ * @return MPMC_OK.
+ */
+int disruptor_send_block(disruptor_t *ring, void *message);
+
+/**
+ * @brief Take the batch of messages available to `consumer` (non-blocking).
+ *
+ * Available means published and released by every dependency. The messages are
+ * read in place with disruptor_get and handed back with disruptor_release.
+ *
+ * @param max Maximum number of messages.
+ * @param seq Receives the sequence of the first message.
+ * @return Number of messages in the batch, 0 if nothing is available.
+ */
+int disruptor_poll(disruptor_consumer_t *consumer, int max, size_t *seq);
+/**
+ * @brief Take between 1 and `max` messages, waiting while nothing is available.
+ *
+ * @return Number of messages in the batch.
+ */
+int disruptor_poll_block(disruptor_consumer_t *consumer, int max, size_t *seq);
+/**
+ * @brief Release the first `count` messages of the last batch.
+ *
+ * Released messages become visible to the dependent consumers, and their cells
+ * go back to the producers once every consumer released them.
+ */
+void disruptor_release(disruptor_consumer_t *consumer, int count);
+/**
+ * @brief Free the ring buffer.
+ *
+ * @warning No thread may use the ring or its consumers during or after this call.
+ */
+void disruptor_destroy(disruptor_t *ring);
+
+#endif
@@ -0,0 +1,95 @@
+#ifndef EXECUTOR_H
+#define EXECUTOR_H
+
+#include <pthread.h>
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include "deque.h"
+#include "parker.h"
+#include "segqueue.h"
+
+/**
+ * @file executor.h
+ * @brief Work-stealing thread pool.
+ *
+ * Every worker owns a deque (see deque.h) : a task spawned from a worker is pushed there
+ * and popped back by the same worker, without touching any shared index. Tasks spawned
+ * from outside the pool, and tasks that don't fit in a full deque, go to a shared
+ * unbounded injector (a segqueue_t). A worker out of work steals from the other
+ * deques, starting at a random one.
+ *
+ * Idle workers sleep on their parker_t. To avoid waking every sleeper on every spawn,
+ * the pool counts the workers that are "searching" (stealing), a spawn only wakes a
+ * sleeper when nobody is searching, and a searcher that finds work wakes the next one
+ * only if it was the last searcher (like tokio and go's scheduler).
+ * At most half of the workers search at the same time.
+ */
+
+/// @brief Tasks every worker deque holds before spilling to the injector.
+#ifndef EXECUTOR_DEQUE_CAPACITY
+#define EXECUTOR_DEQUE_CAPACITY 256
+#endif
+/// @brief A worker looks at the injector before its own deque once per this many tasks,
+/// so tasks spawned from outside can't be starved by a worker feeding itself.
+#define EXECUTOR_INJECTOR_INTERVAL 61
+
+/**
+ * @brief A unit of work, embed it in your own struct (intrusive, the pool never allocates).
+ */
+typedef struct executor_task_t executor_task_t;
+struct executor_task_t
+{
+    void (*run)(executor_task_t *task);
+};
+
+typedef struct executor_t executor_t;
+typedef struct
+{
+    deque_t deque;
+    parker_t parker;
+    executor_t *executor;
+    pthread_t thread;
+    uint32_t seed; // xorshift state of the random steals
+    int index;
+    int idle;  // TRUE while in the idle list, protected by idle_mutex
+    int ticks; // tasks run, see EXECUTOR_INJECTOR_INTERVAL
+} executor_worker_t;
+
+struct executor_t
+{
+    // read-only after init
+    alignas(MPMC_CACHE_LINE) executor_worker_t *workers;
+    int count;
+    segqueue_t injector;
+    alignas(MPMC_CACHE_LINE) atomic_int searching; // workers stealing right now
+    atomic_int idle;                               // workers in the idle list, readable without the mutex
+    atomic_int shutdown;
+    // sleeping workers, a stack of indices
+    pthread_mutex_t idle_mutex;
+    int *idle_list;
+    int idle_count;
+};
+
+/**
+ * @brief Start a pool of `workers` threads.
+ *
+ * @return MPMC_OK on success, MPMC_INIT_FAILED on allocation or thread creation failure.
+ */
+int executor_init(executor_t *executor, int workers);
+/**
+ * @brief Run `task` on the pool, any thread.
+ *
+ * From a worker of the pool the task goes to the worker's own deque, otherwise to
+ * the injector. `task` must stay valid until its run function was called.
+ */
+void executor_spawn(executor_t *executor, executor_task_t *task);
+/**
+ * @brief Stop the workers and free the pool.
+ *
+ * Tasks that are running are finished, tasks still queued are dropped (never run).
+ * Must not be called from a worker of the pool.
+ */
+void executor_shutdown(executor_t *executor);
+
+#endif
@@ -0,0 +1,89 @@
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+
+/**
+ * @file histogram.h
+ * @brief Lock-free log-linear histogram of 64 bit values (HDR histogram style).
+ *
+ * Values are bucketed by their power of two, and every power of two is split in
+ * HISTOGRAM_SUB_BUCKETS linear sub-buckets, so a bucket covers at most
+ * 1/HISTOGRAM_SUB_BUCKETS of its value (about 3%) whatever the magnitude.
+ * Values below HISTOGRAM_SUB_BUCKETS get a bucket each.
+ *
+ * Recording is a relaxed fetch_add on the bucket (plus a load of the max),
+ * there is no shared total to fight over, counts and means are computed
+ * from the buckets when read. Any thread may record, read or merge at any
+ * time, a read that runs concurrently with records is not a single point
+ * in time snapshot.
+ */
+
+#define HISTOGRAM_SUB_BITS 5
+#define HISTOGRAM_SUB_BUCKETS (1 << HISTOGRAM_SUB_BITS)
+#define HISTOGRAM_BUCKETS ((64 - HISTOGRAM_SUB_BITS + 1) * HISTOGRAM_SUB_BUCKETS)
+
+typedef struct
+{
+    atomic_uint_fast64_t counts[HISTOGRAM_BUCKETS];
+    atomic_uint_fast64_t max;
+} histogram_t;
+
+static inline int histogram_bucket(uint64_t value)
+{
+    if (value < HISTOGRAM_SUB_BUCKETS)
+        return (int)value;
+    // the top HISTOGRAM_SUB_BITS + 1 bits of the value pick the bucket
+    int shift = 63 - __builtin_clzll(value) - HISTOGRAM_SUB_BITS;
+    return shift * HISTOGRAM_SUB_BUCKETS + (int)(value >> shift);
+}
+/**
+ * @brief Add one `value` to the histogram.
+ */
+static inline void histogram_record(histogram_t *histogram, uint64_t value)
+{
+    atomic_fetch_add_explicit(&histogram->counts[histogram_bucket(value)], 1, memory_order_relaxed);
+    uint64_t max = atomic_load_explicit(&histogram->max, memory_order_relaxed);
+    while (value > max &&
+           !atomic_compare_exchange_weak_explicit(&histogram->max, &max, value, memory_order_relaxed, memory_order_relaxed))
+        ;
+}
+
+/**
+ * @brief Empty the histogram.
+ *
+ * Also used to initialize one. Values recorded while it runs may be partly lost.
+ */
+void histogram_reset(histogram_t *histogram);
+/**
+ * @brief Add every value of `src` to `dst`.
+ */
+void histogram_merge(histogram_t *dst, histogram_t *src);
+/**
+ * @brief Smallest value of the bucket `bucket`.
+ */
+uint64_t histogram_bucket_value(int bucket);
+/**
+ * @brief Value below which `percentile` percent of the recorded values fall.
+ *
+ * @param percentile Between 0 and 100, 50 is the median.
+ * @return The lower bound of the bucket holding that value, 0 if the histogram is empty.
+ */
+uint64_t histogram_percentile(histogram_t *histogram, double percentile);
+/**
+ * @brief Number of recorded values.
+ */
+uint64_t histogram_count(histogram_t *histogram);
+/**
+ * @brief Mean of the recorded values, 0 if the histogram is empty.
+ *
+ * Every value counts as the middle of its bucket, so this is as precise as the buckets.
+ */
+double histogram_mean(histogram_t *histogram);
+/**
+ * @brief Largest recorded value, exact.
+ */
+uint64_t histogram_max(histogram_t *histogram);
+
+#endif
@@ -1,8 +1,13 @@
 #ifndef MPMC_H
 #define MPMC_H
 
+#include <stdalign.h>
 #include <stdatomic.h>
+#include <stddef.h>
 #include "parker.h"
+#include "adaptive.h"
+#include "stats.h"
+#include "histogram.h"
 typedef enum
 {
     MPMC_OK = 0,
@@ -11,24 +16,108 @@ typedef enum
     MPMC_INIT_FAILED = -3,
 
 } MPMC_RESULT;
-// TODO -> proper align
+/**
+ * @brief Which sides of the queue may be shared between threads.
+ *
+ * A single producer/consumer side skips the CAS on its index, SPSC drops the
+ * per-cell sequence protocol and only exchanges head/tail.
+ * Using a single side from more than one thread at a time is undefined.
+ */
+typedef enum
+{
+    MPMC_MODE_MPMC = 0,
+    MPMC_MODE_SPMC = 1, // single producer
+    MPMC_MODE_MPSC = 2, // single consumer
+    MPMC_MODE_SPSC = 3, // single producer, single consumer
+} MPMC_MODE;
+#define MPMC_SINGLE_PRODUCER 1
+#define MPMC_SINGLE_CONSUMER 2
+#ifndef MPMC_CACHE_LINE
+#define MPMC_CACHE_LINE 64
+#endif
+// cells are padded to this boundary, define MPMC_CELL_PER_LINE to give
+// every cell its own cache line(s) so neighbouring cells never false-share
+#ifdef MPMC_CELL_PER_LINE
+#define MPMC_CELL_ALIGN MPMC_CACHE_LINE
+#else
+#define MPMC_CELL_ALIGN alignof(max_align_t)
+#endif
+// how many selectors may watch each side of a queue, see mpmc_select
+#ifndef MPMC_WATCHERS
+#define MPMC_WATCHERS 4
+#endif
+#if MPMC_WATCHERS > 31
+#error "MPMC_WATCHERS must leave a bit of the watched mask for the eventfd"
+#endif
 typedef struct
 {
-    atomic_size_t seq;    // sequence number
-    unsigned char data[]; // inline storage for item
+    atomic_size_t seq;                         // sequence number
+    alignas(max_align_t) unsigned char data[]; // inline storage for item
 } mpmc_cell_t;
 typedef struct
 {
-    mpmc_cell_t *buffer;
-    atomic_size_t tail;
-    atomic_size_t head;
+    // read-only after init
+    alignas(MPMC_CACHE_LINE) unsigned char *buffer; // cells, NULL for a shared queue (they follow the header)
+    size_t shared_size;                             // bytes of the shared region holding the queue, 0 if private
     size_t item_size;
+    size_t stride; // bytes between cells, a multiple of MPMC_CELL_ALIGN
+    size_t mask;   // capacity - 1 when capacity is a power of two, 0 otherwise
     int capacity;
-    parker_t recv_parker;
-    atomic_size_t recv_waiting;
-    parker_t send_parker;
-    atomic_size_t send_waiting;
+    int mode; // MPMC_MODE
+#ifdef MPMC_LATENCY
+    uint64_t *stamps;     // publish time of every cell, NULL until mpmc_latency_enable
+    histogram_t *latency; // time the messages spent in the queue
+    size_t sample_mask;   // only cells whose index & sample_mask is 0 are timed
+#endif
+    // producers
+    alignas(MPMC_CACHE_LINE) atomic_size_t tail;
+    size_t cached_head;  // SPSC : last head seen by the producer
+    size_t claimed_tail; // SPSC : next position to hand out, tail is the published one
+    // consumers
+    alignas(MPMC_CACHE_LINE) atomic_size_t head;
+    size_t cached_tail;  // SPSC : last tail seen by the consumer
+    size_t claimed_head; // SPSC : next position to hand out, head is the released one
+    // blocked receivers, checked by producers after every send
+    alignas(MPMC_CACHE_LINE) eventcount_t recv_event;
+    adaptive_t recv_wait;
+    // bit i : recv_watchers[i] is set, bit MPMC_WATCHERS : recv_fd is,
+    // a publish loads it first, a queue nobody watches stops there
+    atomic_uint recv_watched;
+    _Atomic(eventcount_t *) recv_watchers[MPMC_WATCHERS]; // selectors waiting for a message, NULL if unused
+    atomic_int recv_fd;     // eventfd readable once there are messages, -1 unless enabled
+    atomic_int recv_armed;  // the next publish writes recv_fd, see mpmc_eventfd_ack
+    // blocked senders, checked by consumers after every recv
+    alignas(MPMC_CACHE_LINE) eventcount_t send_event;
+    adaptive_t send_wait;
+    atomic_uint send_watched;
+    _Atomic(eventcount_t *) send_watchers[MPMC_WATCHERS]; // selectors waiting for a free cell
+    atomic_int send_fd;     // eventfd readable once there are free cells
+    atomic_int send_armed;
+#ifdef SYNC_STATS
+    stats_t stats;
+#endif
 } mpmc_t;
+/**
+ * @brief Contention counters of a queue, see mpmc_stats_snapshot.
+ *
+ * The claims of the blocking calls count too, a blocked send that retries
+ * three times before it gets a cell adds three `send_full`.
+ */
+typedef struct
+{
+    uint64_t send_cas_retry;      // lost races on the tail
+    uint64_t recv_cas_retry;      // lost races on the head
+    uint64_t send_spin_exhausted; // sends that gave up after too many lost races
+    uint64_t recv_spin_exhausted;
+    uint64_t send_full;  // claims that found no free cell
+    uint64_t recv_empty; // claims that found no message
+    uint64_t send_park;  // blocked senders that went to sleep
+    uint64_t recv_park;
+    uint64_t send_unpark; // notifications that found a registered sender, it may not have slept yet
+    uint64_t recv_unpark;
+    uint64_t send_wake_ns; // total time from the notification to the sender running again
+    uint64_t recv_wake_ns;
+} mpmc_stats_t;
 /**
  * @brief Receive a message from the MPMC queue (non-blocking).
  *
@@ -68,11 +157,38 @@ int mpmc_send(mpmc_t *queue, void *message);
  * @return MPMC_OK on success, MPMC_INIT_FAILED on allocation failure.
  */
 int mpmc_init(mpmc_t *queue, int capacity, int item_size);
+/**
+ * @brief Initialize a bounded queue specialized for the given producer/consumer mode.
+ *
+ * Same as mpmc_init, but a side declared single (see MPMC_MODE) must only be
+ * used by one thread at a time. The whole api, blocking, batch and zero-copy calls
+ * included, works in every mode.
+ *
+ * @note In MPMC_MODE_SPSC reserved/peeked slots must be committed/released
+ *       in the order they were obtained.
+ *
+ * @param mode One of MPMC_MODE.
+ * @return MPMC_OK on success, MPMC_INIT_FAILED on allocation failure or bad arguments.
+ */
+int mpmc_init_mode(mpmc_t *queue, int capacity, int item_size, int mode);
+/**
+ * @brief Initialize a bounded queue whose blocking calls wait with `strategy`.
+ *
+ * Same as mpmc_init_mode, mpmc_init and mpmc_init_mode use wait_hybrid().
+ * Both sides of the queue use the same strategy.
+ *
+ * @param strategy One of wait_hybrid(), wait_busy_spin(), wait_yield(),
+ *                 wait_park() or wait_timed_park(ns), see wait.h.
+ * @return MPMC_OK on success, MPMC_INIT_FAILED on allocation failure or bad arguments.
+ */
+int mpmc_init_wait(mpmc_t *queue, int capacity, int item_size, int mode, wait_strategy_t strategy);
 /**
  * @brief Enqueues a message into the MPMC queue.
  *
  * This function will wait the calling thread if the queue is full,
- * until space becomes available.
+ * until space becomes available. Like every blocking call, it spins,
+ * then yields, then parks (see adaptive.h), unless the queue was given
+ * another wait strategy (see mpmc_init_wait).
  *
  * @param queue Pointer to an initialized MPMC queue.
  * @param message Pointer to the message to enqueue. Must be at least
@@ -98,5 +214,360 @@ int mpmc_send_block(mpmc_t *queue, void *message);
  *       Never returns MPMC_EMPTY because it blocks until a message is available.
  */
 int mpmc_recv_block(mpmc_t *queue, void *message);
+/**
+ * @brief Send up to `count` messages to the MPMC queue (non-blocking).
+ *
+ * Claims a run of consecutive free cells with a single CAS on the tail,
+ * copies the messages in and publishes each cell. A single notification
+ * wakes at most one parked receiver per message.
+ *
+ * @param queue Pointer to the MPMC queue.
+ * @param items Array of `count` messages, each queue->item_size bytes.
+ * @param count Number of messages in `items`.
+ * @return Number of messages sent from the front of `items`, 0 if the queue is full.
+ */
+int mpmc_send_many(mpmc_t *queue, void *items, int count);
+/**
+ * @brief Receive up to `max` messages from the MPMC queue (non-blocking).
+ *
+ * Claims a run of consecutive ready cells with a single CAS on the head.
+ *
+ * @param queue Pointer to the MPMC queue.
+ * @param items Buffer with room for `max` messages of queue->item_size bytes.
+ * @param max Maximum number of messages to receive.
+ * @return Number of messages received, 0 if the queue is empty.
+ */
+int mpmc_recv_many(mpmc_t *queue, void *items, int max);
+/**
+ * @brief Send all `count` messages, waiting whenever the queue is full.
+ *
+ * Messages are sent in batches as space becomes available, so messages of
+ * other producers may be interleaved between batches.
+ *
+ * @return int Returns MPMC_OK once every message was sent.
+ */
+int mpmc_send_many_block(mpmc_t *queue, void *items, int count);
+/**
+ * @brief Receive between 1 and `max` messages, waiting while the queue is empty.
+ *
+ * @param max Maximum number of messages to receive, must be greater than 0.
+ * @return int Number of messages received.
+ */
+int mpmc_recv_many_block(mpmc_t *queue, void *items, int max);
+
+/*
+ * Zero-copy api : instead of copying through `message`, the caller works directly
+ * on the cell storage (`slot`, queue->item_size bytes).
+ *
+ * A reserved cell is published only by mpmc_send_commit, and a peeked cell is
+ * handed back to producers only by mpmc_recv_release, cells are still consumed
+ * in order, so a slot that is held for long stalls the cells behind it.
+ */
+
+/**
+ * @brief Reserve the next free cell for in place writing (non-blocking).
+ *
+ * @param queue Pointer to the MPMC queue.
+ * @param slot Receives a pointer to the cell storage.
+ * @return MPMC_OK on success, MPMC_FULL if the queue is full.
+ */
+int mpmc_send_reserve(mpmc_t *queue, void **slot);
+/**
+ * @brief Reserve the next free cell, waiting while the queue is full.
+ *
+ * @return int Returns MPMC_OK.
+ */
+int mpmc_send_reserve_block(mpmc_t *queue, void **slot);
+/**
+ * @brief Reserve up to `max` consecutive free cells with one CAS (non-blocking).
+ *
+ * @return Number of slots written to `slots`, 0 if the queue is full.
+ */
+int mpmc_send_reserve_many(mpmc_t *queue, void **slots, int max);
+/**
+ * @brief Reserve between 1 and `max` cells, waiting while the queue is full.
+ *
+ * @return Number of slots written to `slots`.
+ */
+int mpmc_send_reserve_many_block(mpmc_t *queue, void **slots, int max);
+/**
+ * @brief Publish a cell obtained from one of the reserve functions.
+ *
+ * @param slot Pointer returned by the reserve call, must be committed exactly once.
+ */
+void mpmc_send_commit(mpmc_t *queue, void *slot);
+/**
+ * @brief Publish `count` reserved cells, with a single notification.
+ */
+void mpmc_send_commit_many(mpmc_t *queue, void **slots, int count);
+
+/**
+ * @brief Take the next message for in place reading (non-blocking).
+ *
+ * @param queue Pointer to the MPMC queue.
+ * @param slot Receives a pointer to the cell storage.
+ * @return MPMC_OK on success, MPMC_EMPTY if the queue is empty.
+ */
+int mpmc_recv_peek(mpmc_t *queue, void **slot);
+/**
+ * @brief Take the next message for in place reading, waiting while the queue is empty.
+ *
+ * @return int Returns MPMC_OK.
+ */
+int mpmc_recv_peek_block(mpmc_t *queue, void **slot);
+/**
+ * @brief Take up to `max` consecutive messages with one CAS (non-blocking).
+ *
+ * @return Number of slots written to `slots`, 0 if the queue is empty.
+ */
+int mpmc_recv_peek_many(mpmc_t *queue, void **slots, int max);
+/**
+ * @brief Take between 1 and `max` messages, waiting while the queue is empty.
+ *
+ * @return Number of slots written to `slots`.
+ */
+int mpmc_recv_peek_many_block(mpmc_t *queue, void **slots, int max);
+/**
+ * @brief Hand a peeked cell back to the producers.
+ *
+ * @param slot Pointer returned by the peek call, must be released exactly once.
+ *             The storage must not be touched after this call.
+ */
+void mpmc_recv_release(mpmc_t *queue, void *slot);
+/**
+ * @brief Hand `count` peeked cells back, with a single notification.
+ */
+void mpmc_recv_release_many(mpmc_t *queue, void **slots, int count);
+/**
+ * @brief TRUE if the next message of the queue isn't published yet.
+ *
+ * Only a hint while other threads use the queue. Unlike a failed mpmc_recv, which may
+ * give up after losing too many races, FALSE means a message really was there.
+ */
+int mpmc_empty(mpmc_t *queue);
+/**
+ * @brief Read how the blocking calls of the queue ended their waits.
+ *
+ * @param send Counters of the waits for free cells, may be NULL.
+ * @param recv Counters of the waits for messages, may be NULL.
+ */
+void mpmc_wait_stats(mpmc_t *queue, adaptive_stats_t *send, adaptive_stats_t *recv);
+/**
+ * @brief Read the contention counters of the queue.
+ *
+ * The counters are only kept when the library is built with SYNC_STATS,
+ * otherwise every field reads 0.
+ *
+ * @param queue Pointer to the MPMC queue.
+ * @param stats Receives the counters, summed over the per-thread shards.
+ */
+void mpmc_stats_snapshot(mpmc_t *queue, mpmc_stats_t *stats);
+
+/*
+ * Latency api : with MPMC_LATENCY defined, a queue can record how long every message
+ * stays in it, from the send (or commit) to the recv (or release), in nanoseconds.
+ * Senders stamp the cells in a side array, receivers record the difference in a
+ * histogram owned by the queue. Without MPMC_LATENCY nothing of it is compiled in,
+ * and a queue that was never enabled only pays a NULL check per batch.
+ * Reading the clock is the main cost, sampling a message out of a few keeps
+ * the recording cheap enough to leave on.
+ */
+
+/**
+ * @brief Start recording the time messages spend in the queue.
+ *
+ * @warning Must be called before the queue is shared with other threads.
+ *
+ * @param sample Time one message out of `sample` (rounded up to a power of two),
+ *               1 times every message. Sampled messages are picked by cell, so
+ *               with a capacity below `sample` only the first cell is timed.
+ *
+ * @return MPMC_OK on success, MPMC_INIT_FAILED on allocation failure
+ *         or if the library was built without MPMC_LATENCY.
+ */
+int mpmc_latency_enable(mpmc_t *queue, int sample);
+/**
+ * @brief Add the recorded latencies to `histogram`.
+ *
+ * Merging lets several queues (or several reads) be summed into one histogram,
+ * reset `histogram` first to get the queue alone. Adds nothing if recording is off.
+ */
+void mpmc_latency_read(mpmc_t *queue, histogram_t *histogram);
+/**
+ * @brief Forget the latencies recorded so far.
+ */
+void mpmc_latency_reset(mpmc_t *queue);
+
+/*
+ * Select api : a single thread waits on a set of queues at once, for a message to
+ * receive or a free cell to send into, and the first operation that can be done is.
+ *
+ * The selector owns one eventcount, registered on every queue it watches next to
+ * the queue's own recv_event/send_event, so a publish wakes the selector as well as
+ * the threads blocked in the queue itself. A queue nobody selects on only pays a
+ * load of its watched mask on every notification, the slots are only walked for
+ * the bits that are set.
+ * Cases are tried round robin, starting after the one that completed last, so every
+ * ready case completes within `count` selects however busy the others are.
+ */
+
+#define MPMC_SELECT_RECV 0
+#define MPMC_SELECT_SEND 1
+#ifndef MPMC_SELECT_MAX
+#define MPMC_SELECT_MAX 64
+#endif
+typedef struct
+{
+    mpmc_t *queue;
+    int op;        // MPMC_SELECT_RECV or MPMC_SELECT_SEND
+    void *message; // buffer receiving the message, or message to send
+} mpmc_select_case_t;
+/**
+ * @brief A set of queue operations waited on together, owned by a single thread.
+ */
+typedef struct
+{
+    mpmc_select_case_t cases[MPMC_SELECT_MAX];
+    int count;
+    int next; // first case tried by the next select
+    alignas(MPMC_CACHE_LINE) eventcount_t event;
+    adaptive_t wait;
+} mpmc_selector_t;
+/**
+ * @brief Initialize an empty selector.
+ */
+void mpmc_selector_init(mpmc_selector_t *selector);
+/**
+ * @brief Add a receive (MPMC_SELECT_RECV) or send (MPMC_SELECT_SEND) on `queue`.
+ *
+ * @warning Registers the selector on the queue, must be called while no other
+ *          thread uses `queue`, like mpmc_selector_destroy.
+ *
+ * @param message Buffer of queue->item_size bytes the message is received into,
+ *                or message sent, read on every select until the case completes.
+ * @return The index of the case, reported by mpmc_select, or MPMC_INIT_FAILED if the
+ *         selector is full or the queue already has MPMC_WATCHERS selectors on that side.
+ */
+int mpmc_selector_add(mpmc_selector_t *selector, mpmc_t *queue, int op, void *message);
+/**
+ * @brief Complete one ready case (non-blocking).
+ *
+ * @return The index of the case that completed, MPMC_EMPTY if none was ready.
+ */
+int mpmc_select(mpmc_selector_t *selector);
+/**
+ * @brief Complete one case, waiting until one is ready.
+ *
+ * Spins, yields then parks like the blocking calls of the queues (see adaptive.h).
+ *
+ * @return The index of the case that completed.
+ */
+int mpmc_select_block(mpmc_selector_t *selector);
+/**
+ * @brief Unregister the selector from its queues.
+ *
+ * @warning No other thread may use the queues during this call, nor until it returns
+ *          may a publish that started before it still be running : a publisher may
+ *          notify the selector after its slot was cleared.
+ */
+void mpmc_selector_destroy(mpmc_selector_t *selector);
+
+/*
+ * Eventfd api (linux) : an event loop waits for a queue with epoll instead of a thread
+ * parked in mpmc_recv_block. The queue owns an eventfd per side, both signal readiness
+ * by becoming readable (poll them for EPOLLIN) :
+ *
+ *     fd = mpmc_eventfd(queue, MPMC_EVENTFD_READ);     // add to the epoll set
+ *     on EPOLLIN :
+ *         mpmc_eventfd_ack(queue, MPMC_EVENTFD_READ);
+ *         while (mpmc_recv_many(queue, items, n) > 0) ...
+ *
+ * Writes are edge coalesced : only the first publish after an ack writes the fd,
+ * so a busy queue costs its senders one load per send and nothing more.
+ * The loop must drain (or refill) until the queue stops being ready after every ack,
+ * otherwise it may not be woken again.
+ */
+
+#define MPMC_EVENTFD_READ 1  // the fd becomes readable when the queue has messages
+#define MPMC_EVENTFD_WRITE 2 // the fd becomes readable when the queue has free cells
+/**
+ * @brief Create the eventfds of `events` (MPMC_EVENTFD_READ and/or MPMC_EVENTFD_WRITE).
+ *
+ * A side that is already ready starts with its fd readable.
+ *
+ * @warning Must be called before the queue is shared with other threads.
+ *
+ * @return MPMC_OK on success, MPMC_INIT_FAILED if an eventfd couldn't be created
+ *         or off linux.
+ */
+int mpmc_eventfd_enable(mpmc_t *queue, int events);
+/**
+ * @brief The eventfd of one side, -1 if it wasn't enabled.
+ *
+ * @param event MPMC_EVENTFD_READ or MPMC_EVENTFD_WRITE.
+ */
+int mpmc_eventfd(mpmc_t *queue, int event);
+/**
+ * @brief Consume the readiness of one side and re-arm it, call before draining.
+ *
+ * A publish that the drain may miss after this call writes the fd again.
+ *
+ * @param event MPMC_EVENTFD_READ or MPMC_EVENTFD_WRITE.
+ */
+void mpmc_eventfd_ack(mpmc_t *queue, int event);
+
+/*
+ * Shared api : the queue header and its cells laid out in one region, mapped by several
+ * processes. The region holds no pointer (the cells are found by offset) and the blocking
+ * calls sleep on process-shared futexes, so the fast path is the same as in process.
+ *
+ * creator :                                      other process :
+ *     fd = mpmc_shared_create("jobs", 1024,          mpmc_shared_attach(fd, &queue);
+ *                             sizeof(job_t),         mpmc_recv_block(queue, &job);
+ *                             MPMC_MODE_MPMC, &queue);
+ *     pass fd (fork, SCM_RIGHTS, /proc)
+ *     mpmc_send_block(queue, &job);
+ *
+ * Every process must be built with the same MPMC_* / SYNC_STATS flags. Selectors, eventfds
+ * and latency recording hold per-process pointers or fds, they are refused on a shared queue.
+ */
+
+/**
+ * @brief Bytes needed by mpmc_init_shared for a queue of `capacity` items of `item_size` bytes.
+ */
+size_t mpmc_shared_size(int capacity, int item_size);
+/**
+ * @brief Initialize a queue at the start of a caller provided shared region.
+ *
+ * @param queue Start of the region, aligned to MPMC_CACHE_LINE, mapped MAP_SHARED
+ *              (or placed in memory the processes otherwise share).
+ * @param size Bytes of the region, at least mpmc_shared_size(capacity, item_size).
+ * @return MPMC_OK on success, MPMC_INIT_FAILED on bad arguments or a region too small.
+ */
+int mpmc_init_shared(mpmc_t *queue, size_t size, int capacity, int item_size, int mode);
+/**
+ * @brief Create a queue in a new memfd and map it.
+ *
+ * @param name Name of the memfd, only for debugging (/proc/<pid>/fd).
+ * @param queue Receives the mapped queue, release it with mpmc_shared_detach.
+ * @return The memfd, to be passed to the other processes, or MPMC_INIT_FAILED.
+ */
+int mpmc_shared_create(const char *name, int capacity, int item_size, int mode, mpmc_t **queue);
+/**
+ * @brief Map the queue living at the start of `fd` (a memfd, shm_open or regular file).
+ *
+ * The fd may be closed once attached.
+ *
+ * @param queue Receives the mapped queue, release it with mpmc_shared_detach.
+ * @return MPMC_OK on success, MPMC_INIT_FAILED if the fd doesn't hold a shared queue
+ *         or can't be mapped.
+ */
+int mpmc_shared_attach(int fd, mpmc_t **queue);
+/**
+ * @brief Unmap a queue obtained from mpmc_shared_create or mpmc_shared_attach.
+ *
+ * The memory goes away with the last mapping and the last fd.
+ */
+void mpmc_shared_detach(mpmc_t *queue);
 void destroy_mpmc(mpmc_t *queue);
 #endif
\ No newline at end of file
@@ -1,8 +1,196 @@
+
 #ifndef PARKER_H
 #define PARKER_H
 
 #include <pthread.h>
 #include <stdatomic.h>
+#include <stdint.h>
+#include <limits.h>
+
+// on linux the parker is a single futex word, define PARKER_USE_PTHREAD to force
+// the portable mutex/condvar implementation.
+#if defined(__linux__) && !defined(PARKER_USE_PTHREAD)
+#define PARKER_FUTEX 1
+#endif
+
+// eventcount state layout : epoch << 32 | number of registered waiters
+#define EVENTCOUNT_EPOCH ((uint64_t)1 << 32)
+#define EVENTCOUNT_WAITERS (EVENTCOUNT_EPOCH - 1)
+
+#ifdef PARKER_FUTEX
+
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include "spin.h"
+
+// how many times park polls the state before going to sleep in the kernel
+#define PARKER_SPIN_LIMIT 64
+
+// state layout : bit 0 is the notification token, the rest count the sleeping threads
+#define PARKER_NOTIFIED 1u
+#define PARKER_SLEEPER 2u
+
+typedef struct
+{
+    _Atomic(uint32_t) state;
+} parker_t;
+typedef struct
+{
+    _Atomic(uint32_t) state;
+} waiter_t;
+
+// `flags` is FUTEX_PRIVATE_FLAG, or 0 for a futex in memory shared between processes
+static inline void futex_wait_flags(_Atomic(uint32_t) *addr, uint32_t expected, int flags)
+{
+    syscall(SYS_futex, addr, FUTEX_WAIT | flags, expected, NULL, NULL, 0);
+}
+static inline void futex_wake_flags(_Atomic(uint32_t) *addr, int count, int flags)
+{
+    syscall(SYS_futex, addr, FUTEX_WAKE | flags, count, NULL, NULL, 0);
+}
+static inline void futex_wait(_Atomic(uint32_t) *addr, uint32_t expected)
+{
+    futex_wait_flags(addr, expected, FUTEX_PRIVATE_FLAG);
+}
+static inline void futex_wake(_Atomic(uint32_t) *addr, int count)
+{
+    futex_wake_flags(addr, count, FUTEX_PRIVATE_FLAG);
+}
+// consume the token if it is set, returns non zero on success
+static inline int futex_park_try(_Atomic(uint32_t) *state)
+{
+    uint32_t current = atomic_load_explicit(state, memory_order_relaxed);
+    while ((current & PARKER_NOTIFIED) != 0)
+    {
+        if (atomic_compare_exchange_weak_explicit(state, &current, current & ~PARKER_NOTIFIED,
+                                                  memory_order_acquire, memory_order_relaxed))
+            return 1;
+    }
+    return 0;
+}
+static inline void futex_park(_Atomic(uint32_t) *state)
+{
+    // the token usually arrives shortly after we gave up, poll a bit before the syscall
+    for (int i = 0; i < PARKER_SPIN_LIMIT; i++)
+    {
+        if (futex_park_try(state))
+            return;
+        CPU_HINT_LOOP();
+    }
+    // register as a sleeper, from now on unpark knows it has to call FUTEX_WAKE
+    uint32_t current = atomic_fetch_add(state, PARKER_SLEEPER) + PARKER_SLEEPER;
+    while (1)
+    {
+        if ((current & PARKER_NOTIFIED) != 0)
+        {
+            // take the token and unregister in one step
+            if (atomic_compare_exchange_weak_explicit(state, &current, (current - PARKER_SLEEPER) & ~PARKER_NOTIFIED,
+                                                      memory_order_acquire, memory_order_relaxed))
+                return;
+            continue;
+        }
+        // NOTE : returns right away if the state changed since we read it
+        futex_wait(state, current);
+        current = atomic_load_explicit(state, memory_order_relaxed);
+    }
+}
+static inline void futex_unpark(_Atomic(uint32_t) *state)
+{
+    uint32_t prev = atomic_fetch_or_explicit(state, PARKER_NOTIFIED, memory_order_release);
+    // only enter the kernel if we produced the token and somebody is actually sleeping
+    if ((prev & PARKER_NOTIFIED) == 0 && prev >= PARKER_SLEEPER)
+        futex_wake(state, 1);
+}
+
+static inline void waiter_init(waiter_t *waiter)
+{
+    atomic_store(&waiter->state, 0);
+}
+// NOTE : the mutex is only needed by the pthread implementation
+static inline void waiter_wait(waiter_t *waiter, pthread_mutex_t *mutex)
+{
+    (void)mutex;
+    futex_park(&waiter->state);
+}
+static inline void waiter_wake(waiter_t *waiter, pthread_mutex_t *mutex)
+{
+    (void)mutex;
+    futex_unpark(&waiter->state);
+}
+static inline void waiter_destroy(waiter_t *waiter)
+{
+    (void)waiter;
+}
+static inline void parker_init(parker_t *parker)
+{
+    atomic_store(&parker->state, 0);
+}
+
+static inline void park(parker_t *parker)
+{
+    futex_park(&parker->state);
+}
+
+static inline void unpark(parker_t *parker)
+{
+    futex_unpark(&parker->state);
+}
+static inline void parker_destroy(parker_t *parker)
+{
+    (void)parker;
+}
+
+// -- eventcount --
+// the futex sleeps on the epoch half of the state
+typedef struct
+{
+    _Atomic(uint64_t) state;
+    int flags; // futex flags, see eventcount_init_shared
+} eventcount_t;
+
+static inline _Atomic(uint32_t) *eventcount_epoch(eventcount_t *ec)
+{
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    return (_Atomic(uint32_t) *)&ec->state + 1;
+#else
+    return (_Atomic(uint32_t) *)&ec->state;
+#endif
+}
+static inline void eventcount_init(eventcount_t *ec)
+{
+    atomic_store(&ec->state, 0);
+    ec->flags = FUTEX_PRIVATE_FLAG;
+}
+// for an eventcount in memory shared between processes, the kernel then keys the futex
+// on the physical page instead of the address
+static inline void eventcount_init_shared(eventcount_t *ec)
+{
+    atomic_store(&ec->state, 0);
+    ec->flags = 0;
+}
+static inline void eventcount_commit_wait(eventcount_t *ec, uint32_t key)
+{
+    while ((uint32_t)(atomic_load(&ec->state) >> 32) == key)
+    {
+        futex_wait_flags(eventcount_epoch(ec), key, ec->flags);
+    }
+    atomic_fetch_sub(&ec->state, 1);
+}
+static inline void eventcount_notify_many(eventcount_t *ec, int count)
+{
+    // fast path : a single load, no waiter registered means nothing to do
+    if ((atomic_load(&ec->state) & EVENTCOUNT_WAITERS) == 0)
+        return;
+    atomic_fetch_add(&ec->state, EVENTCOUNT_EPOCH);
+    futex_wake_flags(eventcount_epoch(ec), count, ec->flags);
+}
+static inline void eventcount_destroy(eventcount_t *ec)
+{
+    (void)ec;
+}
+
+#else
 
 typedef struct
 {
@@ -74,4 +262,97 @@ static inline void parker_destroy(parker_t *parker)
     pthread_cond_destroy(&parker->condvar);
 }
 
-#endif
\ No newline at end of file
+// -- eventcount --
+// the mutex/condvar pair is only touched by sleepers and by notify when someone waits
+typedef struct
+{
+    _Atomic(uint64_t) state;
+    pthread_mutex_t mutex;
+    pthread_cond_t condvar;
+} eventcount_t;
+
+static inline void eventcount_init(eventcount_t *ec)
+{
+    atomic_store(&ec->state, 0);
+    pthread_mutex_init(&ec->mutex, NULL);
+    pthread_cond_init(&ec->condvar, NULL);
+}
+static inline void eventcount_init_shared(eventcount_t *ec)
+{
+    pthread_mutexattr_t mutex_attr;
+    pthread_condattr_t cond_attr;
+    atomic_store(&ec->state, 0);
+    pthread_mutexattr_init(&mutex_attr);
+    pthread_mutexattr_setpshared(&mutex_attr, PTHREAD_PROCESS_SHARED);
+    pthread_mutex_init(&ec->mutex, &mutex_attr);
+    pthread_mutexattr_destroy(&mutex_attr);
+    pthread_condattr_init(&cond_attr);
+    pthread_condattr_setpshared(&cond_attr, PTHREAD_PROCESS_SHARED);
+    pthread_cond_init(&ec->condvar, &cond_attr);
+    pthread_condattr_destroy(&cond_attr);
+}
+static inline void eventcount_commit_wait(eventcount_t *ec, uint32_t key)
+{
+    pthread_mutex_lock(&ec->mutex);
+    while ((uint32_t)(atomic_load(&ec->state) >> 32) == key)
+    {
+        pthread_cond_wait(&ec->condvar, &ec->mutex);
+    }
+    pthread_mutex_unlock(&ec->mutex);
+    atomic_fetch_sub(&ec->state, 1);
+}
+static inline void eventcount_notify_many(eventcount_t *ec, int count)
+{
+    if ((atomic_load(&ec->state) & EVENTCOUNT_WAITERS) == 0)
+        return;
+    pthread_mutex_lock(&ec->mutex);
+    uint64_t state = atomic_fetch_add(&ec->state, EVENTCOUNT_EPOCH);
+    // NOTE : signalling more than the registered waiters is wasted work (a batch notifies one
+    // per message), broadcast once instead
+    if ((uint64_t)count >= (state & EVENTCOUNT_WAITERS))
+        pthread_cond_broadcast(&ec->condvar);
+    else
+        for (int i = 0; i < count; i++)
+            pthread_cond_signal(&ec->condvar);
+    pthread_mutex_unlock(&ec->mutex);
+}
+static inline void eventcount_destroy(eventcount_t *ec)
+{
+    pthread_mutex_destroy(&ec->mutex);
+    pthread_cond_destroy(&ec->condvar);
+}
+
+#endif
+
+/*
+ * eventcount_t : a condition variable for lock-free code.
+ *
+ * waiter :                                   notifier :
+ *     key = eventcount_prepare_wait(ec);         make the condition true
+ *     if (condition)                             eventcount_notify_one(ec);
+ *         eventcount_cancel_wait(ec);
+ *     else
+ *         eventcount_commit_wait(ec, key);
+ *
+ * the waiter is registered before its last check, so a notify that follows the
+ * condition change either sees it or bumps the epoch it sleeps on.
+ * notify is a single load while nobody waits and wakes at most `count` sleepers otherwise.
+ */
+static inline uint32_t eventcount_prepare_wait(eventcount_t *ec)
+{
+    return (uint32_t)(atomic_fetch_add(&ec->state, 1) >> 32);
+}
+static inline void eventcount_cancel_wait(eventcount_t *ec)
+{
+    atomic_fetch_sub(&ec->state, 1);
+}
+static inline void eventcount_notify_one(eventcount_t *ec)
+{
+    eventcount_notify_many(ec, 1);
+}
+static inline void eventcount_notify_all(eventcount_t *ec)
+{
+    eventcount_notify_many(ec, INT_MAX);
+}
+
+#endif
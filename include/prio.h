@@ -0,0 +1,92 @@
+#ifndef PRIO_H
+#define PRIO_H
+
+#include <stdalign.h>
+#include <stdatomic.h>
+#include "mpmc.h"
+#include "parker.h"
+#include "adaptive.h"
+
+/**
+ * @file prio.h
+ * @brief Bounded queue with priority lanes.
+ *
+ * Every lane is an mpmc_t, lane 0 has the highest priority. A summary word keeps one bit
+ * per lane that may hold messages, so a receive finds the highest ready lane with a single
+ * load, and an empty queue costs one load. Blocked receivers share one eventcount, woken by
+ * a send on any lane, a blocked sender waits on its own lane like mpmc_send_block.
+ *
+ * By default the priority is strict : a lane is only read once every higher lane is empty.
+ * prio_set_weights bounds the starvation of the low lanes : while several lanes are ready,
+ * lane i gets weights[i] messages out of every sum(weights).
+ */
+
+/// @brief Maximum number of lanes, one bit of the summary word each.
+#define PRIO_MAX_LANES 8
+
+typedef struct
+{
+    mpmc_t lanes[PRIO_MAX_LANES];
+    // read-only after init
+    int lane_count;
+    int weighted; // FALSE for strict priority
+    int weights[PRIO_MAX_LANES];
+    // bit i set : lane i may hold messages, it is only cleared by a receiver that found it empty
+    alignas(MPMC_CACHE_LINE) atomic_uint ready;
+    // weighted : lanes with credit left in this round and their remaining credit,
+    // shared by the receivers and only approximate while they race
+    alignas(MPMC_CACHE_LINE) atomic_uint credited;
+    atomic_int credits[PRIO_MAX_LANES];
+    // blocked receivers, checked by senders of every lane
+    alignas(MPMC_CACHE_LINE) eventcount_t recv_event;
+    adaptive_t recv_wait;
+} prio_t;
+
+/**
+ * @brief Initialize `lanes` lanes of `capacity` items of `item_size` bytes each.
+ *
+ * @param lanes Between 1 and PRIO_MAX_LANES.
+ * @return MPMC_OK on success, MPMC_INIT_FAILED on allocation failure or bad arguments.
+ */
+int prio_init(prio_t *queue, int lanes, int capacity, int item_size);
+/**
+ * @brief Share the receives between the ready lanes by weight instead of strict priority.
+ *
+ * @warning Must be called before the queue is shared with other threads.
+ *
+ * @param weights One weight per lane, at least 1.
+ * @return MPMC_OK, or MPMC_INIT_FAILED if a weight is below 1.
+ */
+int prio_set_weights(prio_t *queue, const int *weights);
+/**
+ * @brief Send a message on `lane` (non-blocking).
+ *
+ * @return MPMC_OK on success, MPMC_FULL if the lane is full.
+ */
+int prio_send(prio_t *queue, int lane, void *message);
+/**
+ * @brief Send a message on `lane`, waiting while the lane is full.
+ *
+ * @return MPMC_OK.
+ */
+int prio_send_block(prio_t *queue, int lane, void *message);
+/**
+ * @brief Receive from the highest ready lane (non-blocking).
+ *
+ * @return The lane the message came from, MPMC_EMPTY if every lane is empty.
+ */
+int prio_recv(prio_t *queue, void *message);
+/**
+ * @brief Receive from the highest ready lane, waiting while every lane is empty.
+ *
+ * @return The lane the message came from.
+ */
+int prio_recv_block(prio_t *queue, void *message);
+/**
+ * @brief Free the lanes.
+ *
+ * @warning No thread may use the queue during or after this call.
+ */
+void prio_destroy(prio_t *queue);
+
+#endif
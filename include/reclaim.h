@@ -0,0 +1,64 @@
+
+#ifndef RECLAIM_H
+#define RECLAIM_H
+
+#include <stdatomic.h>
+
+/**
+ * @file reclaim.h
+ * @brief Hazard pointer based safe memory reclamation for lock-free structures.
+ *
+ * A thread that is about to dereference a shared node first publishes it in
+ * one of its hazard slots with reclaim_protect(). A node that was unlinked
+ * from the structure is handed to reclaim_retire() instead of being freed,
+ * it is freed only once no hazard slot points to it anymore.
+ *
+ * Every thread gets a record on first use, the record is given back when the
+ * thread exits and its retired nodes that are still protected are handed to a
+ * global orphan list, freed by the next scan of any thread.
+ */
+
+/// @brief Maximum number of threads using the reclaimer at the same time.
+#define RECLAIM_MAX_THREADS 128
+
+/// @brief Hazard slots available to every thread.
+#define RECLAIM_HAZARDS 2
+
+/// @brief Retired nodes a thread keeps before scanning the hazard slots.
+#define RECLAIM_RETIRE_MAX (2 * RECLAIM_MAX_THREADS * RECLAIM_HAZARDS)
+
+typedef void (*reclaim_free_fn)(void *ptr);
+
+/**
+ * @brief Load `*src` and protect the loaded pointer in hazard slot `slot`.
+ *
+ * Loops until the published pointer is still the one stored in `src`, after that
+ * the pointer can be dereferenced until the slot is cleared or reused.
+ *
+ * @param slot Hazard slot index, smaller than RECLAIM_HAZARDS.
+ * @param src Shared location to load from.
+ * @return The protected pointer (may be NULL).
+ */
+void *reclaim_protect(int slot, void *_Atomic *src);
+
+/**
+ * @brief Release hazard slot `slot` of the calling thread.
+ */
+void reclaim_clear(int slot);
+
+/**
+ * @brief Hand an unlinked node to the reclaimer.
+ *
+ * `free_fn(ptr)` is called once no thread protects `ptr` anymore, possibly from
+ * another thread if the calling thread exits first.
+ *
+ * @note `ptr` must already be unreachable for threads that did not protect it.
+ */
+void reclaim_retire(void *ptr, reclaim_free_fn free_fn);
+
+/**
+ * @brief Free every retired node of the calling thread that is no longer protected.
+ */
+void reclaim_flush(void);
+
+#endif /* RECLAIM_H */
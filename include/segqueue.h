@@ -0,0 +1,86 @@
+#ifndef SEGQUEUE_H
+#define SEGQUEUE_H
+
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include "mpmc.h"
+#include "parker.h"
+
+/**
+ * @file segqueue.h
+ * @brief Unbounded MPMC queue made of linked fixed size ring segments.
+ *
+ * Every segment holds SEGQUEUE_SEGMENT_CELLS inline cells (the same mpmc_cell_t
+ * layout as mpmc_t), producers and consumers claim cells with a fetch_add on the
+ * segment indices. When the last segment is full a producer links a new one with
+ * the aqueue_enqueue CAS pattern, so a send never fails because the queue is full,
+ * and the allocation is paid once per segment instead of once per item.
+ *
+ * Drained segments are unlinked and retired through the hazard pointers
+ * (see reclaim.h), then kept in a process wide pool for the next segment allocation.
+ */
+
+/// @brief Cells per segment, a segment is allocated (or taken from the pool) once per this many sends.
+#ifndef SEGQUEUE_SEGMENT_CELLS
+#define SEGQUEUE_SEGMENT_CELLS 1024
+#endif
+
+typedef struct segqueue_segment_t segqueue_segment_t;
+
+typedef struct
+{
+    // consumers
+    alignas(MPMC_CACHE_LINE) _Atomic(segqueue_segment_t *) head;
+    // producers
+    alignas(MPMC_CACHE_LINE) _Atomic(segqueue_segment_t *) tail;
+    // read-only after init
+    alignas(MPMC_CACHE_LINE) size_t item_size;
+    size_t stride;       // bytes between cells, a multiple of MPMC_CELL_ALIGN
+    size_t segment_size; // bytes of one segment, cells included
+    // blocked receivers, checked by producers after every send
+    alignas(MPMC_CACHE_LINE) eventcount_t recv_event;
+} segqueue_t;
+
+/**
+ * @brief Initialize an unbounded queue of `item_size` bytes items.
+ *
+ * @param queue Pointer to an already allocated segqueue_t struct.
+ * @param item_size Size in bytes of each item.
+ * @return MPMC_OK on success, MPMC_INIT_FAILED on allocation failure.
+ */
+int segqueue_init(segqueue_t *queue, int item_size);
+/**
+ * @brief Send a message (non-blocking).
+ *
+ * The message is copied inline, like mpmc_send.
+ *
+ * @return MPMC_OK on success, MPMC_FULL only if a new segment could not be allocated.
+ */
+int segqueue_send(segqueue_t *queue, void *message);
+/**
+ * @brief Receive a message (non-blocking).
+ *
+ * @return MPMC_OK on success, MPMC_EMPTY if the queue is empty.
+ */
+int segqueue_recv(segqueue_t *queue, void *message);
+/**
+ * @brief Same as segqueue_send, the queue is unbounded so there is nothing to wait for.
+ *
+ * Kept so code written against mpmc_t can switch queues without changes.
+ */
+int segqueue_send_block(segqueue_t *queue, void *message);
+/**
+ * @brief Receive a message, waiting while the queue is empty.
+ *
+ * @return int Returns MPMC_OK.
+ */
+int segqueue_recv_block(segqueue_t *queue, void *message);
+/**
+ * @brief Give every segment back to the pool.
+ *
+ * @warning No thread may use the queue during or after this call.
+ */
+void segqueue_destroy(segqueue_t *queue);
+
+#endif
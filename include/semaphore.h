@@ -1,10 +1,12 @@
 #ifndef SEMAPHORE_H
 #define SEMAPHORE_H
 
+#include <stdalign.h>
 #include <stdatomic.h>
 #include <pthread.h>
 #include "parker.h"
-#include "aqueue.h"
+#include "adaptive.h"
+#include "stats.h"
 
 /**
  * @file semaphore.h
@@ -23,7 +25,32 @@
 
 /// Forward declarations
 typedef struct semaphore_waiter semaphore_waiter_t;
-typedef struct semaphore_node semaphore_node_t;
+
+/**
+ * @brief Intrusive waiter queue node.
+ *
+ * Lives on the stack of the blocked thread, see semaphore_acquire_many_block.
+ */
+struct semaphore_waiter
+{
+    parker_t *parker;
+    size_t wants;
+    _Atomic(semaphore_waiter_t *) next;
+#ifdef SYNC_STATS
+    uint64_t woken_ns; // when the drainer woke us
+#endif
+};
+
+/// @brief Upper bound on the shards of a sharded semaphore.
+#define SEMAPHORE_MAX_SHARDS 64
+
+/**
+ * @brief A share of the permits, padded to its own cache line.
+ */
+typedef struct
+{
+    alignas(64) atomic_size_t permits;
+} semaphore_shard_t;
 
 /**
  * @brief Counting semaphore structure.
@@ -34,29 +61,80 @@ typedef struct semaphore_node semaphore_node_t;
  *
  *  - `capacity`  : Maximum number of permits allowed.
  *
- *  - `head/tail` : Linked list of waiting threads.
+ *  - `head/tail` : Lock-free FIFO of waiting threads (intrusive MPSC queue),
+ *                  any thread pushes at the tail, only the drainer pops.
+ *
+ *  - `drain`     : Pending drain requests, the thread that raises it from 0
+ *                  becomes the drainer and hands permits to the waiters.
  *
- *  - `queue_mutex`: Protects waiter queue operations.
+ *  - `shards`    : Per-CPU permit counters of a sharded semaphore, NULL otherwise.
  */
 typedef struct
 {
     /// @brief Maximum number of permits the semaphore can hold.
     size_t capacity;
 
-    /// @brief Head of the waiter queue.
-    semaphore_node_t *head;
+    /// @brief Head of the waiter queue, only touched by the drainer.
+    semaphore_waiter_t *head;
+
+    /// @brief Waiter the drainer already partially served, it keeps its place at the front.
+    semaphore_waiter_t *pending;
 
     /// @brief Tail of the waiter queue.
-    semaphore_node_t *tail;
+    _Atomic(semaphore_waiter_t *) tail;
 
-    /// @brief Mutex guarding access to the waiter queue.
-    pthread_mutex_t queue_mutex;
+    /// @brief Keeps the queue non empty so push and pop never race on the same pointer.
+    semaphore_waiter_t stub;
+
+    /// @brief Drain requests not handled yet.
+    atomic_size_t drain;
 
     /// @brief Current number of available permits.
     atomic_size_t permits;
 
+    /// @brief Spin budget and wait counters of the blocking acquires.
+    adaptive_t wait;
+
+    /// @brief Per-CPU permit counters, see semaphore_init_sharded.
+    semaphore_shard_t *shards;
+
+    /// @brief Number of shards - 1, the count is a power of two.
+    size_t shard_mask;
+
+#ifdef SYNC_STATS
+    /// @brief Contention counters, see semaphore_stats_snapshot.
+    stats_t stats;
+#endif
+
 } semaphore_t;
 
+/**
+ * @brief Contention counters of a semaphore, see semaphore_stats_snapshot.
+ */
+typedef struct
+{
+    /// @brief Lost races on the permit counter.
+    uint64_t cas_retry;
+    /// @brief Non-blocking acquires (blocking spins included) that found too few permits.
+    uint64_t not_enough;
+    /// @brief Sharded acquires that had to take permits from another shard.
+    uint64_t steal;
+    /// @brief Waiters pushed on the queue.
+    uint64_t enqueue;
+    /// @brief Waiters that went to sleep.
+    uint64_t park;
+    /// @brief Waiters woken by a drain pass, close wakeups included.
+    uint64_t unpark;
+    /// @brief Total time from the wakeup to the waiter running again.
+    uint64_t wake_ns;
+    /// @brief Drain passes that could only serve part of the front waiter.
+    uint64_t partial_grant;
+    /// @brief Waiters woken because the semaphore was closed.
+    uint64_t close_wakeup;
+    /// @brief Drain passes.
+    uint64_t drain;
+} semaphore_stats_t;
+
 /**
  * @brief Result codes returned by semaphore operations.
  */
@@ -94,13 +172,44 @@ typedef enum
  */
 int semaphore_init(semaphore_t *sem, size_t init_permits);
 
+/**
+ * @brief Initialize a semaphore whose blocking acquires wait with `strategy`.
+ *
+ * Same as semaphore_init, which uses wait_hybrid().
+ *
+ * @param strategy See wait.h, waiters only queue up (and keep their FIFO order)
+ *                 with wait_hybrid() and wait_park().
+ * @return SEMAPHORE_OK on success, or SEMAPHORE_INIT_FAILED on error.
+ */
+int semaphore_init_wait(semaphore_t *sem, size_t init_permits, wait_strategy_t strategy);
+
+/**
+ * @brief Initialize a semaphore whose permits are spread over per-CPU shards.
+ *
+ * For heavily contended semaphores : acquires and releases work on the
+ * shard of the current CPU, so they don't all hit the same cache line.
+ * A dry shard steals from the others (and keeps part of the loot for the
+ * next acquires), and once every shard is dry the thread queues up like
+ * with a regular semaphore. Waiters are still served in FIFO order and the
+ * total number of permits is exact, only the split between shards moves.
+ *
+ * @param sem Pointer to the semaphore to initialize.
+ * @param init_permits Initial number of available permits.
+ * @param shards Number of shards, rounded up to a power of two and capped at
+ *               SEMAPHORE_MAX_SHARDS, 0 for one per online CPU.
+ * @param strategy Wait strategy of the blocking acquires, as for semaphore_init_wait.
+ * @return SEMAPHORE_OK on success, or SEMAPHORE_INIT_FAILED on error.
+ */
+int semaphore_init_sharded(semaphore_t *sem, size_t init_permits, int shards, wait_strategy_t strategy);
+
 /**
  * @brief Attempt to acquire multiple permits without blocking.
  *
  * @param sem Pointer to the semaphore.
  * @param count Number of permits requested.
  * @return SEMAPHORE_OK if successful,
- *         SEMAPHORE_NOT_ENOUGH if insufficient permits,
+ *         SEMAPHORE_NOT_ENOUGH if insufficient permits (or other threads are
+ *         already queued for permits, they are served first),
  *         or SEMAPHORE_CLOSED if the semaphore was destroyed.
  */
 int semaphore_acquire_many(semaphore_t *sem, size_t count);
@@ -113,20 +222,45 @@ int semaphore_acquire_many(semaphore_t *sem, size_t count);
  * @return SEMAPHORE_OK on success,
  *         SEMAPHORE_CLOSED if the semaphore was destroyed.
  *
- * @note This function may park the calling thread using a per-thread
- *       parker until permits become available.
+ * @note With the default wait strategy (see semaphore_init_wait),
+ *       this function spins, then yields (see adaptive.h) and finally may
+ *       park the calling thread using a per-thread parker until permits
+ *       become available. The contended path does
+ *       not allocate, the queue node lives on the caller's stack.
  */
 int semaphore_acquire_many_block(semaphore_t *sem, size_t count);
 
 /**
  * @brief Release multiple permits and wake waiters as needed.
  *
+ * A single atomic add while no thread is queued, otherwise the permits
+ * are handed over to the waiters by a drain pass, no lock is taken.
+ *
  * @param sem Pointer to the semaphore.
  * @param count Number of permits to release.
  * @return SEMAPHORE_OK on success or SEMAPHORE_FULL if over-released.
  */
 int semaphore_release_many(semaphore_t *sem, size_t count);
 
+/**
+ * @brief Read how the blocking acquires ended their waits.
+ *
+ * @param sem Pointer to the semaphore.
+ * @param stats Receives the number of waits satisfied while spinning, yielding or parked.
+ */
+void semaphore_wait_stats(semaphore_t *sem, adaptive_stats_t *stats);
+
+/**
+ * @brief Read the contention counters of the semaphore.
+ *
+ * The counters are only kept when the library is built with SYNC_STATS,
+ * otherwise every field reads 0.
+ *
+ * @param sem Pointer to the semaphore.
+ * @param stats Receives the counters, summed over the per-thread shards.
+ */
+void semaphore_stats_snapshot(semaphore_t *sem, semaphore_stats_t *stats);
+
 /**
  * @brief Attempt to acquire a single permit without blocking.
  *
@@ -169,12 +303,13 @@ static inline int semaphore_acquire_block(semaphore_t *sem)
  *
  *  1. Marks the semaphore as closed (prevents future acquisitions).
  *
- *  2. Wakes all threads currently waiting.
- *
- *  3. Releases all internal resources.
+ *  2. Wakes all threads currently waiting (waits for a drain pass run
+ *     by another thread to finish, so the semaphore is untouched on return).
  *
  * @warning After calling this, `sem` must not be used by any thread.
  *          Waiters woken by this function should detect closure the return SEMAPHORE_CLOSED.
+ * @warning A sharded semaphore frees its shards here, threads may be parked in
+ *          semaphore_acquire_many_block but no other call may run concurrently.
  */
 void semaphore_destroy(semaphore_t *sem);
 
@@ -1,11 +1,33 @@
 #ifndef SPIN_H
 #define SPIN_H
 
+#include <stdint.h>
+#include <time.h>
+
+#ifndef TRUE
+#define TRUE 1
+#endif
+#ifndef FALSE
+#define FALSE 0
+#endif
+
+/*
+ * spin_t : exponential backoff.
+ *
+ * round `next` waits SPIN_UNIT_NS * pow^(next - 1), capped at SPIN_ROUND_MAX_NS, and spin_next
+ * returns TRUE once `max` rounds were spent. the wait is counted in cpu hints (pause/yield
+ * instructions), whose cost goes from a few to more than a hundred cycles depending on the cpu,
+ * so the time of one hint is measured on first use and the rounds take the same time everywhere.
+ */
+#define SPIN_UNIT_NS 10
+#define SPIN_ROUND_MAX_NS 1000
+
 typedef struct
 {
-    int next;
-    int pow;
-    int max;
+    int next;  // round about to run, starts at 1
+    int pow;   // growth factor of the rounds
+    int max;   // rounds before giving up
+    int hints; // length of the next round, 0 until the first one
 } spin_t;
 
 // similiar to rust hint spin
@@ -24,16 +46,30 @@ typedef struct
 #define CPU_HINT_LOOP() __asm__ __volatile__("" ::: "memory")
 #endif
 
+static inline uint64_t spin_clock_ns(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec;
+}
+// picoseconds per CPU_HINT_LOOP, measured once per process (see spin.c)
+int spin_hint_ps(void);
 static inline int spin_next(spin_t *spin)
 {
     if (spin->next > spin->max)
     {
         return TRUE;
     }
-    for (int i = 0; i < (spin->next ^ spin->pow); i++)
+    int ps = spin_hint_ps();
+    int cap = SPIN_ROUND_MAX_NS * 1000 / ps + 1;
+    if (spin->hints == 0)
+        spin->hints = SPIN_UNIT_NS * 1000 / ps + 1;
+    for (int i = 0; i < spin->hints; i++)
     {
         CPU_HINT_LOOP();
     }
+    if (spin->pow > 1)
+        spin->hints = spin->hints > cap / spin->pow ? cap : spin->hints * spin->pow;
     spin->next += 1;
     return FALSE;
 }
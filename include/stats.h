@@ -0,0 +1,105 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <time.h>
+
+/*
+ * stats_t : optional contention counters, compiled in with -DSYNC_STATS.
+ *
+ * every object that supports them embeds a stats_t and bumps its counters with
+ * STATS_INC/STATS_ADD, without SYNC_STATS the field is gone and the macros expand to nothing.
+ * the counters are split in STATS_SHARDS cache line padded shards and a thread always
+ * writes the same shard, so counting doesn't add a shared cache line to the hot path.
+ * readers sum the shards, a snapshot taken while threads run is not atomic as a whole.
+ *
+ * the wake latency is measured with a stamp : the notifier stores the time it woke
+ * somebody, the woken thread adds the time since the stamp to a counter.
+ */
+
+// shards per object, threads beyond this share a shard (still correct, only slower)
+#define STATS_SHARDS 8
+// counters per object
+#define STATS_COUNTERS 16
+// stamps per object, one per kind of wakeup
+#define STATS_STAMPS 2
+#ifndef STATS_CACHE_LINE
+#define STATS_CACHE_LINE 64
+#endif
+
+typedef struct
+{
+    alignas(STATS_CACHE_LINE) atomic_uint_fast64_t counters[STATS_COUNTERS];
+} stats_shard_t;
+
+typedef struct
+{
+    stats_shard_t shards[STATS_SHARDS];
+    alignas(STATS_CACHE_LINE) atomic_uint_fast64_t stamps[STATS_STAMPS];
+} stats_t;
+
+static inline void stats_init(stats_t *stats)
+{
+    for (int i = 0; i < STATS_SHARDS; i++)
+        for (int j = 0; j < STATS_COUNTERS; j++)
+            atomic_store_explicit(&stats->shards[i].counters[j], 0, memory_order_relaxed);
+    for (int i = 0; i < STATS_STAMPS; i++)
+        atomic_store_explicit(&stats->stamps[i], 0, memory_order_relaxed);
+}
+static inline uint64_t stats_now_ns(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec;
+}
+// the calling thread's slot, 0 until stats_assign_slot gave it one (see stats.c)
+extern _Thread_local unsigned stats_slot;
+unsigned stats_assign_slot(void);
+// threads get their shard round robin on first use
+static inline stats_shard_t *stats_local_shard(stats_t *stats)
+{
+    unsigned slot = stats_slot;
+    if (slot == 0)
+        slot = stats_assign_slot();
+    return &stats->shards[slot % STATS_SHARDS];
+}
+// NOTE : a fetch_add and not a load/store pair, several threads may share a shard
+static inline void stats_add(stats_t *stats, int counter, uint64_t value)
+{
+    atomic_fetch_add_explicit(&stats_local_shard(stats)->counters[counter], value, memory_order_relaxed);
+}
+static inline void stats_stamp(stats_t *stats, int stamp)
+{
+    atomic_store_explicit(&stats->stamps[stamp], stats_now_ns(), memory_order_relaxed);
+}
+// add the time since `stamp` to `counter`, a stamp from the future (clock read before ours) counts as 0
+static inline void stats_since(stats_t *stats, int stamp, int counter)
+{
+    uint64_t then = atomic_load_explicit(&stats->stamps[stamp], memory_order_relaxed);
+    uint64_t now = stats_now_ns();
+    if (then != 0 && now > then)
+        stats_add(stats, counter, now - then);
+}
+static inline uint64_t stats_sum(stats_t *stats, int counter)
+{
+    uint64_t sum = 0;
+    for (int i = 0; i < STATS_SHARDS; i++)
+        sum += atomic_load_explicit(&stats->shards[i].counters[counter], memory_order_relaxed);
+    return sum;
+}
+
+#ifdef SYNC_STATS
+#define STATS_ADD(stats, counter, value) stats_add((stats), (counter), (value))
+#define STATS_INC(stats, counter) stats_add((stats), (counter), 1)
+#define STATS_STAMP(stats, stamp) stats_stamp((stats), (stamp))
+#define STATS_SINCE(stats, stamp, counter) stats_since((stats), (stamp), (counter))
+#else
+#define STATS_ADD(stats, counter, value) ((void)0)
+#define STATS_INC(stats, counter) ((void)0)
+#define STATS_STAMP(stats, stamp) ((void)0)
+#define STATS_SINCE(stats, stamp, counter) ((void)0)
+#endif
+
+#endif
@@ -0,0 +1,64 @@
+#ifndef WAIT_H
+#define WAIT_H
+
+/*
+ * wait_strategy_t : how a blocking call waits, chosen per object (see mpmc_init_wait,
+ * semaphore_init_wait), like the wait strategies of the LMAX disruptor.
+ *
+ *   WAIT_HYBRID     : spin with backoff, yield, then park, the spin budget is learned (adaptive.h).
+ *                     the default, a good fit when nothing is known about the load.
+ *   WAIT_BUSY_SPIN  : retry with a cpu hint between attempts and never give the cpu away.
+ *                     lowest wake up latency, for threads pinned on isolated cores only :
+ *                     it burns its core and on an oversubscribed machine it delays the thread it waits for.
+ *   WAIT_YIELD      : spin `spins` backoff rounds, then retry after every sched_yield.
+ *                     low latency while leaving the core to other runnable threads.
+ *   WAIT_PARK       : park right away, the wakeup costs a syscall but nothing is burnt while waiting.
+ *                     for batch workers.
+ *   WAIT_TIMED_PARK : sleep `park_ns`, retry, sleep again... without registering on the
+ *                     eventcount, so the wakers never pay for a notification. the latency is
+ *                     up to `park_ns`.
+ *
+ * semaphore waiters that busy spin, yield or sleep never queue up, so the FIFO order
+ * of the waiters only holds with WAIT_HYBRID and WAIT_PARK.
+ */
+
+typedef enum
+{
+    WAIT_HYBRID = 0,
+    WAIT_BUSY_SPIN = 1,
+    WAIT_YIELD = 2,
+    WAIT_PARK = 3,
+    WAIT_TIMED_PARK = 4,
+} WAIT_KIND;
+
+typedef struct
+{
+    int kind;     // WAIT_KIND
+    int spins;    // WAIT_YIELD : backoff rounds before the first yield
+    long park_ns; // WAIT_TIMED_PARK : sleep between two attempts
+} wait_strategy_t;
+
+#define WAIT_YIELD_SPINS 8
+
+static inline wait_strategy_t wait_hybrid(void)
+{
+    return (wait_strategy_t){.kind = WAIT_HYBRID};
+}
+static inline wait_strategy_t wait_busy_spin(void)
+{
+    return (wait_strategy_t){.kind = WAIT_BUSY_SPIN};
+}
+static inline wait_strategy_t wait_yield(void)
+{
+    return (wait_strategy_t){.kind = WAIT_YIELD, .spins = WAIT_YIELD_SPINS};
+}
+static inline wait_strategy_t wait_park(void)
+{
+    return (wait_strategy_t){.kind = WAIT_PARK};
+}
+static inline wait_strategy_t wait_timed_park(long park_ns)
+{
+    return (wait_strategy_t){.kind = WAIT_TIMED_PARK, .park_ns = park_ns};
+}
+
+#endif
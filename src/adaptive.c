@@ -0,0 +1,18 @@
+#include <stdatomic.h>
+#include <unistd.h>
+#include "adaptive.h"
+
+// one cache for the whole process, a static in the inline header would give every
+// translation unit its own
+static atomic_int cpus;
+
+int adaptive_single_cpu(void)
+{
+    int count = atomic_load_explicit(&cpus, memory_order_relaxed);
+    if (count == 0)
+    {
+        count = (int)sysconf(_SC_NPROCESSORS_ONLN);
+        atomic_store_explicit(&cpus, count, memory_order_relaxed);
+    }
+    return count <= 1;
+}
@@ -1,59 +1,247 @@
 #include "aqueue.h"
 #include <stdatomic.h>
-#include <libc.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include "spin.h"
+#include "reclaim.h"
 // -- this impl is based on Michael Scott Queue --
-void aqueue_init(aqueue_t *queue)
+// nodes are freed through hazard pointers (see reclaim.h) :
+// slot 0 protects the head/tail node we work on, slot 1 the head's successor.
+#define AQUEUE_HAZARD_NODE 0
+#define AQUEUE_HAZARD_NEXT 1
+
+// -- node pool --
+// nodes come from slabs and are never given back to the os.
+// free nodes are kept in batches : a chain of nodes linked through `next`, batches
+// themselves are linked through the `data` field of their first node.
+// every thread caches a few batches, full batches move to and from a shared stack.
+// pushes are a lock-free CAS, pops take one batch at a time under a mutex : with a single
+// popper a batch can't leave and come back on top between its load and the CAS, so there is
+// no ABA problem, and the mutex is only taken once per AQUEUE_POOL_BATCH allocations.
+#define AQUEUE_POOL_SLAB 64
+#define AQUEUE_POOL_BATCH 64
+
+typedef struct
+{
+    aqueue_node_t *free;    // nodes ready for allocation
+    aqueue_node_t *filling; // freed nodes, becomes a batch once it holds AQUEUE_POOL_BATCH nodes
+    size_t filling_count;
+    aqueue_node_t *batches; // full batches
+    int registered;
+    int exiting;
+} aqueue_pool_cache_t;
+
+static _Atomic(aqueue_node_t *) pool_shared;
+static pthread_mutex_t pool_pop_mutex = PTHREAD_MUTEX_INITIALIZER;
+static _Thread_local aqueue_pool_cache_t pool_cache;
+static pthread_key_t pool_key;
+static pthread_once_t pool_key_once = PTHREAD_ONCE_INIT;
+
+static void aqueue_pool_push_shared(aqueue_node_t *batch)
+{
+    aqueue_node_t *top = atomic_load_explicit(&pool_shared, memory_order_relaxed);
+    do
+    {
+        batch->data = top;
+    } while (!atomic_compare_exchange_weak_explicit(&pool_shared, &top, batch, memory_order_release, memory_order_relaxed));
+}
+// take one batch from the shared stack, the others stay for the other threads
+static aqueue_node_t *aqueue_pool_pop_shared(void)
+{
+    if (atomic_load_explicit(&pool_shared, memory_order_relaxed) == NULL)
+        return NULL;
+    pthread_mutex_lock(&pool_pop_mutex);
+    aqueue_node_t *batch = atomic_load_explicit(&pool_shared, memory_order_acquire);
+    while (batch != NULL && !atomic_compare_exchange_weak_explicit(&pool_shared, &batch, batch->data,
+                                                                   memory_order_acquire, memory_order_acquire))
+        ;
+    pthread_mutex_unlock(&pool_pop_mutex);
+    if (batch != NULL)
+        batch->data = NULL;
+    return batch;
+}
+static void aqueue_pool_thread_exit(void *arg)
+{
+    aqueue_pool_cache_t *cache = arg;
+    // frees that still happen during thread teardown (reclaim flushes) go straight to the shared stack
+    cache->exiting = TRUE;
+    if (cache->free != NULL)
+        aqueue_pool_push_shared(cache->free);
+    if (cache->filling != NULL)
+        aqueue_pool_push_shared(cache->filling);
+    while (cache->batches != NULL)
+    {
+        aqueue_node_t *batch = cache->batches;
+        cache->batches = batch->data;
+        aqueue_pool_push_shared(batch);
+    }
+    cache->free = cache->filling = NULL;
+    cache->filling_count = 0;
+}
+static void aqueue_pool_create_key(void)
+{
+    pthread_key_create(&pool_key, aqueue_pool_thread_exit);
+}
+// make sure the cache is handed back when the thread exits
+static void aqueue_pool_register(aqueue_pool_cache_t *cache)
+{
+    pthread_once(&pool_key_once, aqueue_pool_create_key);
+    pthread_setspecific(pool_key, cache);
+    cache->registered = TRUE;
+}
+// allocate a slab and link its nodes into one batch
+static aqueue_node_t *aqueue_pool_slab(size_t count)
+{
+    aqueue_node_t *slab = aligned_alloc(alignof(aqueue_node_t), count * sizeof(aqueue_node_t));
+    if (slab == NULL)
+        return NULL;
+    for (size_t i = 0; i + 1 < count; i++)
+        atomic_init(&slab[i].next, &slab[i + 1]);
+    atomic_init(&slab[count - 1].next, NULL);
+    slab[0].data = NULL;
+    return slab;
+}
+static void aqueue_pool_refill(aqueue_pool_cache_t *cache)
+{
+    if (!cache->registered)
+        aqueue_pool_register(cache);
+    // recently freed nodes first, they are the most likely to be in cache
+    if (cache->filling != NULL)
+    {
+        cache->free = cache->filling;
+        cache->filling = NULL;
+        cache->filling_count = 0;
+        return;
+    }
+    if (cache->batches == NULL)
+        cache->batches = aqueue_pool_pop_shared();
+    if (cache->batches == NULL)
+        cache->batches = aqueue_pool_slab(AQUEUE_POOL_SLAB);
+    if (cache->batches == NULL)
+        return;
+    cache->free = cache->batches;
+    cache->batches = cache->batches->data;
+}
+static aqueue_node_t *aqueue_alloc_node(void)
+{
+    aqueue_pool_cache_t *cache = &pool_cache;
+    if (cache->free == NULL)
+    {
+        aqueue_pool_refill(cache);
+        if (cache->free == NULL)
+            return NULL;
+    }
+    aqueue_node_t *node = cache->free;
+    cache->free = atomic_load_explicit(&node->next, memory_order_relaxed);
+    return node;
+}
+static void aqueue_free_node(void *ptr)
+{
+    aqueue_node_t *node = ptr;
+    aqueue_pool_cache_t *cache = &pool_cache;
+    if (cache->exiting)
+    {
+        atomic_store_explicit(&node->next, NULL, memory_order_relaxed);
+        aqueue_pool_push_shared(node);
+        return;
+    }
+    if (!cache->registered)
+        aqueue_pool_register(cache);
+    atomic_store_explicit(&node->next, cache->filling, memory_order_relaxed);
+    cache->filling = node;
+    if (++cache->filling_count < AQUEUE_POOL_BATCH)
+        return;
+    // keep one spare batch for our own allocations, the rest goes to the other threads
+    if (cache->batches == NULL)
+    {
+        node->data = NULL;
+        cache->batches = node;
+    }
+    else
+    {
+        aqueue_pool_push_shared(node);
+    }
+    cache->filling = NULL;
+    cache->filling_count = 0;
+}
+int aqueue_init_prealloc(aqueue_t *queue, size_t nodes)
 {
-    aqueue_node_t *dummy = malloc(sizeof(aqueue_node_t));
+    if (nodes > 0)
+    {
+        aqueue_node_t *batch = aqueue_pool_slab(nodes);
+        if (batch != NULL)
+            aqueue_pool_push_shared(batch);
+    }
+    aqueue_node_t *dummy = aqueue_alloc_node();
+    if (dummy == NULL)
+    {
+        return AQUEUE_NO_MEMORY;
+    }
     dummy->data = NULL;
-    atomic_store(&dummy->refcount, 2); // 1 for head, 1 for tail
     atomic_store(&dummy->next, NULL);
     atomic_store(&queue->head, dummy);
     atomic_store(&queue->tail, dummy);
+    return AQUEUE_OK;
+}
+int aqueue_init(aqueue_t *queue)
+{
+    return aqueue_init_prealloc(queue, 0);
 }
 void *aqueue_dequeue(aqueue_t *queue)
 {
     while (1)
     {
-        aqueue_node_t *head = atomic_load(&queue->head);
-        aqueue_node_t *next = atomic_load(&head->next);
+        aqueue_node_t *head = reclaim_protect(AQUEUE_HAZARD_NODE, (void *_Atomic *)&queue->head);
+        aqueue_node_t *tail = atomic_load(&queue->tail);
+        // head is protected, so its next field is safe to read, next itself needs its own hazard
+        // because another dequeuer may retire it as soon as it becomes the head
+        aqueue_node_t *next = reclaim_protect(AQUEUE_HAZARD_NEXT, (void *_Atomic *)&head->next);
+        if (head != atomic_load(&queue->head))
+            continue;
         // if the next is null the queue is empty
         // we don't count the dummy node
         if (!next)
+        {
+            reclaim_clear(AQUEUE_HAZARD_NODE);
+            reclaim_clear(AQUEUE_HAZARD_NEXT);
             return NULL;
+        }
+        if (head == tail)
+        {
+            // the tail is lagging behind an enqueue, help it before moving the head past it
+            atomic_compare_exchange_strong(&queue->tail, &tail, next);
+            continue;
+        }
 
         void *data = next->data;
 
         // lets try to move the head forward
         if (atomic_compare_exchange_weak(&queue->head, &head, next))
         {
-
-            // new head gains a reference for the queue
-            atomic_fetch_add(&next->refcount, 1);
-            // decrement old head's refcount
-            if (atomic_fetch_sub(&head->refcount, 1) == 1)
-            {
-                printf("free \n");
-                free(head);
-            }
-
+            reclaim_clear(AQUEUE_HAZARD_NODE);
+            reclaim_clear(AQUEUE_HAZARD_NEXT);
+            // next is the new dummy, the old one is unreachable now
+            reclaim_retire(head, aqueue_free_node);
             return data;
         }
     }
 }
 
-void aqueue_enqueue(aqueue_t *queue, void *data)
+int aqueue_enqueue(aqueue_t *queue, void *data)
 {
 
     // set new node
-    aqueue_node_t *node = malloc(sizeof(aqueue_node_t));
+    aqueue_node_t *node = aqueue_alloc_node();
+    if (node == NULL)
+    {
+        return AQUEUE_NO_MEMORY;
+    }
     node->data = data;
     atomic_init(&node->next, NULL);
-    atomic_init(&node->refcount, 1);
     while (1)
     {
         // load tail and tail next
-        aqueue_node_t *tail = atomic_load(&queue->tail);
+        aqueue_node_t *tail = reclaim_protect(AQUEUE_HAZARD_NODE, (void *_Atomic *)&queue->tail);
         aqueue_node_t *next = atomic_load(&tail->next);
 
         // check if the tail is the last node, or next is not NULL
@@ -61,16 +249,15 @@ void aqueue_enqueue(aqueue_t *queue, void *data)
         {
             // the tail is the last node
             // lets try to set the tail next to our mode, if we failed , lets retry.
-            if (atomic_compare_exchange_weak(&tail->next, &tail, node))
+            if (atomic_compare_exchange_weak(&tail->next, &next, node))
             {
-                // now the tail own the node too
-                atomic_fetch_add(&node->refcount, 1);
                 // if we successfully stored the next in the tail
                 atomic_compare_exchange_strong(&queue->tail, &tail, node);
                 // note we use strong here and we don't care about the result, because
                 // the only way we fail here, is by knowning other thread help us
                 // change the tail to our new node or the tail pointer has been pushed even further
-                return;
+                reclaim_clear(AQUEUE_HAZARD_NODE);
+                return AQUEUE_OK;
             }
         }
         else
@@ -81,7 +268,20 @@ void aqueue_enqueue(aqueue_t *queue, void *data)
             // lets try help it and advance the tail into the node
 
             // NOTE : we still need to enqueue our node!, we failed but we trying to help other thread.
-            atomic_compare_exchange_weak(&queue->tail, &tail, tail->next);
+            atomic_compare_exchange_weak(&queue->tail, &tail, next);
         }
     }
 }
+
+void aqueue_destroy(aqueue_t *queue)
+{
+    aqueue_node_t *node = atomic_load(&queue->head);
+    while (node != NULL)
+    {
+        aqueue_node_t *next = atomic_load(&node->next);
+        aqueue_free_node(node);
+        node = next;
+    }
+    atomic_store(&queue->head, NULL);
+    atomic_store(&queue->tail, NULL);
+}
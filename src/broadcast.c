@@ -0,0 +1,197 @@
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include "broadcast.h"
+#include "spin.h"
+#define BROADCAST_SPIN ((spin_t){.next = 1, .pow = 2, .max = 6})
+
+static inline mpmc_cell_t *broadcast_get_cell(broadcast_t *channel, size_t pos)
+{
+    return (mpmc_cell_t *)(channel->buffer + (pos & channel->mask) * channel->stride);
+}
+static inline size_t broadcast_align_up(size_t value, size_t align)
+{
+    return (value + align - 1) & ~(align - 1);
+}
+// stamp of a complete message `pos`
+static inline size_t broadcast_stamp(size_t pos)
+{
+    return 2 * (pos + 1);
+}
+
+int broadcast_init(broadcast_t *channel, int capacity, int item_size)
+{
+    if (capacity <= 0 || (capacity & (capacity - 1)) != 0 || item_size < 0)
+    {
+        return MPMC_INIT_FAILED;
+    }
+    channel->stride = broadcast_align_up(sizeof(mpmc_cell_t) + item_size, MPMC_CELL_ALIGN);
+    // aligned_alloc wants the size to be a multiple of the alignment
+    channel->buffer = aligned_alloc(MPMC_CACHE_LINE, broadcast_align_up(capacity * channel->stride, MPMC_CACHE_LINE));
+    if (channel->buffer == NULL)
+    {
+        return MPMC_INIT_FAILED;
+    }
+    channel->item_size = item_size;
+    channel->mask = (size_t)capacity - 1;
+    channel->capacity = capacity;
+    // 0 is older than any stamp
+    for (size_t i = 0; i < (size_t)capacity; i++)
+    {
+        atomic_store(&broadcast_get_cell(channel, i)->seq, 0);
+    }
+    atomic_store(&channel->tail, 0);
+    atomic_store(&channel->subscribers, 0);
+    eventcount_init(&channel->recv_event);
+    adaptive_init(&channel->recv_wait, wait_hybrid());
+    return MPMC_OK;
+}
+
+int broadcast_send(broadcast_t *channel, void *message)
+{
+    size_t pos = atomic_fetch_add(&channel->tail, 1);
+    mpmc_cell_t *cell = broadcast_get_cell(channel, pos);
+    size_t stamp = atomic_load_explicit(&cell->seq, memory_order_relaxed);
+    spin_t spin = BROADCAST_SPIN;
+    while (1)
+    {
+        if (stamp > broadcast_stamp(pos))
+        {
+            // NOTE : a sender a lap ahead already took the cell, our message would be
+            // overwritten right away, receivers see it as lagged
+            return MPMC_OK;
+        }
+        if ((stamp & 1) != 0)
+        {
+            // the sender of the previous lap is still copying, it may have been preempted
+            if (spin_next(&spin) == TRUE)
+                sched_yield();
+            stamp = atomic_load_explicit(&cell->seq, memory_order_relaxed);
+            continue;
+        }
+        if (atomic_compare_exchange_weak_explicit(&cell->seq, &stamp, broadcast_stamp(pos) - 1,
+                                                  memory_order_relaxed, memory_order_relaxed))
+            break;
+    }
+    // the odd stamp is visible before any byte of the new message
+    atomic_thread_fence(memory_order_release);
+    memcpy(cell->data, message, channel->item_size);
+    atomic_store_explicit(&cell->seq, broadcast_stamp(pos), memory_order_release);
+    // the eventcount is read after the stamp, a receiver that registered before can't be missed
+    atomic_thread_fence(memory_order_seq_cst);
+    eventcount_notify_all(&channel->recv_event);
+    return MPMC_OK;
+}
+
+int broadcast_subscribers(broadcast_t *channel)
+{
+    return atomic_load_explicit(&channel->subscribers, memory_order_relaxed);
+}
+void broadcast_subscribe(broadcast_t *channel, broadcast_receiver_t *receiver)
+{
+    receiver->channel = channel;
+    receiver->next = atomic_load(&channel->tail);
+    atomic_fetch_add_explicit(&channel->subscribers, 1, memory_order_relaxed);
+}
+void broadcast_unsubscribe(broadcast_receiver_t *receiver)
+{
+    // NOTE : senders never wait for receivers, so there is nothing to hand back
+    atomic_fetch_sub_explicit(&receiver->channel->subscribers, 1, memory_order_relaxed);
+    receiver->channel = NULL;
+}
+
+// the receiver is more than a lap behind, move it to the oldest message still in the ring
+static int broadcast_lagged(broadcast_receiver_t *receiver, size_t *lagged)
+{
+    broadcast_t *channel = receiver->channel;
+    size_t tail = atomic_load(&channel->tail);
+    size_t oldest = tail - channel->capacity;
+    if (lagged != NULL)
+        *lagged = oldest - receiver->next;
+    receiver->next = oldest;
+    return BROADCAST_LAGGED;
+}
+int broadcast_recv(broadcast_receiver_t *receiver, void *message, size_t *lagged)
+{
+    broadcast_t *channel = receiver->channel;
+    size_t pos = receiver->next;
+    mpmc_cell_t *cell = broadcast_get_cell(channel, pos);
+    size_t stamp = atomic_load_explicit(&cell->seq, memory_order_acquire);
+    if (stamp < broadcast_stamp(pos))
+    {
+        // not sent yet, or still being written
+        return MPMC_EMPTY;
+    }
+    if (stamp > broadcast_stamp(pos))
+    {
+        return broadcast_lagged(receiver, lagged);
+    }
+    // NOTE : a sender a lap ahead may overwrite the cell while we copy it, the copy is then
+    // thrown away, the stamp check below tells us
+    memcpy(message, cell->data, channel->item_size);
+    atomic_thread_fence(memory_order_acquire);
+    if (atomic_load_explicit(&cell->seq, memory_order_relaxed) != stamp)
+    {
+        return broadcast_lagged(receiver, lagged);
+    }
+    receiver->next = pos + 1;
+    return MPMC_OK;
+}
+
+// arguments and result of a recv retried by adaptive_spin
+typedef struct
+{
+    broadcast_receiver_t *receiver;
+    void *message;
+    size_t *lagged;
+    int result;
+} broadcast_try_t;
+static int broadcast_try_recv(void *ctx)
+{
+    broadcast_try_t *attempt = ctx;
+    attempt->result = broadcast_recv(attempt->receiver, attempt->message, attempt->lagged);
+    return attempt->result != MPMC_EMPTY;
+}
+// TRUE if the next message of the receiver was written (or overwritten)
+static inline int broadcast_can_recv(broadcast_receiver_t *receiver)
+{
+    size_t pos = receiver->next;
+    return atomic_load(&broadcast_get_cell(receiver->channel, pos)->seq) >= broadcast_stamp(pos);
+}
+int broadcast_recv_block(broadcast_receiver_t *receiver, void *message, size_t *lagged)
+{
+    broadcast_t *channel = receiver->channel;
+    int result = broadcast_recv(receiver, message, lagged);
+    if (result != MPMC_EMPTY)
+    {
+        return result;
+    }
+    broadcast_try_t attempt = {receiver, message, lagged, result};
+    if (adaptive_spin(&channel->recv_wait, broadcast_try_recv, &attempt))
+    {
+        return attempt.result;
+    }
+    while (1)
+    {
+        // registered before the last check, so a send that follows it can't miss us
+        uint32_t key = eventcount_prepare_wait(&channel->recv_event);
+        if (broadcast_can_recv(receiver))
+            eventcount_cancel_wait(&channel->recv_event);
+        else
+            eventcount_commit_wait(&channel->recv_event, key);
+        result = broadcast_recv(receiver, message, lagged);
+        if (result != MPMC_EMPTY)
+        {
+            adaptive_parked(&channel->recv_wait);
+            return result;
+        }
+    }
+}
+
+void broadcast_destroy(broadcast_t *channel)
+{
+    free(channel->buffer);
+    channel->buffer = NULL;
+    eventcount_destroy(&channel->recv_event);
+}
@@ -0,0 +1,96 @@
+#include <stdatomic.h>
+#include <stdlib.h>
+#include "deque.h"
+// top and bottom only grow (the ring index is taken with the mask), bottom may go one below
+// top for a moment while the owner pops the last item, hence the signed positions
+
+int deque_init(deque_t *deque, int capacity)
+{
+    if (capacity <= 0 || (capacity & (capacity - 1)) != 0)
+    {
+        return MPMC_INIT_FAILED;
+    }
+    deque->items = calloc(capacity, sizeof(*deque->items));
+    if (deque->items == NULL)
+    {
+        return MPMC_INIT_FAILED;
+    }
+    deque->mask = capacity - 1;
+    atomic_store(&deque->top, 0);
+    atomic_store(&deque->bottom, 0);
+    return MPMC_OK;
+}
+
+int deque_push(deque_t *deque, void *item)
+{
+    int64_t bottom = atomic_load_explicit(&deque->bottom, memory_order_relaxed);
+    int64_t top = atomic_load_explicit(&deque->top, memory_order_acquire);
+    if (bottom - top > deque->mask)
+    {
+        return MPMC_FULL;
+    }
+    atomic_store_explicit(&deque->items[bottom & deque->mask], item, memory_order_relaxed);
+    // the item (and what it points to) is visible before the new bottom, thieves load it with acquire
+    atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_release);
+    return MPMC_OK;
+}
+
+int deque_pop(deque_t *deque, void **item)
+{
+    int64_t bottom = atomic_load_explicit(&deque->bottom, memory_order_relaxed) - 1;
+    atomic_store_explicit(&deque->bottom, bottom, memory_order_relaxed);
+    // NOTE : the new bottom must be visible to thieves before we read top, or a thief and
+    // the owner could both take the last item
+    atomic_thread_fence(memory_order_seq_cst);
+    int64_t top = atomic_load_explicit(&deque->top, memory_order_relaxed);
+    if (top > bottom)
+    {
+        // empty, put bottom back
+        atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_relaxed);
+        return MPMC_EMPTY;
+    }
+    *item = atomic_load_explicit(&deque->items[bottom & deque->mask], memory_order_relaxed);
+    if (top < bottom)
+    {
+        // more than one item, no thief can reach this one
+        return MPMC_OK;
+    }
+    // the last item, race the thieves for it on top
+    int won = atomic_compare_exchange_strong_explicit(&deque->top, &top, top + 1,
+                                                      memory_order_seq_cst, memory_order_relaxed);
+    atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_relaxed);
+    return won ? MPMC_OK : MPMC_EMPTY;
+}
+
+int deque_steal(deque_t *deque, void **item)
+{
+    int64_t top = atomic_load_explicit(&deque->top, memory_order_acquire);
+    atomic_thread_fence(memory_order_seq_cst);
+    int64_t bottom = atomic_load_explicit(&deque->bottom, memory_order_acquire);
+    if (top >= bottom)
+    {
+        return MPMC_EMPTY;
+    }
+    // read before the CAS, once top moves the owner may reuse the cell
+    void *stolen = atomic_load_explicit(&deque->items[top & deque->mask], memory_order_relaxed);
+    if (!atomic_compare_exchange_strong_explicit(&deque->top, &top, top + 1,
+                                                 memory_order_seq_cst, memory_order_relaxed))
+    {
+        return DEQUE_ABORT;
+    }
+    *item = stolen;
+    return MPMC_OK;
+}
+
+int deque_size(deque_t *deque)
+{
+    int64_t bottom = atomic_load_explicit(&deque->bottom, memory_order_relaxed);
+    int64_t top = atomic_load_explicit(&deque->top, memory_order_relaxed);
+    return bottom > top ? (int)(bottom - top) : 0;
+}
+
+void deque_destroy(deque_t *deque)
+{
+    free(deque->items);
+    deque->items = NULL;
+}
@@ -0,0 +1,278 @@
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include "disruptor.h"
+#include "spin.h"
+// a cell holds message `seq` once its seq field is seq + 1, until then it still holds `seq - capacity`
+// (or nothing, the initial 0 matches no sequence of the first lap)
+
+static inline mpmc_cell_t *disruptor_get_cell(disruptor_t *ring, size_t seq)
+{
+    return (mpmc_cell_t *)(ring->buffer + (seq & ring->mask) * ring->stride);
+}
+static inline size_t disruptor_align_up(size_t value, size_t align)
+{
+    return (value + align - 1) & ~(align - 1);
+}
+
+int disruptor_init(disruptor_t *ring, int capacity, int item_size, int mode)
+{
+    if (capacity <= 0 || (capacity & (capacity - 1)) != 0 || item_size < 0 ||
+        (mode != MPMC_MODE_MPMC && mode != MPMC_MODE_SPMC))
+    {
+        return MPMC_INIT_FAILED;
+    }
+    ring->stride = disruptor_align_up(sizeof(mpmc_cell_t) + item_size, MPMC_CELL_ALIGN);
+    // aligned_alloc wants the size to be a multiple of the alignment
+    ring->buffer = aligned_alloc(MPMC_CACHE_LINE, disruptor_align_up(capacity * ring->stride, MPMC_CACHE_LINE));
+    if (ring->buffer == NULL)
+    {
+        return MPMC_INIT_FAILED;
+    }
+    ring->item_size = item_size;
+    ring->mask = (size_t)capacity - 1;
+    ring->capacity = capacity;
+    ring->mode = mode;
+    ring->consumer_count = 0;
+    atomic_store(&ring->claim, 0);
+    atomic_store(&ring->gate, 0);
+    for (size_t i = 0; i < (size_t)capacity; i++)
+    {
+        atomic_store(&disruptor_get_cell(ring, i)->seq, 0);
+    }
+    eventcount_init(&ring->consumer_event);
+    eventcount_init(&ring->producer_event);
+    adaptive_init(&ring->consumer_wait, wait_hybrid());
+    adaptive_init(&ring->producer_wait, wait_hybrid());
+    return MPMC_OK;
+}
+
+int disruptor_add_consumer(disruptor_t *ring, disruptor_consumer_t *consumer,
+                           disruptor_consumer_t **deps, int dep_count)
+{
+    if (ring->consumer_count >= DISRUPTOR_MAX_CONSUMERS || dep_count < 0 || dep_count > DISRUPTOR_MAX_DEPS)
+    {
+        return MPMC_INIT_FAILED;
+    }
+    atomic_store(&consumer->cursor, 0);
+    consumer->ring = ring;
+    consumer->dep_count = dep_count;
+    consumer->downstream = FALSE;
+    for (int i = 0; i < dep_count; i++)
+    {
+        consumer->deps[i] = deps[i];
+        deps[i]->downstream = TRUE;
+    }
+    ring->consumers[ring->consumer_count++] = consumer;
+    return MPMC_OK;
+}
+
+// -- producers --
+// the slowest consumer, a producer may claim up to gate + capacity
+static size_t disruptor_min_cursor(disruptor_t *ring)
+{
+    size_t min = atomic_load(&ring->claim);
+    for (int i = 0; i < ring->consumer_count; i++)
+    {
+        size_t cursor = atomic_load_explicit(&ring->consumers[i]->cursor, memory_order_acquire);
+        if (cursor < min)
+            min = cursor;
+    }
+    return min;
+}
+// cells free for the claim `next`, a stale gate may be more than a lap behind it
+static inline size_t disruptor_free(disruptor_t *ring, size_t gate, size_t next)
+{
+    return gate + ring->capacity > next ? gate + ring->capacity - next : 0;
+}
+int disruptor_claim(disruptor_t *ring, int count, size_t *seq)
+{
+    size_t next = atomic_load_explicit(&ring->claim, memory_order_relaxed);
+    while (1)
+    {
+        // the cached gate is enough most of the time, the consumers are only read when it looks full
+        size_t gate = atomic_load_explicit(&ring->gate, memory_order_acquire);
+        size_t free = disruptor_free(ring, gate, next);
+        if (free < (size_t)count)
+        {
+            gate = disruptor_min_cursor(ring);
+            // NOTE : a racing producer may store an older gate, it is only more conservative
+            atomic_store_explicit(&ring->gate, gate, memory_order_release);
+            free = disruptor_free(ring, gate, next);
+            if (free == 0)
+            {
+                return 0;
+            }
+        }
+        int claimed = free < (size_t)count ? (int)free : count;
+        if (ring->mode == MPMC_MODE_SPMC)
+        {
+            // nobody else moves the claim
+            atomic_store_explicit(&ring->claim, next + claimed, memory_order_relaxed);
+            *seq = next;
+            return claimed;
+        }
+        if (atomic_compare_exchange_weak(&ring->claim, &next, next + claimed))
+        {
+            *seq = next;
+            return claimed;
+        }
+    }
+}
+// arguments and result of a claim or poll retried by adaptive_spin
+typedef struct
+{
+    disruptor_t *ring;
+    disruptor_consumer_t *consumer;
+    int count;
+    size_t *seq;
+    int claimed;
+} disruptor_try_t;
+static int disruptor_try_claim(void *ctx)
+{
+    disruptor_try_t *attempt = ctx;
+    attempt->claimed = disruptor_claim(attempt->ring, attempt->count, attempt->seq);
+    return attempt->claimed > 0;
+}
+int disruptor_claim_block(disruptor_t *ring, int count, size_t *seq)
+{
+    int claimed = disruptor_claim(ring, count, seq);
+    if (claimed > 0)
+    {
+        return claimed;
+    }
+    disruptor_try_t attempt = {ring, NULL, count, seq, 0};
+    if (adaptive_spin(&ring->producer_wait, disruptor_try_claim, &attempt))
+    {
+        return attempt.claimed;
+    }
+    while (1)
+    {
+        // registered before the last check, so a release that follows it can't miss us
+        uint32_t key = eventcount_prepare_wait(&ring->producer_event);
+        atomic_thread_fence(memory_order_seq_cst);
+        claimed = disruptor_claim(ring, count, seq);
+        if (claimed > 0)
+        {
+            eventcount_cancel_wait(&ring->producer_event);
+            adaptive_parked(&ring->producer_wait);
+            return claimed;
+        }
+        eventcount_commit_wait(&ring->producer_event, key);
+    }
+}
+void disruptor_publish(disruptor_t *ring, size_t seq, int count)
+{
+    for (int i = 0; i < count; i++)
+    {
+        atomic_store_explicit(&disruptor_get_cell(ring, seq + i)->seq, seq + i + 1, memory_order_release);
+    }
+    // the eventcount is read after the stores, see disruptor_release
+    atomic_thread_fence(memory_order_seq_cst);
+    // every consumer wants every message
+    eventcount_notify_all(&ring->consumer_event);
+}
+int disruptor_send(disruptor_t *ring, void *message)
+{
+    size_t seq;
+    if (disruptor_claim(ring, 1, &seq) == 0)
+    {
+        return MPMC_FULL;
+    }
+    memcpy(disruptor_get(ring, seq), message, ring->item_size);
+    disruptor_publish(ring, seq, 1);
+    return MPMC_OK;
+}
+int disruptor_send_block(disruptor_t *ring, void *message)
+{
+    size_t seq;
+    disruptor_claim_block(ring, 1, &seq);
+    memcpy(disruptor_get(ring, seq), message, ring->item_size);
+    disruptor_publish(ring, seq, 1);
+    return MPMC_OK;
+}
+
+// -- consumers --
+int disruptor_poll(disruptor_consumer_t *consumer, int max, size_t *seq)
+{
+    disruptor_t *ring = consumer->ring;
+    // only we move our cursor
+    size_t cursor = atomic_load_explicit(&consumer->cursor, memory_order_relaxed);
+    size_t end = cursor + max;
+    if (consumer->dep_count > 0)
+    {
+        // the dependencies only release published messages, their cursors are the barrier
+        for (int i = 0; i < consumer->dep_count; i++)
+        {
+            size_t released = atomic_load_explicit(&consumer->deps[i]->cursor, memory_order_acquire);
+            if (released < end)
+                end = released;
+        }
+    }
+    else
+    {
+        // the publishes of several producers may complete out of order, stop at the first gap
+        size_t last = cursor;
+        while (last < end &&
+               atomic_load_explicit(&disruptor_get_cell(ring, last)->seq, memory_order_acquire) == last + 1)
+        {
+            last++;
+        }
+        end = last;
+    }
+    *seq = cursor;
+    return (int)(end - cursor);
+}
+static int disruptor_try_poll(void *ctx)
+{
+    disruptor_try_t *attempt = ctx;
+    attempt->claimed = disruptor_poll(attempt->consumer, attempt->count, attempt->seq);
+    return attempt->claimed > 0;
+}
+int disruptor_poll_block(disruptor_consumer_t *consumer, int max, size_t *seq)
+{
+    disruptor_t *ring = consumer->ring;
+    int count = disruptor_poll(consumer, max, seq);
+    if (count > 0)
+    {
+        return count;
+    }
+    disruptor_try_t attempt = {ring, consumer, max, seq, 0};
+    if (adaptive_spin(&ring->consumer_wait, disruptor_try_poll, &attempt))
+    {
+        return attempt.claimed;
+    }
+    while (1)
+    {
+        uint32_t key = eventcount_prepare_wait(&ring->consumer_event);
+        atomic_thread_fence(memory_order_seq_cst);
+        count = disruptor_poll(consumer, max, seq);
+        if (count > 0)
+        {
+            eventcount_cancel_wait(&ring->consumer_event);
+            adaptive_parked(&ring->consumer_wait);
+            return count;
+        }
+        eventcount_commit_wait(&ring->consumer_event, key);
+    }
+}
+void disruptor_release(disruptor_consumer_t *consumer, int count)
+{
+    disruptor_t *ring = consumer->ring;
+    size_t cursor = atomic_load_explicit(&consumer->cursor, memory_order_relaxed);
+    atomic_store_explicit(&consumer->cursor, cursor + count, memory_order_release);
+    // NOTE : a release store alone may be reordered after the load of the eventcount state,
+    // a waiter that registered in between would then sleep through our release
+    atomic_thread_fence(memory_order_seq_cst);
+    eventcount_notify_all(&ring->producer_event);
+    if (consumer->downstream)
+        eventcount_notify_all(&ring->consumer_event);
+}
+
+void disruptor_destroy(disruptor_t *ring)
+{
+    free(ring->buffer);
+    ring->buffer = NULL;
+    eventcount_destroy(&ring->consumer_event);
+    eventcount_destroy(&ring->producer_event);
+}
@@ -0,0 +1,260 @@
+#include <stdatomic.h>
+#include <stdlib.h>
+#include "executor.h"
+#include "spin.h"
+
+// the worker running on this thread, NULL outside of any pool
+static _Thread_local executor_worker_t *executor_local;
+
+static inline uint32_t executor_random(executor_worker_t *worker)
+{
+    uint32_t x = worker->seed;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    worker->seed = x;
+    return x;
+}
+
+// -- sleep / wake --
+// the state that matters is `searching` and `idle` : a spawn first publishes its task,
+// then reads them (seq_cst), a worker going to sleep first registers in `idle` (and leaves
+// `searching`), then looks at every queue again. one of the two always sees the other.
+
+// wake a sleeper unless somebody is already looking for work, the woken worker starts searching
+static void executor_notify(executor_t *executor)
+{
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load(&executor->searching) != 0 || atomic_load(&executor->idle) == 0)
+    {
+        return;
+    }
+    pthread_mutex_lock(&executor->idle_mutex);
+    if (executor->idle_count == 0)
+    {
+        pthread_mutex_unlock(&executor->idle_mutex);
+        return;
+    }
+    executor_worker_t *worker = &executor->workers[executor->idle_list[--executor->idle_count]];
+    worker->idle = FALSE;
+    atomic_fetch_sub(&executor->idle, 1);
+    atomic_fetch_add(&executor->searching, 1);
+    pthread_mutex_unlock(&executor->idle_mutex);
+    unpark(&worker->parker);
+}
+static inline int executor_start_search(executor_t *executor)
+{
+    // NOTE : more searchers only fight over the same few tasks
+    int searching = atomic_load(&executor->searching);
+    if (2 * searching >= executor->count)
+        return FALSE;
+    atomic_fetch_add(&executor->searching, 1);
+    return TRUE;
+}
+// a searcher found work, if it was the last one there may be more, keep somebody looking
+static inline void executor_end_search(executor_t *executor)
+{
+    if (atomic_fetch_sub(&executor->searching, 1) == 1)
+        executor_notify(executor);
+}
+
+// -- finding work --
+static executor_task_t *executor_steal(executor_t *executor, executor_worker_t *worker)
+{
+    int start = (int)(executor_random(worker) % (uint32_t)executor->count);
+    for (int i = 0; i < executor->count; i++)
+    {
+        executor_worker_t *victim = &executor->workers[(start + i) % executor->count];
+        if (victim == worker)
+            continue;
+        void *task;
+        int result;
+        // DEQUE_ABORT : somebody else got the top item, the next one may still be there
+        while ((result = deque_steal(&victim->deque, &task)) == DEQUE_ABORT)
+            CPU_HINT_LOOP();
+        if (result == MPMC_OK)
+            return task;
+    }
+    executor_task_t *task;
+    if (segqueue_recv(&executor->injector, &task) == MPMC_OK)
+        return task;
+    return NULL;
+}
+static executor_task_t *executor_find(executor_t *executor, executor_worker_t *worker, int *searching)
+{
+    executor_task_t *task;
+    void *local;
+    if (++worker->ticks % EXECUTOR_INJECTOR_INTERVAL == 0 && segqueue_recv(&executor->injector, &task) == MPMC_OK)
+        return task;
+    if (deque_pop(&worker->deque, &local) == MPMC_OK)
+        return local;
+    if (segqueue_recv(&executor->injector, &task) == MPMC_OK)
+        return task;
+    if (!*searching)
+        *searching = executor_start_search(executor);
+    if (!*searching)
+        return NULL;
+    return executor_steal(executor, worker);
+}
+// go to sleep, returns a task found by the last look before sleeping, if any
+static executor_task_t *executor_idle(executor_t *executor, executor_worker_t *worker, int *searching)
+{
+    pthread_mutex_lock(&executor->idle_mutex);
+    executor->idle_list[executor->idle_count++] = worker->index;
+    worker->idle = TRUE;
+    atomic_fetch_add(&executor->idle, 1);
+    if (*searching)
+        atomic_fetch_sub(&executor->searching, 1);
+    *searching = FALSE;
+    pthread_mutex_unlock(&executor->idle_mutex);
+
+    atomic_thread_fence(memory_order_seq_cst);
+    executor_task_t *task = executor_steal(executor, worker);
+    if (task != NULL || atomic_load(&executor->shutdown))
+    {
+        pthread_mutex_lock(&executor->idle_mutex);
+        int listed = worker->idle;
+        if (listed)
+        {
+            for (int i = 0; i < executor->idle_count; i++)
+            {
+                if (executor->idle_list[i] == worker->index)
+                {
+                    executor->idle_list[i] = executor->idle_list[--executor->idle_count];
+                    break;
+                }
+            }
+            worker->idle = FALSE;
+            atomic_fetch_sub(&executor->idle, 1);
+        }
+        pthread_mutex_unlock(&executor->idle_mutex);
+        if (listed)
+            return task;
+        // a notify took us out of the list first, take its token, it counted us as searching
+    }
+    park(&worker->parker);
+    *searching = TRUE;
+    return task;
+}
+
+static void *executor_worker_main(void *arg)
+{
+    executor_worker_t *worker = arg;
+    executor_t *executor = worker->executor;
+    int searching = FALSE;
+    executor_local = worker;
+    while (!atomic_load_explicit(&executor->shutdown, memory_order_relaxed))
+    {
+        executor_task_t *task = executor_find(executor, worker, &searching);
+        if (task == NULL)
+            task = executor_idle(executor, worker, &searching);
+        if (task == NULL)
+            continue;
+        if (searching)
+        {
+            searching = FALSE;
+            executor_end_search(executor);
+        }
+        task->run(task);
+    }
+    executor_local = NULL;
+    return NULL;
+}
+
+// stop and join the first `started` workers, then free everything, the other workers
+// only have their deque and parker
+static void executor_stop(executor_t *executor, int started)
+{
+    atomic_store(&executor->shutdown, TRUE);
+    // every worker gets a token, the running ones just find it on their next sleep
+    for (int i = 0; i < started; i++)
+    {
+        unpark(&executor->workers[i].parker);
+    }
+    for (int i = 0; i < started; i++)
+    {
+        pthread_join(executor->workers[i].thread, NULL);
+    }
+    for (int i = 0; i < executor->count; i++)
+    {
+        deque_destroy(&executor->workers[i].deque);
+        parker_destroy(&executor->workers[i].parker);
+    }
+    segqueue_destroy(&executor->injector);
+    pthread_mutex_destroy(&executor->idle_mutex);
+    free(executor->workers);
+    free(executor->idle_list);
+}
+
+int executor_init(executor_t *executor, int workers)
+{
+    if (workers <= 0)
+    {
+        return MPMC_INIT_FAILED;
+    }
+    executor->workers = calloc(workers, sizeof(executor_worker_t));
+    executor->idle_list = calloc(workers, sizeof(int));
+    if (executor->workers == NULL || executor->idle_list == NULL ||
+        segqueue_init(&executor->injector, sizeof(executor_task_t *)) != MPMC_OK)
+    {
+        free(executor->workers);
+        free(executor->idle_list);
+        return MPMC_INIT_FAILED;
+    }
+    executor->count = workers;
+    executor->idle_count = 0;
+    atomic_store(&executor->searching, 0);
+    atomic_store(&executor->idle, 0);
+    atomic_store(&executor->shutdown, FALSE);
+    pthread_mutex_init(&executor->idle_mutex, NULL);
+    for (int i = 0; i < workers; i++)
+    {
+        executor_worker_t *worker = &executor->workers[i];
+        if (deque_init(&worker->deque, EXECUTOR_DEQUE_CAPACITY) != MPMC_OK)
+        {
+            // NOTE : no thread runs yet, the workers that did init are freed by hand
+            for (int j = 0; j < i; j++)
+            {
+                deque_destroy(&executor->workers[j].deque);
+                parker_destroy(&executor->workers[j].parker);
+            }
+            pthread_mutex_destroy(&executor->idle_mutex);
+            segqueue_destroy(&executor->injector);
+            free(executor->workers);
+            free(executor->idle_list);
+            return MPMC_INIT_FAILED;
+        }
+        parker_init(&worker->parker);
+        worker->executor = executor;
+        worker->index = i;
+        worker->seed = 0x9e3779b9u * (uint32_t)(i + 1);
+        worker->idle = FALSE;
+        worker->ticks = 0;
+    }
+    for (int i = 0; i < workers; i++)
+    {
+        if (pthread_create(&executor->workers[i].thread, NULL, executor_worker_main, &executor->workers[i]) != 0)
+        {
+            // NOTE : the started workers steal from every deque and read count, both stay
+            // untouched until they are joined
+            executor_stop(executor, i);
+            return MPMC_INIT_FAILED;
+        }
+    }
+    return MPMC_OK;
+}
+
+void executor_spawn(executor_t *executor, executor_task_t *task)
+{
+    executor_worker_t *worker = executor_local;
+    if (worker == NULL || worker->executor != executor || deque_push(&worker->deque, task) != MPMC_OK)
+    {
+        segqueue_send(&executor->injector, &task);
+    }
+    executor_notify(executor);
+}
+
+void executor_shutdown(executor_t *executor)
+{
+    executor_stop(executor, executor->count);
+}
@@ -0,0 +1,87 @@
+#include "histogram.h"
+
+void histogram_reset(histogram_t *histogram)
+{
+    for (int i = 0; i < HISTOGRAM_BUCKETS; i++)
+    {
+        atomic_store_explicit(&histogram->counts[i], 0, memory_order_relaxed);
+    }
+    atomic_store_explicit(&histogram->max, 0, memory_order_relaxed);
+}
+
+void histogram_merge(histogram_t *dst, histogram_t *src)
+{
+    for (int i = 0; i < HISTOGRAM_BUCKETS; i++)
+    {
+        uint64_t count = atomic_load_explicit(&src->counts[i], memory_order_relaxed);
+        // most buckets are empty, don't dirty their cache lines
+        if (count != 0)
+            atomic_fetch_add_explicit(&dst->counts[i], count, memory_order_relaxed);
+    }
+    uint64_t value = atomic_load_explicit(&src->max, memory_order_relaxed);
+    uint64_t max = atomic_load_explicit(&dst->max, memory_order_relaxed);
+    while (value > max &&
+           !atomic_compare_exchange_weak_explicit(&dst->max, &max, value, memory_order_relaxed, memory_order_relaxed))
+        ;
+}
+
+uint64_t histogram_bucket_value(int bucket)
+{
+    if (bucket < 2 * HISTOGRAM_SUB_BUCKETS)
+        return (uint64_t)bucket;
+    // inverse of histogram_bucket
+    int shift = bucket / HISTOGRAM_SUB_BUCKETS - 1;
+    return (uint64_t)(bucket - shift * HISTOGRAM_SUB_BUCKETS) << shift;
+}
+
+uint64_t histogram_count(histogram_t *histogram)
+{
+    uint64_t total = 0;
+    for (int i = 0; i < HISTOGRAM_BUCKETS; i++)
+    {
+        total += atomic_load_explicit(&histogram->counts[i], memory_order_relaxed);
+    }
+    return total;
+}
+
+uint64_t histogram_percentile(histogram_t *histogram, double percentile)
+{
+    uint64_t total = histogram_count(histogram);
+    if (total == 0)
+        return 0;
+    uint64_t rank = (uint64_t)(percentile / 100.0 * total);
+    if (rank >= total)
+        rank = total - 1;
+    uint64_t seen = 0;
+    for (int i = 0; i < HISTOGRAM_BUCKETS; i++)
+    {
+        seen += atomic_load_explicit(&histogram->counts[i], memory_order_relaxed);
+        if (seen > rank)
+            return histogram_bucket_value(i);
+    }
+    // the buckets grew since we counted them
+    return atomic_load_explicit(&histogram->max, memory_order_relaxed);
+}
+
+double histogram_mean(histogram_t *histogram)
+{
+    double sum = 0;
+    uint64_t total = 0;
+    for (int i = 0; i < HISTOGRAM_BUCKETS; i++)
+    {
+        uint64_t count = atomic_load_explicit(&histogram->counts[i], memory_order_relaxed);
+        if (count == 0)
+            continue;
+        // the last bucket ends past UINT64_MAX, the double doesn't mind
+        double low = (double)histogram_bucket_value(i);
+        double high = i + 1 < HISTOGRAM_BUCKETS ? (double)histogram_bucket_value(i + 1) : 2 * low;
+        sum += count * (low + high - 1) / 2;
+        total += count;
+    }
+    return total == 0 ? 0 : sum / total;
+}
+
+uint64_t histogram_max(histogram_t *histogram)
+{
+    return atomic_load_explicit(&histogram->max, memory_order_relaxed);
+}
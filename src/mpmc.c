@@ -1,31 +1,86 @@
 
+// memfd_create
+#define _GNU_SOURCE
 #include <stdatomic.h>
 #include <stdlib.h>
-#include <libc.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#ifdef __linux__
+#include <sys/eventfd.h>
+#endif
 #include "mpmc.h"
 #include "parker.h"
 #include "spin.h"
 #define MPMC_SPIN ((spin_t){.next = 1, .pow = 2, .max = 6})
-static inline mpmc_cell_t *mpmc_get_cell(mpmc_t *queue, size_t i)
+// stats_t counters come in pairs, counter + MPMC_STATS_SEND / counter + MPMC_STATS_RECV (see mpmc_stats_t).
+// the side is also the index of the wakeup stamp
+#define MPMC_STATS_SEND 0
+#define MPMC_STATS_RECV 1
+#define MPMC_STAT_CAS_RETRY 0
+#define MPMC_STAT_SPIN_EXHAUSTED 2
+#define MPMC_STAT_NO_CELL 4
+#define MPMC_STAT_PARK 6
+#define MPMC_STAT_UNPARK 8
+#define MPMC_STAT_WAKE_NS 10
+// `pos` is an unbounded position (head/tail), the ring index is taken here
+static inline size_t mpmc_index(mpmc_t *queue, size_t pos)
 {
-
-    size_t cell_size = sizeof(mpmc_cell_t) + queue->item_size;
-    return (mpmc_cell_t *)(queue->buffer + i * cell_size);
+    return queue->mask != 0 ? pos & queue->mask : pos % queue->capacity;
+}
+static inline size_t mpmc_align_up(size_t value, size_t align)
+{
+    return (value + align - 1) & ~(align - 1);
+}
+// the cells of a shared queue follow its header in the region
+#define MPMC_SHARED_CELLS mpmc_align_up(sizeof(mpmc_t), MPMC_CACHE_LINE)
+// a shared queue is mapped at a different address in every process, it has no cell pointer
+// and finds its cells from its own address
+static inline unsigned char *mpmc_buffer(mpmc_t *queue)
+{
+    if (queue->buffer != NULL)
+        return queue->buffer;
+    return (unsigned char *)queue + MPMC_SHARED_CELLS;
+}
+static inline mpmc_cell_t *mpmc_get_cell(mpmc_t *queue, size_t pos)
+{
+    return (mpmc_cell_t *)(mpmc_buffer(queue) + mpmc_index(queue, pos) * queue->stride);
 }
 
 int mpmc_init(mpmc_t *queue, int capacity, int item_size)
 {
-    queue->buffer = malloc(capacity * (sizeof(mpmc_cell_t) + item_size));
+    return mpmc_init_mode(queue, capacity, item_size, MPMC_MODE_MPMC);
+}
 
-    if (queue->buffer == NULL)
-    {
-        return MPMC_INIT_FAILED;
-    }
+int mpmc_init_mode(mpmc_t *queue, int capacity, int item_size, int mode)
+{
+    return mpmc_init_wait(queue, capacity, item_size, mode, wait_hybrid());
+}
 
+// everything but the allocation of the cells, `buffer` is NULL for a shared queue,
+// which also gets process-shared eventcounts
+static void mpmc_setup(mpmc_t *queue, unsigned char *buffer, int capacity, int item_size, int mode,
+                       wait_strategy_t strategy)
+{
+    int shared = buffer == NULL;
+    queue->buffer = buffer;
+    queue->shared_size = 0;
+    queue->mask = (capacity & (capacity - 1)) == 0 ? (size_t)capacity - 1 : 0;
     queue->capacity = capacity;
     queue->item_size = item_size;
+    queue->mode = mode;
     atomic_store(&queue->head, 0);
     atomic_store(&queue->tail, 0);
+    queue->cached_head = 0;
+    queue->cached_tail = 0;
+    queue->claimed_tail = 0;
+    queue->claimed_head = 0;
+#ifdef MPMC_LATENCY
+    queue->stamps = NULL;
+    queue->latency = NULL;
+    queue->sample_mask = 0;
+#endif
     for (size_t i = 0; i < capacity; i++)
     {
         // get the cell
@@ -33,124 +88,1045 @@ int mpmc_init(mpmc_t *queue, int capacity, int item_size)
         // init the seq
         atomic_store(&cell->seq, i);
     }
-    parker_init(&queue->send_parker);
-    parker_init(&queue->recv_parker);
+    if (shared)
+    {
+        eventcount_init_shared(&queue->send_event);
+        eventcount_init_shared(&queue->recv_event);
+    }
+    else
+    {
+        eventcount_init(&queue->send_event);
+        eventcount_init(&queue->recv_event);
+    }
+    for (int i = 0; i < MPMC_WATCHERS; i++)
+    {
+        atomic_store(&queue->recv_watchers[i], NULL);
+        atomic_store(&queue->send_watchers[i], NULL);
+    }
+    atomic_store(&queue->recv_watched, 0);
+    atomic_store(&queue->send_watched, 0);
+    atomic_store(&queue->recv_fd, -1);
+    atomic_store(&queue->send_fd, -1);
+    atomic_store(&queue->recv_armed, FALSE);
+    atomic_store(&queue->send_armed, FALSE);
+    adaptive_init(&queue->send_wait, strategy);
+    adaptive_init(&queue->recv_wait, strategy);
+#ifdef SYNC_STATS
+    stats_init(&queue->stats);
+#endif
+}
+static inline int mpmc_valid(int capacity, int item_size, int mode)
+{
+    return capacity > 0 && item_size >= 0 && mode >= MPMC_MODE_MPMC && mode <= MPMC_MODE_SPSC;
+}
+static inline size_t mpmc_stride(int item_size)
+{
+    return mpmc_align_up(sizeof(mpmc_cell_t) + item_size, MPMC_CELL_ALIGN);
+}
+
+int mpmc_init_wait(mpmc_t *queue, int capacity, int item_size, int mode, wait_strategy_t strategy)
+{
+    if (!mpmc_valid(capacity, item_size, mode))
+    {
+        return MPMC_INIT_FAILED;
+    }
+    queue->stride = mpmc_stride(item_size);
+    // aligned_alloc wants the size to be a multiple of the alignment
+    unsigned char *buffer = aligned_alloc(MPMC_CACHE_LINE, mpmc_align_up(capacity * queue->stride, MPMC_CACHE_LINE));
+
+    if (buffer == NULL)
+    {
+        return MPMC_INIT_FAILED;
+    }
+    mpmc_setup(queue, buffer, capacity, item_size, mode, strategy);
 
     return MPMC_OK;
 }
 
-int mpmc_send(mpmc_t *queue, void *message)
+static inline mpmc_cell_t *mpmc_slot_cell(void *slot)
+{
+    return (mpmc_cell_t *)((unsigned char *)slot - offsetof(mpmc_cell_t, data));
+}
+
+// SPSC : the producer owns the tail, head is only reloaded when the cached copy says we are full.
+// the tail itself is advanced by mpmc_publish_send.
+static inline int mpmc_claim_send_spsc(mpmc_t *queue, int count, size_t *pos)
+{
+    size_t tail = queue->claimed_tail;
+    size_t free = queue->capacity - (tail - queue->cached_head);
+    if (free < (size_t)count)
+    {
+        queue->cached_head = atomic_load_explicit(&queue->head, memory_order_acquire);
+        free = queue->capacity - (tail - queue->cached_head);
+        if (free == 0)
+        {
+            STATS_INC(&queue->stats, MPMC_STAT_NO_CELL + MPMC_STATS_SEND);
+            return MPMC_FULL;
+        }
+    }
+    if ((size_t)count > free)
+    {
+        count = (int)free;
+    }
+    queue->claimed_tail = tail + count;
+    *pos = tail;
+    return count;
+}
+// claim up to `count` free cells in a row starting at the tail with a single CAS,
+// returns how many were claimed and their first position in `pos`.
+// a cell at tail + i can only be taken by a producer that already moved the tail past it,
+// so the CAS validates the whole run.
+static inline int mpmc_claim_send(mpmc_t *queue, int count, size_t *pos)
 {
     size_t tail;
-    size_t seq;
+    int claimed;
     spin_t spin = MPMC_SPIN;
+    if (queue->mode == MPMC_MODE_SPSC)
+    {
+        return mpmc_claim_send_spsc(queue, count, pos);
+    }
     while (1)
     {
         tail = atomic_load(&queue->tail);
-        mpmc_cell_t *cell = mpmc_get_cell(queue, tail % queue->capacity);
-        seq = atomic_load(&cell->seq);
-        if (seq == tail)
-        {
-            if (atomic_compare_exchange_weak(&queue->tail, &tail, tail + 1))
-            {
-                memcpy(cell->data, message, queue->item_size);
-                atomic_store(&cell->seq, tail + 1);
-                if (atomic_load(&queue->recv_waiting) > 0)
-                {
-                    unpark(&queue->recv_parker);
-                }
-
-                return MPMC_OK;
-            }
-            else
-            {
-                if (spin_next(&spin) == TRUE)
-                {
-                    // NOTE : this isn't always mean the mpmc is full , but if we retry this many time,
-                    // it mean the send is "blocking", which isn't the purpose of this function
-                    return MPMC_EMPTY;
-                }
-            }
+        claimed = 0;
+        while (claimed < count && atomic_load(&mpmc_get_cell(queue, tail + claimed)->seq) == tail + claimed)
+        {
+            claimed++;
         }
-        else
+        if (claimed == 0)
         {
+            STATS_INC(&queue->stats, MPMC_STAT_NO_CELL + MPMC_STATS_SEND);
             return MPMC_FULL;
         }
+        if ((queue->mode & MPMC_SINGLE_PRODUCER) != 0)
+        {
+            // nobody else moves the tail
+            atomic_store_explicit(&queue->tail, tail + claimed, memory_order_relaxed);
+            *pos = tail;
+            return claimed;
+        }
+        if (atomic_compare_exchange_weak(&queue->tail, &tail, tail + claimed))
+        {
+            *pos = tail;
+            return claimed;
+        }
+        STATS_INC(&queue->stats, MPMC_STAT_CAS_RETRY + MPMC_STATS_SEND);
+        if (spin_next(&spin) == TRUE)
+        {
+            STATS_INC(&queue->stats, MPMC_STAT_SPIN_EXHAUSTED + MPMC_STATS_SEND);
+            // NOTE : this isn't always mean the mpmc is full , but if we retry this many time,
+            // it mean the send is "blocking", which isn't the purpose of this function
+            return MPMC_EMPTY;
+        }
     }
-};
-
-int mpmc_recv(mpmc_t *queue, void *message)
+}
+static inline int mpmc_claim_recv_spsc(mpmc_t *queue, int max, size_t *pos)
+{
+    size_t head = queue->claimed_head;
+    size_t ready = queue->cached_tail - head;
+    if (ready < (size_t)max)
+    {
+        queue->cached_tail = atomic_load_explicit(&queue->tail, memory_order_acquire);
+        ready = queue->cached_tail - head;
+        if (ready == 0)
+        {
+            STATS_INC(&queue->stats, MPMC_STAT_NO_CELL + MPMC_STATS_RECV);
+            return MPMC_EMPTY;
+        }
+    }
+    if ((size_t)max > ready)
+    {
+        max = (int)ready;
+    }
+    queue->claimed_head = head + max;
+    *pos = head;
+    return max;
+}
+static inline int mpmc_claim_recv(mpmc_t *queue, int max, size_t *pos)
 {
     size_t head;
-    size_t seq;
+    int claimed;
     spin_t spin = MPMC_SPIN;
+    if (queue->mode == MPMC_MODE_SPSC)
+    {
+        return mpmc_claim_recv_spsc(queue, max, pos);
+    }
     while (1)
     {
         head = atomic_load(&queue->head);
-        mpmc_cell_t *cell = mpmc_get_cell(queue, head % queue->capacity);
-        seq = atomic_load(&cell->seq);
-        if (seq == head + 1)
-        {
-            if (atomic_compare_exchange_weak(&queue->head, &head, head + 1))
-            {
-                memcpy(message, cell->data, queue->item_size);
-                atomic_store(&cell->seq, head + queue->capacity);
-                if (atomic_load(&queue->send_waiting) > 0)
-                {
-                    unpark(&queue->send_parker);
-                    /* code */
-                }
-                return MPMC_OK;
-            }
-            else
-            {
-                if (spin_next(&spin) == TRUE)
-                {
-                    // NOTE : this isn't always mean the mpmc is empty , but if we retry this many time,
-                    // it mean the recv is "blocking", which isn't the purpose of this function
-                    return MPMC_EMPTY;
-                }
-            }
+        claimed = 0;
+        while (claimed < max && atomic_load(&mpmc_get_cell(queue, head + claimed)->seq) == head + claimed + 1)
+        {
+            claimed++;
         }
-        else
+        if (claimed == 0)
         {
-
+            STATS_INC(&queue->stats, MPMC_STAT_NO_CELL + MPMC_STATS_RECV);
+            return MPMC_EMPTY;
+        }
+        if ((queue->mode & MPMC_SINGLE_CONSUMER) != 0)
+        {
+            // nobody else moves the head
+            atomic_store_explicit(&queue->head, head + claimed, memory_order_relaxed);
+            *pos = head;
+            return claimed;
+        }
+        if (atomic_compare_exchange_weak(&queue->head, &head, head + claimed))
+        {
+            *pos = head;
+            return claimed;
+        }
+        STATS_INC(&queue->stats, MPMC_STAT_CAS_RETRY + MPMC_STATS_RECV);
+        if (spin_next(&spin) == TRUE)
+        {
+            STATS_INC(&queue->stats, MPMC_STAT_SPIN_EXHAUSTED + MPMC_STATS_RECV);
+            // NOTE : this isn't always mean the mpmc is empty , but if we retry this many time,
+            // it mean the recv is "blocking", which isn't the purpose of this function
             return MPMC_EMPTY;
         }
     }
 }
-int mpmc_send_block(mpmc_t *queue, void *message)
+// write the eventfd if the loop acked since the last write, the publish stores come before
+// the load of `armed` (seq_cst), mpmc_eventfd_ack pairs with it
+static inline void mpmc_eventfd_signal(int fd, atomic_int *armed)
+{
+    if (atomic_load(armed) && atomic_exchange(armed, FALSE))
+    {
+        uint64_t one = 1;
+        // NOTE : can only fail if the counter overflows, it is reset by every ack
+        ssize_t written = write(fd, &one, sizeof(one));
+        (void)written;
+    }
+}
+// bit of recv_watched / send_watched set once the side has an eventfd
+#define MPMC_WATCHED_FD (1u << MPMC_WATCHERS)
+// wake up to `count` sleepers of one side (MPMC_STATS_SEND or MPMC_STATS_RECV)
+static inline void mpmc_notify(mpmc_t *queue, eventcount_t *event, int side, int count)
+{
+#ifdef SYNC_STATS
+    if ((atomic_load_explicit(&event->state, memory_order_relaxed) & EVENTCOUNT_WAITERS) != 0)
+    {
+        STATS_INC(&queue->stats, MPMC_STAT_UNPARK + side);
+        STATS_STAMP(&queue->stats, side);
+    }
+#else
+    (void)side;
+#endif
+    eventcount_notify_many(event, count);
+    int recv = side == MPMC_STATS_RECV;
+    unsigned watched = atomic_load_explicit(recv ? &queue->recv_watched : &queue->send_watched,
+                                            memory_order_acquire);
+    if (watched == 0)
+        return;
+    // a selector sleeps on its own eventcount, one wakeup is enough, it owns a single thread
+    _Atomic(eventcount_t *) *watchers = recv ? queue->recv_watchers : queue->send_watchers;
+    for (unsigned bits = watched & ~MPMC_WATCHED_FD; bits != 0; bits &= bits - 1)
+    {
+        eventcount_t *watcher = atomic_load_explicit(&watchers[__builtin_ctz(bits)], memory_order_acquire);
+        if (watcher != NULL)
+            eventcount_notify_one(watcher);
+    }
+    if ((watched & MPMC_WATCHED_FD) != 0)
+    {
+        atomic_int *fd = recv ? &queue->recv_fd : &queue->send_fd;
+        mpmc_eventfd_signal(atomic_load_explicit(fd, memory_order_relaxed),
+                            recv ? &queue->recv_armed : &queue->send_armed);
+    }
+}
+// -- latency --
+// a cell is stamped before it is published and read before it is handed back,
+// so the seq (or head/tail) protocol orders the stamp like the data.
+// only the cells whose ring index is a multiple of the sampling rate are timed, senders and
+// receivers pick the same cells without talking, and the other messages don't read the clock
+static inline void mpmc_stamp(mpmc_t *queue, size_t pos, int count)
 {
+#ifdef MPMC_LATENCY
+    if (queue->stamps == NULL)
+        return;
+    uint64_t now = 0;
+    for (int i = 0; i < count; i++)
+    {
+        size_t index = mpmc_index(queue, pos + i);
+        if ((index & queue->sample_mask) != 0)
+            continue;
+        // one clock read per batch
+        if (now == 0)
+            now = stats_now_ns();
+        queue->stamps[index] = now;
+    }
+#else
+    (void)queue, (void)pos, (void)count;
+#endif
+}
+static inline void mpmc_record(mpmc_t *queue, size_t pos, int count)
+{
+#ifdef MPMC_LATENCY
+    if (queue->latency == NULL)
+        return;
+    uint64_t now = 0;
+    for (int i = 0; i < count; i++)
+    {
+        size_t index = mpmc_index(queue, pos + i);
+        if ((index & queue->sample_mask) != 0)
+            continue;
+        if (now == 0)
+            now = stats_now_ns();
+        uint64_t then = queue->stamps[index];
+        histogram_record(queue->latency, now > then ? now - then : 0);
+    }
+#else
+    (void)queue, (void)pos, (void)count;
+#endif
+}
+// position of a reserved/peeked cell, the zero-copy calls only have the slot
+static inline size_t mpmc_slot_index(mpmc_t *queue, void *slot)
+{
+    return (size_t)((unsigned char *)slot - offsetof(mpmc_cell_t, data) - mpmc_buffer(queue)) / queue->stride;
+}
+
+// make `count` claimed cells starting at `pos` visible to consumers, every cell wakes at most one sleeper
+static inline void mpmc_publish_send(mpmc_t *queue, size_t pos, int count)
+{
+    mpmc_stamp(queue, pos, count);
+    if (queue->mode == MPMC_MODE_SPSC)
+    {
+        atomic_store(&queue->tail, pos + count);
+    }
+    else
+    {
+        for (int i = 0; i < count; i++)
+        {
+            atomic_store(&mpmc_get_cell(queue, pos + i)->seq, pos + i + 1);
+        }
+    }
+    mpmc_notify(queue, &queue->recv_event, MPMC_STATS_RECV, count);
+}
+// hand `count` consumed cells starting at `pos` back to the producers
+static inline void mpmc_publish_recv(mpmc_t *queue, size_t pos, int count)
+{
+    mpmc_record(queue, pos, count);
+    if (queue->mode == MPMC_MODE_SPSC)
+    {
+        atomic_store(&queue->head, pos + count);
+    }
+    else
+    {
+        for (int i = 0; i < count; i++)
+        {
+            atomic_store(&mpmc_get_cell(queue, pos + i)->seq, pos + i + queue->capacity);
+        }
+    }
+    mpmc_notify(queue, &queue->send_event, MPMC_STATS_SEND, count);
+}
+
+// NOTE : another thread may take the cell between the load of tail (head) and the load of its
+// seq, the seq is then ahead of what we expect. only a seq behind means full (empty), a seq
+// ahead means our position is stale and is loaded again, or a blocked thread could sleep (and
+// prio_recv drop a lane's bit) while the queue still has cells (messages) further on
+static inline int mpmc_can_send(mpmc_t *queue)
+{
+    size_t tail = atomic_load(&queue->tail);
+    if (queue->mode == MPMC_MODE_SPSC)
+        return tail - atomic_load(&queue->head) < (size_t)queue->capacity;
+    while (1)
+    {
+        intptr_t diff = (intptr_t)(atomic_load(&mpmc_get_cell(queue, tail)->seq) - tail);
+        if (diff <= 0)
+            return diff == 0;
+        tail = atomic_load(&queue->tail);
+    }
+}
+static inline int mpmc_can_recv(mpmc_t *queue)
+{
+    size_t head = atomic_load(&queue->head);
+    if (queue->mode == MPMC_MODE_SPSC)
+        return atomic_load(&queue->tail) != head;
     while (1)
     {
-        if (mpmc_send(queue, message) == MPMC_FULL)
+        intptr_t diff = (intptr_t)(atomic_load(&mpmc_get_cell(queue, head)->seq) - (head + 1));
+        if (diff <= 0)
+            return diff == 0;
+        head = atomic_load(&queue->head);
+    }
+}
+// sleep until `ready` says we can make progress,
+// we are registered on the eventcount before the last check so a publisher can't miss us
+static inline void mpmc_wait(mpmc_t *queue, eventcount_t *event, int side, int (*ready)(mpmc_t *))
+{
+#ifndef SYNC_STATS
+    (void)side;
+#endif
+    uint32_t key = eventcount_prepare_wait(event);
+    if (ready(queue))
+        eventcount_cancel_wait(event);
+    else
+    {
+        STATS_INC(&queue->stats, MPMC_STAT_PARK + side);
+        eventcount_commit_wait(event, key);
+        STATS_SINCE(&queue->stats, side, MPMC_STAT_WAKE_NS + side);
+    }
+}
+// arguments and result of a claim retried by adaptive_spin
+typedef struct
+{
+    mpmc_t *queue;
+    int count;
+    size_t *pos;
+    int claimed;
+} mpmc_claim_t;
+static int mpmc_try_claim_send(void *ctx)
+{
+    mpmc_claim_t *claim = ctx;
+    claim->claimed = mpmc_claim_send(claim->queue, claim->count, claim->pos);
+    return claim->claimed > 0;
+}
+static int mpmc_try_claim_recv(void *ctx)
+{
+    mpmc_claim_t *claim = ctx;
+    claim->claimed = mpmc_claim_recv(claim->queue, claim->count, claim->pos);
+    return claim->claimed > 0;
+}
+static int mpmc_claim_send_block(mpmc_t *queue, int count, size_t *pos)
+{
+    int claimed = mpmc_claim_send(queue, count, pos);
+    if (claimed > 0)
+    {
+        return claimed;
+    }
+    // the cells usually come back quickly, spin and yield before sleeping
+    mpmc_claim_t claim = {queue, count, pos, 0};
+    if (adaptive_spin(&queue->send_wait, mpmc_try_claim_send, &claim))
+    {
+        return claim.claimed;
+    }
+    while (1)
+    {
+        // NOTE : MPMC_EMPTY means we lost too many races, mpmc_wait sees the free cell and returns right away
+        mpmc_wait(queue, &queue->send_event, MPMC_STATS_SEND, mpmc_can_send);
+        claimed = mpmc_claim_send(queue, count, pos);
+        if (claimed > 0)
         {
-            atomic_fetch_add(&queue->send_waiting, 1);
-            park(&queue->send_parker);
-            atomic_fetch_sub(&queue->send_waiting, 1);
-            continue;
+            adaptive_parked(&queue->send_wait);
+            return claimed;
+        }
+    }
+}
+static int mpmc_claim_recv_block(mpmc_t *queue, int max, size_t *pos)
+{
+    int claimed = mpmc_claim_recv(queue, max, pos);
+    if (claimed > 0)
+    {
+        return claimed;
+    }
+    mpmc_claim_t claim = {queue, max, pos, 0};
+    if (adaptive_spin(&queue->recv_wait, mpmc_try_claim_recv, &claim))
+    {
+        return claim.claimed;
+    }
+    while (1)
+    {
+        mpmc_wait(queue, &queue->recv_event, MPMC_STATS_RECV, mpmc_can_recv);
+        claimed = mpmc_claim_recv(queue, max, pos);
+        if (claimed > 0)
+        {
+            adaptive_parked(&queue->recv_wait);
+            return claimed;
         }
-        return MPMC_OK;
     }
 }
+
+int mpmc_send(mpmc_t *queue, void *message)
+{
+    size_t tail;
+    int claimed = mpmc_claim_send(queue, 1, &tail);
+    if (claimed < 0)
+    {
+        return claimed;
+    }
+    memcpy(mpmc_get_cell(queue, tail)->data, message, queue->item_size);
+    mpmc_publish_send(queue, tail, 1);
+    return MPMC_OK;
+}
+
+int mpmc_recv(mpmc_t *queue, void *message)
+{
+    size_t head;
+    int claimed = mpmc_claim_recv(queue, 1, &head);
+    if (claimed < 0)
+    {
+        return claimed;
+    }
+    memcpy(message, mpmc_get_cell(queue, head)->data, queue->item_size);
+    mpmc_publish_recv(queue, head, 1);
+    return MPMC_OK;
+}
+int mpmc_send_block(mpmc_t *queue, void *message)
+{
+    size_t tail;
+    mpmc_claim_send_block(queue, 1, &tail);
+    memcpy(mpmc_get_cell(queue, tail)->data, message, queue->item_size);
+    mpmc_publish_send(queue, tail, 1);
+    return MPMC_OK;
+}
 int mpmc_recv_block(mpmc_t *queue, void *message)
 {
+    size_t head;
+    mpmc_claim_recv_block(queue, 1, &head);
+    memcpy(message, mpmc_get_cell(queue, head)->data, queue->item_size);
+    mpmc_publish_recv(queue, head, 1);
+    return MPMC_OK;
+}
+
+static inline void mpmc_copy_in(mpmc_t *queue, size_t pos, unsigned char *src, int count)
+{
+    for (int i = 0; i < count; i++)
+    {
+        memcpy(mpmc_get_cell(queue, pos + i)->data, src + i * queue->item_size, queue->item_size);
+    }
+}
+static inline void mpmc_copy_out(mpmc_t *queue, size_t pos, unsigned char *dst, int count)
+{
+    for (int i = 0; i < count; i++)
+    {
+        memcpy(dst + i * queue->item_size, mpmc_get_cell(queue, pos + i)->data, queue->item_size);
+    }
+}
+int mpmc_send_many(mpmc_t *queue, void *items, int count)
+{
+    size_t tail;
+    int claimed = mpmc_claim_send(queue, count, &tail);
+    if (claimed <= 0)
+    {
+        return 0;
+    }
+    mpmc_copy_in(queue, tail, items, claimed);
+    mpmc_publish_send(queue, tail, claimed);
+    return claimed;
+}
+
+int mpmc_recv_many(mpmc_t *queue, void *items, int max)
+{
+    size_t head;
+    int claimed = mpmc_claim_recv(queue, max, &head);
+    if (claimed <= 0)
+    {
+        return 0;
+    }
+    mpmc_copy_out(queue, head, items, claimed);
+    mpmc_publish_recv(queue, head, claimed);
+    return claimed;
+}
+int mpmc_send_many_block(mpmc_t *queue, void *items, int count)
+{
+    unsigned char *src = items;
+    int sent = 0;
+    while (sent < count)
+    {
+        size_t tail;
+        int claimed = mpmc_claim_send_block(queue, count - sent, &tail);
+        mpmc_copy_in(queue, tail, src + sent * queue->item_size, claimed);
+        mpmc_publish_send(queue, tail, claimed);
+        sent += claimed;
+    }
+    return MPMC_OK;
+}
+int mpmc_recv_many_block(mpmc_t *queue, void *items, int max)
+{
+    size_t head;
+    int claimed = mpmc_claim_recv_block(queue, max, &head);
+    mpmc_copy_out(queue, head, items, claimed);
+    mpmc_publish_recv(queue, head, claimed);
+    return claimed;
+}
+
+// -- zero copy --
+// a reserved/peeked cell keeps its old seq until it is committed/released,
+// so the position can be recovered from the cell itself and the api only deals in slot pointers
+static inline void mpmc_get_slots(mpmc_t *queue, size_t pos, void **slots, int count)
+{
+    for (int i = 0; i < count; i++)
+    {
+        slots[i] = mpmc_get_cell(queue, pos + i)->data;
+    }
+}
+int mpmc_send_reserve(mpmc_t *queue, void **slot)
+{
+    size_t tail;
+    int claimed = mpmc_claim_send(queue, 1, &tail);
+    if (claimed < 0)
+    {
+        return claimed;
+    }
+    *slot = mpmc_get_cell(queue, tail)->data;
+    return MPMC_OK;
+}
+int mpmc_send_reserve_block(mpmc_t *queue, void **slot)
+{
+    size_t tail;
+    mpmc_claim_send_block(queue, 1, &tail);
+    *slot = mpmc_get_cell(queue, tail)->data;
+    return MPMC_OK;
+}
+int mpmc_send_reserve_many(mpmc_t *queue, void **slots, int max)
+{
+    size_t tail;
+    int claimed = mpmc_claim_send(queue, max, &tail);
+    if (claimed <= 0)
+    {
+        return 0;
+    }
+    mpmc_get_slots(queue, tail, slots, claimed);
+    return claimed;
+}
+int mpmc_send_reserve_many_block(mpmc_t *queue, void **slots, int max)
+{
+    size_t tail;
+    int claimed = mpmc_claim_send_block(queue, max, &tail);
+    mpmc_get_slots(queue, tail, slots, claimed);
+    return claimed;
+}
+void mpmc_send_commit(mpmc_t *queue, void *slot)
+{
+    mpmc_send_commit_many(queue, &slot, 1);
+}
+void mpmc_send_commit_many(mpmc_t *queue, void **slots, int count)
+{
+    if (queue->mode == MPMC_MODE_SPSC)
+    {
+        // slots are committed in reservation order, so this is just the next `count` positions
+        mpmc_publish_send(queue, atomic_load_explicit(&queue->tail, memory_order_relaxed), count);
+        return;
+    }
+    for (int i = 0; i < count; i++)
+    {
+        mpmc_stamp(queue, mpmc_slot_index(queue, slots[i]), 1);
+        mpmc_cell_t *cell = mpmc_slot_cell(slots[i]);
+        // seq still holds the claimed position
+        atomic_store(&cell->seq, atomic_load_explicit(&cell->seq, memory_order_relaxed) + 1);
+    }
+    mpmc_notify(queue, &queue->recv_event, MPMC_STATS_RECV, count);
+}
+
+int mpmc_recv_peek(mpmc_t *queue, void **slot)
+{
+    size_t head;
+    int claimed = mpmc_claim_recv(queue, 1, &head);
+    if (claimed < 0)
+    {
+        return claimed;
+    }
+    *slot = mpmc_get_cell(queue, head)->data;
+    return MPMC_OK;
+}
+int mpmc_recv_peek_block(mpmc_t *queue, void **slot)
+{
+    size_t head;
+    mpmc_claim_recv_block(queue, 1, &head);
+    *slot = mpmc_get_cell(queue, head)->data;
+    return MPMC_OK;
+}
+int mpmc_recv_peek_many(mpmc_t *queue, void **slots, int max)
+{
+    size_t head;
+    int claimed = mpmc_claim_recv(queue, max, &head);
+    if (claimed <= 0)
+    {
+        return 0;
+    }
+    mpmc_get_slots(queue, head, slots, claimed);
+    return claimed;
+}
+int mpmc_recv_peek_many_block(mpmc_t *queue, void **slots, int max)
+{
+    size_t head;
+    int claimed = mpmc_claim_recv_block(queue, max, &head);
+    mpmc_get_slots(queue, head, slots, claimed);
+    return claimed;
+}
+void mpmc_recv_release(mpmc_t *queue, void *slot)
+{
+    mpmc_recv_release_many(queue, &slot, 1);
+}
+void mpmc_recv_release_many(mpmc_t *queue, void **slots, int count)
+{
+    if (queue->mode == MPMC_MODE_SPSC)
+    {
+        mpmc_publish_recv(queue, atomic_load_explicit(&queue->head, memory_order_relaxed), count);
+        return;
+    }
+    for (int i = 0; i < count; i++)
+    {
+        mpmc_record(queue, mpmc_slot_index(queue, slots[i]), 1);
+        mpmc_cell_t *cell = mpmc_slot_cell(slots[i]);
+        // seq holds position + 1, the producers expect position + capacity
+        atomic_store(&cell->seq, atomic_load_explicit(&cell->seq, memory_order_relaxed) - 1 + queue->capacity);
+    }
+    mpmc_notify(queue, &queue->send_event, MPMC_STATS_SEND, count);
+}
+// -- select --
+// the cases are tried round robin, starting after the last one that completed
+int mpmc_select(mpmc_selector_t *selector)
+{
+    for (int i = 0; i < selector->count; i++)
+    {
+        int index = (selector->next + i) % selector->count;
+        mpmc_select_case_t *c = &selector->cases[index];
+        int result = c->op == MPMC_SELECT_RECV ? mpmc_recv(c->queue, c->message) : mpmc_send(c->queue, c->message);
+        if (result == MPMC_OK)
+        {
+            selector->next = (index + 1) % selector->count;
+            return index;
+        }
+    }
+    return MPMC_EMPTY;
+}
+// NOTE : goes through the retrying checks, a plain receiver racing the selector on one of the
+// queues would otherwise make it sleep on a queue that holds messages
+static int mpmc_select_ready(mpmc_selector_t *selector)
+{
+    for (int i = 0; i < selector->count; i++)
+    {
+        mpmc_select_case_t *c = &selector->cases[i];
+        if (c->op == MPMC_SELECT_RECV ? mpmc_can_recv(c->queue) : mpmc_can_send(c->queue))
+            return TRUE;
+    }
+    return FALSE;
+}
+void mpmc_selector_init(mpmc_selector_t *selector)
+{
+    selector->count = 0;
+    selector->next = 0;
+    eventcount_init(&selector->event);
+    adaptive_init(&selector->wait, wait_hybrid());
+}
+int mpmc_selector_add(mpmc_selector_t *selector, mpmc_t *queue, int op, void *message)
+{
+    if (selector->count >= MPMC_SELECT_MAX || (op != MPMC_SELECT_RECV && op != MPMC_SELECT_SEND) ||
+        queue->shared_size != 0)
+    {
+        return MPMC_INIT_FAILED;
+    }
+    _Atomic(eventcount_t *) *watchers = op == MPMC_SELECT_RECV ? queue->recv_watchers : queue->send_watchers;
+    int slot = -1;
+    for (int i = 0; i < MPMC_WATCHERS; i++)
+    {
+        eventcount_t *watcher = atomic_load_explicit(&watchers[i], memory_order_relaxed);
+        // a selector with several cases on the same side of a queue only needs one slot
+        if (watcher == &selector->event)
+        {
+            slot = i;
+            break;
+        }
+        if (watcher == NULL && slot < 0)
+            slot = i;
+    }
+    if (slot < 0)
+    {
+        return MPMC_INIT_FAILED;
+    }
+    atomic_store_explicit(&watchers[slot], &selector->event, memory_order_relaxed);
+    // the slot is written before its bit, mpmc_notify loads the mask with acquire
+    atomic_fetch_or_explicit(op == MPMC_SELECT_RECV ? &queue->recv_watched : &queue->send_watched,
+                             1u << slot, memory_order_release);
+    selector->cases[selector->count] = (mpmc_select_case_t){queue, op, message};
+    return selector->count++;
+}
+// arguments and result of a select retried by adaptive_spin
+typedef struct
+{
+    mpmc_selector_t *selector;
+    int index;
+} mpmc_select_try_t;
+static int mpmc_try_select(void *ctx)
+{
+    mpmc_select_try_t *attempt = ctx;
+    attempt->index = mpmc_select(attempt->selector);
+    return attempt->index >= 0;
+}
+int mpmc_select_block(mpmc_selector_t *selector)
+{
+    int index = mpmc_select(selector);
+    if (index >= 0)
+    {
+        return index;
+    }
+    mpmc_select_try_t attempt = {selector, index};
+    if (adaptive_spin(&selector->wait, mpmc_try_select, &attempt))
+    {
+        return attempt.index;
+    }
     while (1)
     {
-        if (mpmc_recv(queue, message) == MPMC_EMPTY)
+        // registered before the last check, so a publish on any of the queues can't miss us.
+        // NOTE : a case may fail on a queue that looked ready (lost race), the check sees it
+        // again and we don't sleep
+        uint32_t key = eventcount_prepare_wait(&selector->event);
+        if (mpmc_select_ready(selector))
+            eventcount_cancel_wait(&selector->event);
+        else
+            eventcount_commit_wait(&selector->event, key);
+        index = mpmc_select(selector);
+        if (index >= 0)
         {
-            atomic_fetch_add(&queue->recv_waiting, 1);
-            park(&queue->recv_parker);
-            atomic_fetch_sub(&queue->recv_waiting, 1);
-            continue;
+            adaptive_parked(&selector->wait);
+            return index;
+        }
+    }
+}
+void mpmc_selector_destroy(mpmc_selector_t *selector)
+{
+    // NOTE : the atomics only keep the slots and the masks consistent, a publisher that loaded
+    // a slot before it is cleared still notifies the selector afterwards. nothing waits for it,
+    // hence the queues must not be in use (see mpmc.h)
+    for (int i = 0; i < selector->count; i++)
+    {
+        mpmc_t *queue = selector->cases[i].queue;
+        for (int j = 0; j < MPMC_WATCHERS; j++)
+        {
+            eventcount_t *event = &selector->event;
+            if (atomic_compare_exchange_strong(&queue->recv_watchers[j], &event, NULL))
+                atomic_fetch_and(&queue->recv_watched, ~(1u << j));
+            event = &selector->event;
+            if (atomic_compare_exchange_strong(&queue->send_watchers[j], &event, NULL))
+                atomic_fetch_and(&queue->send_watched, ~(1u << j));
         }
-        return MPMC_OK;
     }
+    selector->count = 0;
+    eventcount_destroy(&selector->event);
+}
+// -- eventfd --
+int mpmc_eventfd(mpmc_t *queue, int event)
+{
+    if (event == MPMC_EVENTFD_READ)
+        return atomic_load_explicit(&queue->recv_fd, memory_order_relaxed);
+    if (event == MPMC_EVENTFD_WRITE)
+        return atomic_load_explicit(&queue->send_fd, memory_order_relaxed);
+    return -1;
+}
+void mpmc_eventfd_ack(mpmc_t *queue, int event)
+{
+    int fd = mpmc_eventfd(queue, event);
+    atomic_int *armed = event == MPMC_EVENTFD_READ ? &queue->recv_armed : &queue->send_armed;
+    if (fd < 0)
+        return;
+    uint64_t count;
+    // the fd is non blocking, nothing to read is fine
+    ssize_t got = read(fd, &count, sizeof(count));
+    (void)got;
+    atomic_store(armed, TRUE);
+    // NOTE : the drain that follows loads the queue with acquire at best (SPSC), the fence keeps
+    // those loads after the store, a publish either sees `armed` or is seen by the drain
+    atomic_thread_fence(memory_order_seq_cst);
+}
+int mpmc_eventfd_enable(mpmc_t *queue, int events)
+{
+#ifdef __linux__
+    if (queue->shared_size != 0)
+        return MPMC_INIT_FAILED;
+    if ((events & MPMC_EVENTFD_READ) != 0 && mpmc_eventfd(queue, MPMC_EVENTFD_READ) < 0)
+    {
+        int fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (fd < 0)
+            return MPMC_INIT_FAILED;
+        atomic_store(&queue->recv_fd, fd);
+        atomic_store(&queue->recv_armed, TRUE);
+        // the fd is stored before its bit, mpmc_notify loads the mask with acquire
+        atomic_fetch_or(&queue->recv_watched, MPMC_WATCHED_FD);
+        if (mpmc_can_recv(queue))
+            mpmc_eventfd_signal(fd, &queue->recv_armed);
+    }
+    if ((events & MPMC_EVENTFD_WRITE) != 0 && mpmc_eventfd(queue, MPMC_EVENTFD_WRITE) < 0)
+    {
+        int fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (fd < 0)
+            return MPMC_INIT_FAILED;
+        atomic_store(&queue->send_fd, fd);
+        atomic_store(&queue->send_armed, TRUE);
+        atomic_fetch_or(&queue->send_watched, MPMC_WATCHED_FD);
+        if (mpmc_can_send(queue))
+            mpmc_eventfd_signal(fd, &queue->send_armed);
+    }
+    return MPMC_OK;
+#else
+    (void)queue, (void)events;
+    return MPMC_INIT_FAILED;
+#endif
+}
+int mpmc_empty(mpmc_t *queue)
+{
+    return !mpmc_can_recv(queue);
+}
+void mpmc_wait_stats(mpmc_t *queue, adaptive_stats_t *send, adaptive_stats_t *recv)
+{
+    if (send != NULL)
+        adaptive_stats(&queue->send_wait, send);
+    if (recv != NULL)
+        adaptive_stats(&queue->recv_wait, recv);
+}
+void mpmc_stats_snapshot(mpmc_t *queue, mpmc_stats_t *stats)
+{
+#ifdef SYNC_STATS
+    stats->send_cas_retry = stats_sum(&queue->stats, MPMC_STAT_CAS_RETRY + MPMC_STATS_SEND);
+    stats->recv_cas_retry = stats_sum(&queue->stats, MPMC_STAT_CAS_RETRY + MPMC_STATS_RECV);
+    stats->send_spin_exhausted = stats_sum(&queue->stats, MPMC_STAT_SPIN_EXHAUSTED + MPMC_STATS_SEND);
+    stats->recv_spin_exhausted = stats_sum(&queue->stats, MPMC_STAT_SPIN_EXHAUSTED + MPMC_STATS_RECV);
+    stats->send_full = stats_sum(&queue->stats, MPMC_STAT_NO_CELL + MPMC_STATS_SEND);
+    stats->recv_empty = stats_sum(&queue->stats, MPMC_STAT_NO_CELL + MPMC_STATS_RECV);
+    stats->send_park = stats_sum(&queue->stats, MPMC_STAT_PARK + MPMC_STATS_SEND);
+    stats->recv_park = stats_sum(&queue->stats, MPMC_STAT_PARK + MPMC_STATS_RECV);
+    stats->send_unpark = stats_sum(&queue->stats, MPMC_STAT_UNPARK + MPMC_STATS_SEND);
+    stats->recv_unpark = stats_sum(&queue->stats, MPMC_STAT_UNPARK + MPMC_STATS_RECV);
+    stats->send_wake_ns = stats_sum(&queue->stats, MPMC_STAT_WAKE_NS + MPMC_STATS_SEND);
+    stats->recv_wake_ns = stats_sum(&queue->stats, MPMC_STAT_WAKE_NS + MPMC_STATS_RECV);
+#else
+    (void)queue;
+    memset(stats, 0, sizeof(*stats));
+#endif
+}
+int mpmc_latency_enable(mpmc_t *queue, int sample)
+{
+#ifdef MPMC_LATENCY
+    if (queue->shared_size != 0)
+        return MPMC_INIT_FAILED;
+    if (queue->latency != NULL || sample <= 0)
+        return queue->latency != NULL ? MPMC_OK : MPMC_INIT_FAILED;
+    size_t rate = 1;
+    while (rate < (size_t)sample)
+        rate <<= 1;
+    queue->sample_mask = rate - 1;
+    queue->stamps = calloc(queue->capacity, sizeof(uint64_t));
+    queue->latency = malloc(sizeof(histogram_t));
+    if (queue->stamps == NULL || queue->latency == NULL)
+    {
+        free(queue->stamps);
+        free(queue->latency);
+        queue->stamps = NULL;
+        queue->latency = NULL;
+        return MPMC_INIT_FAILED;
+    }
+    histogram_reset(queue->latency);
+    return MPMC_OK;
+#else
+    (void)queue, (void)sample;
+    return MPMC_INIT_FAILED;
+#endif
+}
+void mpmc_latency_read(mpmc_t *queue, histogram_t *histogram)
+{
+#ifdef MPMC_LATENCY
+    if (queue->latency != NULL)
+        histogram_merge(histogram, queue->latency);
+#else
+    (void)queue, (void)histogram;
+#endif
+}
+void mpmc_latency_reset(mpmc_t *queue)
+{
+#ifdef MPMC_LATENCY
+    if (queue->latency != NULL)
+        histogram_reset(queue->latency);
+#else
+    (void)queue;
+#endif
+}
+// -- shared --
+// the cells follow the header in the region, both start on a cache line
+size_t mpmc_shared_size(int capacity, int item_size)
+{
+    if (capacity <= 0 || item_size < 0)
+        return 0;
+    return MPMC_SHARED_CELLS + mpmc_align_up(capacity * mpmc_stride(item_size), MPMC_CACHE_LINE);
+}
+int mpmc_init_shared(mpmc_t *queue, size_t size, int capacity, int item_size, int mode)
+{
+    if (!mpmc_valid(capacity, item_size, mode) || ((uintptr_t)queue & (MPMC_CACHE_LINE - 1)) != 0 ||
+        size < mpmc_shared_size(capacity, item_size))
+    {
+        return MPMC_INIT_FAILED;
+    }
+    queue->stride = mpmc_stride(item_size);
+    mpmc_setup(queue, NULL, capacity, item_size, mode, wait_hybrid());
+    // NOTE : set last, mpmc_shared_attach refuses a region that isn't initialized yet
+    queue->shared_size = size;
+    return MPMC_OK;
+}
+int mpmc_shared_create(const char *name, int capacity, int item_size, int mode, mpmc_t **queue)
+{
+    size_t size = mpmc_shared_size(capacity, item_size);
+    if (size == 0)
+    {
+        return MPMC_INIT_FAILED;
+    }
+    int fd = memfd_create(name, MFD_CLOEXEC);
+    if (fd < 0)
+    {
+        return MPMC_INIT_FAILED;
+    }
+    void *region = MAP_FAILED;
+    if (ftruncate(fd, (off_t)size) == 0)
+    {
+        region = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    if (region == MAP_FAILED)
+    {
+        close(fd);
+        return MPMC_INIT_FAILED;
+    }
+    // mmap returns page aligned memory
+    if (mpmc_init_shared(region, size, capacity, item_size, mode) != MPMC_OK)
+    {
+        munmap(region, size);
+        close(fd);
+        return MPMC_INIT_FAILED;
+    }
+    *queue = region;
+    return fd;
+}
+int mpmc_shared_attach(int fd, mpmc_t **queue)
+{
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(mpmc_t))
+    {
+        return MPMC_INIT_FAILED;
+    }
+    mpmc_t *region = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (region == MAP_FAILED)
+    {
+        return MPMC_INIT_FAILED;
+    }
+    if (region->shared_size != (size_t)st.st_size ||
+        region->shared_size < mpmc_shared_size(region->capacity, (int)region->item_size))
+    {
+        munmap(region, st.st_size);
+        return MPMC_INIT_FAILED;
+    }
+    *queue = region;
+    return MPMC_OK;
+}
+void mpmc_shared_detach(mpmc_t *queue)
+{
+    munmap(queue, queue->shared_size);
 }
 void destroy_mpmc(mpmc_t *queue)
 {
-    free(queue->buffer);
+    if (queue->shared_size != 0)
+    {
+        // the cells live in the region, only the eventcounts may hold resources
+        eventcount_destroy(&queue->recv_event);
+        eventcount_destroy(&queue->send_event);
+        return;
+    }
+    free(mpmc_buffer(queue));
+#ifdef MPMC_LATENCY
+    free(queue->stamps);
+    free(queue->latency);
+#endif
 
-    parker_destroy(&queue->recv_parker);
-    parker_destroy(&queue->send_parker);
+    int recv_fd = atomic_load(&queue->recv_fd), send_fd = atomic_load(&queue->send_fd);
+    if (recv_fd >= 0)
+        close(recv_fd);
+    if (send_fd >= 0)
+        close(send_fd);
+    eventcount_destroy(&queue->recv_event);
+    eventcount_destroy(&queue->send_event);
 }
\ No newline at end of file
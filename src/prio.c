@@ -0,0 +1,177 @@
+#include <stdatomic.h>
+#include "prio.h"
+// a sender publishes its message, then reads the summary and sets its bit if needed.
+// a receiver that finds a lane empty clears the bit, then looks at the lane again.
+// every step is seq_cst, so either the sender sees the cleared bit or the receiver sees the message.
+
+int prio_init(prio_t *queue, int lanes, int capacity, int item_size)
+{
+    if (lanes <= 0 || lanes > PRIO_MAX_LANES)
+    {
+        return MPMC_INIT_FAILED;
+    }
+    for (int i = 0; i < lanes; i++)
+    {
+        if (mpmc_init(&queue->lanes[i], capacity, item_size) != MPMC_OK)
+        {
+            for (int j = 0; j < i; j++)
+                destroy_mpmc(&queue->lanes[j]);
+            return MPMC_INIT_FAILED;
+        }
+        queue->weights[i] = 1;
+        atomic_store(&queue->credits[i], 0);
+    }
+    queue->lane_count = lanes;
+    queue->weighted = FALSE;
+    atomic_store(&queue->ready, 0);
+    atomic_store(&queue->credited, 0);
+    eventcount_init(&queue->recv_event);
+    adaptive_init(&queue->recv_wait, wait_hybrid());
+    return MPMC_OK;
+}
+int prio_set_weights(prio_t *queue, const int *weights)
+{
+    for (int i = 0; i < queue->lane_count; i++)
+    {
+        if (weights[i] < 1)
+            return MPMC_INIT_FAILED;
+    }
+    for (int i = 0; i < queue->lane_count; i++)
+    {
+        queue->weights[i] = weights[i];
+    }
+    queue->weighted = TRUE;
+    return MPMC_OK;
+}
+
+// -- senders --
+static inline void prio_published(prio_t *queue, int lane)
+{
+    unsigned bit = 1u << lane;
+    // the load keeps the summary line shared while the lane stays busy
+    if ((atomic_load(&queue->ready) & bit) == 0)
+        atomic_fetch_or(&queue->ready, bit);
+    eventcount_notify_one(&queue->recv_event);
+}
+int prio_send(prio_t *queue, int lane, void *message)
+{
+    int result = mpmc_send(&queue->lanes[lane], message);
+    if (result != MPMC_OK)
+    {
+        return result;
+    }
+    prio_published(queue, lane);
+    return MPMC_OK;
+}
+int prio_send_block(prio_t *queue, int lane, void *message)
+{
+    // a full lane frees up through its own receives, the lane's send_event is the right place to wait
+    mpmc_send_block(&queue->lanes[lane], message);
+    prio_published(queue, lane);
+    return MPMC_OK;
+}
+
+// -- receivers --
+// start a new weighted round, every lane gets its weight back
+static void prio_refill(prio_t *queue)
+{
+    for (int i = 0; i < queue->lane_count; i++)
+    {
+        atomic_store_explicit(&queue->credits[i], queue->weights[i], memory_order_relaxed);
+    }
+    atomic_store_explicit(&queue->credited, (1u << queue->lane_count) - 1, memory_order_relaxed);
+}
+// the lane to read among the ready ones in `mask`
+static inline int prio_pick(prio_t *queue, unsigned mask)
+{
+    if (queue->weighted)
+    {
+        unsigned credited = atomic_load_explicit(&queue->credited, memory_order_relaxed);
+        if ((mask & credited) == 0)
+        {
+            // every ready lane used its share, the round is over
+            prio_refill(queue);
+            credited = (1u << queue->lane_count) - 1;
+        }
+        mask &= credited;
+    }
+    return __builtin_ctz(mask);
+}
+static inline void prio_charge(prio_t *queue, int lane)
+{
+    if (queue->weighted && atomic_fetch_sub_explicit(&queue->credits[lane], 1, memory_order_relaxed) <= 1)
+        atomic_fetch_and_explicit(&queue->credited, ~(1u << lane), memory_order_relaxed);
+}
+int prio_recv(prio_t *queue, void *message)
+{
+    unsigned mask = atomic_load(&queue->ready);
+    while (mask != 0)
+    {
+        int lane = prio_pick(queue, mask);
+        unsigned bit = 1u << lane;
+        if (mpmc_recv(&queue->lanes[lane], message) == MPMC_OK)
+        {
+            prio_charge(queue, lane);
+            return lane;
+        }
+        atomic_fetch_and(&queue->ready, ~bit);
+        // NOTE : a failed mpmc_recv may only have lost too many races, mpmc_empty doesn't give up,
+        // a lane that still holds messages gets its bit back
+        atomic_thread_fence(memory_order_seq_cst);
+        if (!mpmc_empty(&queue->lanes[lane]))
+            atomic_fetch_or(&queue->ready, bit);
+        mask = atomic_load(&queue->ready);
+    }
+    return MPMC_EMPTY;
+}
+
+// arguments and result of a recv retried by adaptive_spin
+typedef struct
+{
+    prio_t *queue;
+    void *message;
+    int lane;
+} prio_try_t;
+static int prio_try_recv(void *ctx)
+{
+    prio_try_t *attempt = ctx;
+    attempt->lane = prio_recv(attempt->queue, attempt->message);
+    return attempt->lane >= 0;
+}
+int prio_recv_block(prio_t *queue, void *message)
+{
+    int lane = prio_recv(queue, message);
+    if (lane >= 0)
+    {
+        return lane;
+    }
+    prio_try_t attempt = {queue, message, lane};
+    if (adaptive_spin(&queue->recv_wait, prio_try_recv, &attempt))
+    {
+        return attempt.lane;
+    }
+    while (1)
+    {
+        // registered before the last check, a send on any lane sets its bit before notifying
+        uint32_t key = eventcount_prepare_wait(&queue->recv_event);
+        if (atomic_load(&queue->ready) != 0)
+            eventcount_cancel_wait(&queue->recv_event);
+        else
+            eventcount_commit_wait(&queue->recv_event, key);
+        lane = prio_recv(queue, message);
+        if (lane >= 0)
+        {
+            adaptive_parked(&queue->recv_wait);
+            return lane;
+        }
+    }
+}
+
+void prio_destroy(prio_t *queue)
+{
+    for (int i = 0; i < queue->lane_count; i++)
+    {
+        destroy_mpmc(&queue->lanes[i]);
+    }
+    eventcount_destroy(&queue->recv_event);
+}
@@ -0,0 +1,218 @@
+
+#include "reclaim.h"
+#include <stdalign.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "spin.h"
+
+// -- hazard pointers, based on Maged Michael's "Hazard Pointers: Safe Memory Reclamation for Lock-Free Objects" --
+
+typedef struct
+{
+    // read by every scanning thread
+    alignas(64) void *_Atomic hazards[RECLAIM_HAZARDS];
+    atomic_int active;
+    // only touched by the owner
+    alignas(64) size_t retired_count;
+    void *retired[RECLAIM_RETIRE_MAX];
+    reclaim_free_fn free_fns[RECLAIM_RETIRE_MAX];
+} reclaim_record_t;
+
+static reclaim_record_t records[RECLAIM_MAX_THREADS];
+// records past this index were never handed out, so scans can stop there
+static atomic_int records_used;
+
+// nodes still protected when their thread exited, adopted by the next scan of any thread
+typedef struct reclaim_orphan_t
+{
+    struct reclaim_orphan_t *next;
+    void *ptr;
+    reclaim_free_fn free_fn;
+} reclaim_orphan_t;
+static _Atomic(reclaim_orphan_t *) orphans;
+
+static pthread_key_t record_key;
+static pthread_once_t record_key_once = PTHREAD_ONCE_INIT;
+static _Thread_local reclaim_record_t *self;
+
+static int reclaim_compare(const void *a, const void *b)
+{
+    uintptr_t x = (uintptr_t)*(void *const *)a;
+    uintptr_t y = (uintptr_t)*(void *const *)b;
+    return (x > y) - (x < y);
+}
+
+static void reclaim_push_orphan(reclaim_orphan_t *orphan)
+{
+    reclaim_orphan_t *head = atomic_load_explicit(&orphans, memory_order_relaxed);
+    do
+    {
+        orphan->next = head;
+    } while (!atomic_compare_exchange_weak_explicit(&orphans, &head, orphan, memory_order_release,
+                                                    memory_order_relaxed));
+}
+// move the orphans into `record` while it has room, the stack is taken whole so there is no ABA
+static void reclaim_adopt(reclaim_record_t *record)
+{
+    if (atomic_load_explicit(&orphans, memory_order_relaxed) == NULL)
+        return;
+    reclaim_orphan_t *orphan = atomic_exchange_explicit(&orphans, NULL, memory_order_acquire);
+    while (orphan != NULL)
+    {
+        reclaim_orphan_t *next = orphan->next;
+        if (record->retired_count < RECLAIM_RETIRE_MAX)
+        {
+            record->retired[record->retired_count] = orphan->ptr;
+            record->free_fns[record->retired_count] = orphan->free_fn;
+            record->retired_count++;
+            free(orphan);
+        }
+        else
+        {
+            reclaim_push_orphan(orphan);
+        }
+        orphan = next;
+    }
+}
+
+static void reclaim_scan(reclaim_record_t *record)
+{
+    reclaim_adopt(record);
+    void *protected[RECLAIM_MAX_THREADS * RECLAIM_HAZARDS];
+    size_t protected_count = 0;
+    // pairs with the seq_cst store in reclaim_protect,
+    // any hazard published before the node was unlinked is visible here
+    atomic_thread_fence(memory_order_seq_cst);
+    int used = atomic_load(&records_used);
+    for (int i = 0; i < used; i++)
+    {
+        for (int j = 0; j < RECLAIM_HAZARDS; j++)
+        {
+            void *hazard = atomic_load(&records[i].hazards[j]);
+            if (hazard != NULL)
+                protected[protected_count++] = hazard;
+        }
+    }
+    qsort(protected, protected_count, sizeof(void *), reclaim_compare);
+
+    size_t kept = 0;
+    for (size_t i = 0; i < record->retired_count; i++)
+    {
+        void *ptr = record->retired[i];
+        if (bsearch(&ptr, protected, protected_count, sizeof(void *), reclaim_compare) != NULL)
+        {
+            // still in use, keep it for the next scan
+            record->retired[kept] = ptr;
+            record->free_fns[kept] = record->free_fns[i];
+            kept++;
+        }
+        else
+        {
+            record->free_fns[i](ptr);
+        }
+    }
+    record->retired_count = kept;
+}
+
+static void reclaim_release_record(void *arg)
+{
+    reclaim_record_t *record = arg;
+    for (int j = 0; j < RECLAIM_HAZARDS; j++)
+        atomic_store(&record->hazards[j], NULL);
+    reclaim_scan(record);
+    // whatever is still protected goes to the orphans, freed by a later scan of another thread
+    size_t kept = 0;
+    for (size_t i = 0; i < record->retired_count; i++)
+    {
+        reclaim_orphan_t *orphan = malloc(sizeof(reclaim_orphan_t));
+        if (orphan == NULL)
+        {
+            // NOTE : out of memory, the node stays in the record until its next owner scans
+            record->retired[kept] = record->retired[i];
+            record->free_fns[kept] = record->free_fns[i];
+            kept++;
+            continue;
+        }
+        orphan->ptr = record->retired[i];
+        orphan->free_fn = record->free_fns[i];
+        reclaim_push_orphan(orphan);
+    }
+    record->retired_count = kept;
+    atomic_store_explicit(&record->active, FALSE, memory_order_release);
+    // a later key destructor of this thread must not publish hazards in a record another
+    // thread may already own, it gets a fresh one instead
+    self = NULL;
+}
+
+static void reclaim_create_key(void)
+{
+    pthread_key_create(&record_key, reclaim_release_record);
+}
+
+static reclaim_record_t *reclaim_acquire_record(void)
+{
+    pthread_once(&record_key_once, reclaim_create_key);
+    for (int i = 0; i < RECLAIM_MAX_THREADS; i++)
+    {
+        int expected = FALSE;
+        if (atomic_load_explicit(&records[i].active, memory_order_relaxed) == FALSE &&
+            atomic_compare_exchange_strong(&records[i].active, &expected, TRUE))
+        {
+            // publish the record to scanners before any hazard is set in it
+            int used = atomic_load(&records_used);
+            while (used <= i && !atomic_compare_exchange_weak(&records_used, &used, i + 1))
+                ;
+            pthread_setspecific(record_key, &records[i]);
+            return &records[i];
+        }
+    }
+    fprintf(stderr, "reclaim: more than %d threads\n", RECLAIM_MAX_THREADS);
+    abort();
+}
+
+static inline reclaim_record_t *reclaim_self(void)
+{
+    if (self == NULL)
+        self = reclaim_acquire_record();
+    return self;
+}
+
+void *reclaim_protect(int slot, void *_Atomic *src)
+{
+    reclaim_record_t *record = reclaim_self();
+    void *ptr = atomic_load(src);
+    while (1)
+    {
+        atomic_store(&record->hazards[slot], ptr);
+        // the node may have been unlinked (and scanned) before the hazard became visible,
+        // it is only safe if it is still reachable from `src` after publishing
+        void *current = atomic_load(src);
+        if (current == ptr)
+            return ptr;
+        ptr = current;
+    }
+}
+
+void reclaim_clear(int slot)
+{
+    atomic_store_explicit(&reclaim_self()->hazards[slot], NULL, memory_order_release);
+}
+
+void reclaim_retire(void *ptr, reclaim_free_fn free_fn)
+{
+    reclaim_record_t *record = reclaim_self();
+    record->retired[record->retired_count] = ptr;
+    record->free_fns[record->retired_count] = free_fn;
+    record->retired_count++;
+    // at most RECLAIM_MAX_THREADS * RECLAIM_HAZARDS nodes can survive a scan,
+    // so a full list always frees at least half of it
+    if (record->retired_count == RECLAIM_RETIRE_MAX)
+        reclaim_scan(record);
+}
+
+void reclaim_flush(void)
+{
+    reclaim_scan(reclaim_self());
+}
@@ -0,0 +1,285 @@
+#include "segqueue.h"
+#include <stdatomic.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include "reclaim.h"
+#include "spin.h"
+// -- this impl is a FAA array queue (see crossbeam's SegQueue, LCRQ) --
+// every cell of a segment is claimed by exactly one producer and one consumer through
+// a fetch_add on enq_idx/deq_idx. the cell seq tells them whether the other side got there first :
+// a producer publishes with EMPTY -> READY, a consumer that is tired of waiting gives the cell
+// up with EMPTY -> SKIPPED and the producer retries with a fresh index.
+#define SEGQUEUE_CELL_EMPTY 0
+#define SEGQUEUE_CELL_READY 1
+#define SEGQUEUE_CELL_SKIPPED 2
+// the only hazard slot we need protects the segment we work on
+#define SEGQUEUE_HAZARD 0
+// how long a consumer waits for a producer that claimed its cell but didn't publish yet
+#define SEGQUEUE_SPIN ((spin_t){.next = 1, .pow = 2, .max = 6})
+
+struct segqueue_segment_t
+{
+    alignas(MPMC_CACHE_LINE) atomic_size_t enq_idx;
+    alignas(MPMC_CACHE_LINE) atomic_size_t deq_idx;
+    alignas(MPMC_CACHE_LINE) _Atomic(segqueue_segment_t *) next;
+    size_t size; // allocation size, used to find the pool class
+    alignas(MPMC_CACHE_LINE) unsigned char cells[];
+};
+
+// -- segment pool --
+// segments are only allocated once per SEGQUEUE_SEGMENT_CELLS sends, so a mutex is cheap enough here.
+// the pool is process wide because retired segments can be freed after their queue was destroyed.
+#define SEGQUEUE_POOL_CLASSES 8
+#define SEGQUEUE_POOL_MAX 16
+
+typedef struct
+{
+    size_t size; // segment size of this class, 0 while unused
+    segqueue_segment_t *free;
+    int count;
+} segqueue_pool_class_t;
+
+static segqueue_pool_class_t pool[SEGQUEUE_POOL_CLASSES];
+static pthread_mutex_t pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static inline size_t segqueue_align_up(size_t value, size_t align)
+{
+    return (value + align - 1) & ~(align - 1);
+}
+static inline mpmc_cell_t *segqueue_get_cell(segqueue_t *queue, segqueue_segment_t *segment, size_t idx)
+{
+    return (mpmc_cell_t *)(segment->cells + idx * queue->stride);
+}
+// find the class of `size`, claims an unused one if needed, the pool mutex must be held
+static segqueue_pool_class_t *segqueue_pool_class(size_t size)
+{
+    segqueue_pool_class_t *unused = NULL;
+    for (int i = 0; i < SEGQUEUE_POOL_CLASSES; i++)
+    {
+        if (pool[i].size == size)
+            return &pool[i];
+        if (pool[i].size == 0 && unused == NULL)
+            unused = &pool[i];
+    }
+    if (unused != NULL)
+        unused->size = size;
+    return unused;
+}
+static void segqueue_free_segment(void *ptr)
+{
+    segqueue_segment_t *segment = ptr;
+    pthread_mutex_lock(&pool_mutex);
+    segqueue_pool_class_t *class = segqueue_pool_class(segment->size);
+    if (class != NULL && class->count < SEGQUEUE_POOL_MAX)
+    {
+        atomic_store_explicit(&segment->next, class->free, memory_order_relaxed);
+        class->free = segment;
+        class->count++;
+        segment = NULL;
+    }
+    pthread_mutex_unlock(&pool_mutex);
+    // NOTE : the pool is full (or out of classes), past a burst the memory goes back to the os
+    free(segment);
+}
+static segqueue_segment_t *segqueue_alloc_segment(segqueue_t *queue)
+{
+    segqueue_segment_t *segment = NULL;
+    pthread_mutex_lock(&pool_mutex);
+    segqueue_pool_class_t *class = segqueue_pool_class(queue->segment_size);
+    if (class != NULL && class->free != NULL)
+    {
+        segment = class->free;
+        class->free = atomic_load_explicit(&segment->next, memory_order_relaxed);
+        class->count--;
+    }
+    pthread_mutex_unlock(&pool_mutex);
+    if (segment == NULL)
+    {
+        segment = aligned_alloc(MPMC_CACHE_LINE, queue->segment_size);
+        if (segment == NULL)
+            return NULL;
+        segment->size = queue->segment_size;
+    }
+    atomic_store_explicit(&segment->enq_idx, 0, memory_order_relaxed);
+    atomic_store_explicit(&segment->deq_idx, 0, memory_order_relaxed);
+    atomic_store_explicit(&segment->next, NULL, memory_order_relaxed);
+    for (size_t i = 0; i < SEGQUEUE_SEGMENT_CELLS; i++)
+    {
+        atomic_store_explicit(&segqueue_get_cell(queue, segment, i)->seq, SEGQUEUE_CELL_EMPTY, memory_order_relaxed);
+    }
+    return segment;
+}
+
+int segqueue_init(segqueue_t *queue, int item_size)
+{
+    if (item_size < 0)
+    {
+        return MPMC_INIT_FAILED;
+    }
+    queue->item_size = item_size;
+    queue->stride = segqueue_align_up(sizeof(mpmc_cell_t) + item_size, MPMC_CELL_ALIGN);
+    // aligned_alloc wants the size to be a multiple of the alignment
+    queue->segment_size = segqueue_align_up(offsetof(segqueue_segment_t, cells) + SEGQUEUE_SEGMENT_CELLS * queue->stride,
+                                            MPMC_CACHE_LINE);
+    segqueue_segment_t *segment = segqueue_alloc_segment(queue);
+    if (segment == NULL)
+    {
+        return MPMC_INIT_FAILED;
+    }
+    atomic_store(&queue->head, segment);
+    atomic_store(&queue->tail, segment);
+    eventcount_init(&queue->recv_event);
+    return MPMC_OK;
+}
+
+int segqueue_send(segqueue_t *queue, void *message)
+{
+    while (1)
+    {
+        segqueue_segment_t *tail = reclaim_protect(SEGQUEUE_HAZARD, (void *_Atomic *)&queue->tail);
+        size_t idx = atomic_fetch_add(&tail->enq_idx, 1);
+        if (idx < SEGQUEUE_SEGMENT_CELLS)
+        {
+            mpmc_cell_t *cell = segqueue_get_cell(queue, tail, idx);
+            memcpy(cell->data, message, queue->item_size);
+            size_t expected = SEGQUEUE_CELL_EMPTY;
+            if (atomic_compare_exchange_strong(&cell->seq, &expected, SEGQUEUE_CELL_READY))
+            {
+                reclaim_clear(SEGQUEUE_HAZARD);
+                eventcount_notify_one(&queue->recv_event);
+                return MPMC_OK;
+            }
+            // a consumer skipped the cell before we published, take another one
+            continue;
+        }
+        // the segment is full, link a new one
+        segqueue_segment_t *next = atomic_load(&tail->next);
+        if (next == NULL)
+        {
+            segqueue_segment_t *segment = segqueue_alloc_segment(queue);
+            if (segment == NULL)
+            {
+                reclaim_clear(SEGQUEUE_HAZARD);
+                return MPMC_FULL;
+            }
+            // our message goes in the first cell before anybody can see the segment
+            mpmc_cell_t *cell = segqueue_get_cell(queue, segment, 0);
+            memcpy(cell->data, message, queue->item_size);
+            atomic_store_explicit(&cell->seq, SEGQUEUE_CELL_READY, memory_order_relaxed);
+            atomic_store_explicit(&segment->enq_idx, 1, memory_order_relaxed);
+            if (atomic_compare_exchange_strong(&tail->next, &next, segment))
+            {
+                // NOTE : same as aqueue_enqueue, if this fails another thread already moved the tail for us
+                atomic_compare_exchange_strong(&queue->tail, &tail, segment);
+                reclaim_clear(SEGQUEUE_HAZARD);
+                eventcount_notify_one(&queue->recv_event);
+                return MPMC_OK;
+            }
+            // another producer linked its segment first, ours was never visible
+            segqueue_free_segment(segment);
+        }
+        // help the tail forward and retry on the new segment
+        atomic_compare_exchange_strong(&queue->tail, &tail, next);
+    }
+}
+
+int segqueue_recv(segqueue_t *queue, void *message)
+{
+    while (1)
+    {
+        segqueue_segment_t *head = reclaim_protect(SEGQUEUE_HAZARD, (void *_Atomic *)&queue->head);
+        size_t deq = atomic_load(&head->deq_idx);
+        if (deq >= SEGQUEUE_SEGMENT_CELLS)
+        {
+            // every cell of the segment was handed out, move to the next one
+            segqueue_segment_t *next = atomic_load(&head->next);
+            if (next == NULL)
+            {
+                // a producer is still linking the next segment
+                reclaim_clear(SEGQUEUE_HAZARD);
+                return MPMC_EMPTY;
+            }
+            segqueue_segment_t *tail = head;
+            // the tail may lag behind, never move the head past it
+            atomic_compare_exchange_strong(&queue->tail, &tail, next);
+            if (atomic_compare_exchange_strong(&queue->head, &head, next))
+            {
+                reclaim_clear(SEGQUEUE_HAZARD);
+                reclaim_retire(head, segqueue_free_segment);
+            }
+            continue;
+        }
+        // don't burn indices of an empty segment, they would make the producers retry
+        if (deq >= atomic_load(&head->enq_idx))
+        {
+            reclaim_clear(SEGQUEUE_HAZARD);
+            return MPMC_EMPTY;
+        }
+        size_t idx = atomic_fetch_add(&head->deq_idx, 1);
+        if (idx >= SEGQUEUE_SEGMENT_CELLS)
+        {
+            continue;
+        }
+        mpmc_cell_t *cell = segqueue_get_cell(queue, head, idx);
+        spin_t spin = SEGQUEUE_SPIN;
+        size_t seq = atomic_load(&cell->seq);
+        // the producer of this cell already claimed it (or is about to), give it a moment to publish
+        while (seq == SEGQUEUE_CELL_EMPTY && spin_next(&spin) == FALSE)
+        {
+            seq = atomic_load(&cell->seq);
+        }
+        if (seq == SEGQUEUE_CELL_EMPTY &&
+            atomic_compare_exchange_strong(&cell->seq, &seq, SEGQUEUE_CELL_SKIPPED))
+        {
+            // the producer will see the skip and move on to another cell
+            continue;
+        }
+        memcpy(message, cell->data, queue->item_size);
+        reclaim_clear(SEGQUEUE_HAZARD);
+        return MPMC_OK;
+    }
+}
+
+int segqueue_send_block(segqueue_t *queue, void *message)
+{
+    return segqueue_send(queue, message);
+}
+
+// TRUE if a recv may find something, false positives only cost a retry
+static int segqueue_can_recv(segqueue_t *queue)
+{
+    segqueue_segment_t *head = reclaim_protect(SEGQUEUE_HAZARD, (void *_Atomic *)&queue->head);
+    size_t deq = atomic_load(&head->deq_idx);
+    int ready = deq < SEGQUEUE_SEGMENT_CELLS ? deq < atomic_load(&head->enq_idx) : atomic_load(&head->next) != NULL;
+    reclaim_clear(SEGQUEUE_HAZARD);
+    return ready;
+}
+
+int segqueue_recv_block(segqueue_t *queue, void *message)
+{
+    while (segqueue_recv(queue, message) != MPMC_OK)
+    {
+        // registered before the last check, so a send that follows it can't miss us
+        uint32_t key = eventcount_prepare_wait(&queue->recv_event);
+        if (segqueue_can_recv(queue))
+            eventcount_cancel_wait(&queue->recv_event);
+        else
+            eventcount_commit_wait(&queue->recv_event, key);
+    }
+    return MPMC_OK;
+}
+
+void segqueue_destroy(segqueue_t *queue)
+{
+    segqueue_segment_t *segment = atomic_load(&queue->head);
+    while (segment != NULL)
+    {
+        segqueue_segment_t *next = atomic_load(&segment->next);
+        segqueue_free_segment(segment);
+        segment = next;
+    }
+    atomic_store(&queue->head, NULL);
+    atomic_store(&queue->tail, NULL);
+    eventcount_destroy(&queue->recv_event);
+}
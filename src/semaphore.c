@@ -1,144 +1,338 @@
 
+// sched_getcpu
+#define _GNU_SOURCE
 #include "semaphore.h"
-#include <libc.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sched.h>
 #include "spin.h"
-#include "aqueue.h"
 #define SEM_SPIN ((spin_t){.next = 1, .pow = 4, .max = 7})
 #define CLOSE_BIT ((size_t)1 << (sizeof(size_t) * (8 - 1)))
-#define MAX_PERMITS (SIZE_MAX ^ CLOSE_BIT)
+// set while the waiter queue is not empty, releases that see it ask for a drain,
+// acquires that see it queue up behind the waiters (FIFO)
+#define WAITERS_BIT (CLOSE_BIT >> 1)
+#define MAX_PERMITS (SIZE_MAX ^ CLOSE_BIT ^ WAITERS_BIT)
+// stats_t counters, see semaphore_stats_t
+#define SEM_STAT_CAS_RETRY 0
+#define SEM_STAT_NOT_ENOUGH 1
+#define SEM_STAT_STEAL 2
+#define SEM_STAT_ENQUEUE 3
+#define SEM_STAT_PARK 4
+#define SEM_STAT_UNPARK 5
+#define SEM_STAT_WAKE_NS 6
+#define SEM_STAT_PARTIAL_GRANT 7
+#define SEM_STAT_CLOSE_WAKEUP 8
+#define SEM_STAT_DRAIN 9
 
-struct semaphore_waiter
+// every thread parks on its own cached parker, so blocking doesn't set one up each time.
+// NOTE : a parker gets exactly one unpark per enqueued waiter, so no stale token survives an acquire
+static _Thread_local parker_t semaphore_parker;
+static _Thread_local int semaphore_parker_ready;
+
+static inline parker_t *semaphore_thread_parker(void)
 {
-    parker_t parker;
-    size_t wants;
-};
+    if (!semaphore_parker_ready)
+    {
+        parker_init(&semaphore_parker);
+        semaphore_parker_ready = TRUE;
+    }
+    return &semaphore_parker;
+}
+
+// -- shards --
+// a sharded semaphore keeps most permits in per-CPU counters, `permits` still holds the
+// flag bits and the permits handed back by drain passes (the central counter).
+// NOTE : a release that adds to a shard and a drain pass that sweeps the shards meet Dekker style :
+// the release adds then reads WAITERS_BIT, the enqueue sets the bit then the drain sweeps,
+// all seq_cst, so either the release asks for a drain or the sweep sees its permits.
+static atomic_size_t semaphore_next_slot;
+static _Thread_local size_t semaphore_slot;
 
-struct semaphore_node
+static inline semaphore_shard_t *semaphore_local_shard(semaphore_t *sem)
 {
-    semaphore_waiter_t *waiter;
-    struct semaphore_node *next;
-};
-static inline int is_semaphore_closed(semaphore_t *sem)
+#ifdef __linux__
+    int cpu = sched_getcpu();
+    if (cpu >= 0)
+        return &sem->shards[(size_t)cpu & sem->shard_mask];
+#endif
+    // no cpu number, every thread gets its own slot
+    if (semaphore_slot == 0)
+        semaphore_slot = atomic_fetch_add_explicit(&semaphore_next_slot, 1, memory_order_relaxed) + 1;
+    return &sem->shards[semaphore_slot & sem->shard_mask];
+}
+// take up to `want` permits from a shard, returns how many were taken
+static inline size_t semaphore_shard_take(semaphore_shard_t *shard, size_t want)
 {
-    return (atomic_load(&sem->permits) & CLOSE_BIT) != 0;
+    size_t current = atomic_load_explicit(&shard->permits, memory_order_relaxed);
+    while (current > 0)
+    {
+        size_t taken = current < want ? current : want;
+        if (atomic_compare_exchange_weak_explicit(&shard->permits, &current, current - taken,
+                                                  memory_order_acq_rel, memory_order_relaxed))
+            return taken;
+    }
+    return 0;
 }
-static inline semaphore_waiter_t *semaphore_dequeue_locked(semaphore_t *sem)
+// same for the central counter, nothing is taken once waiters are queued
+static inline size_t semaphore_central_take(semaphore_t *sem, size_t want)
 {
-    if (sem->head == NULL)
+    size_t current = atomic_load_explicit(&sem->permits, memory_order_relaxed);
+    while ((current & (CLOSE_BIT | WAITERS_BIT)) == 0 && (current & MAX_PERMITS) > 0)
     {
-        // if queue is empty
-        return NULL;
+        size_t available = current & MAX_PERMITS;
+        size_t taken = available < want ? available : want;
+        if (atomic_compare_exchange_weak_explicit(&sem->permits, &current, current - taken,
+                                                  memory_order_acq_rel, memory_order_relaxed))
+            return taken;
     }
-    semaphore_node_t *removed = sem->head;
-    semaphore_waiter_t *result = sem->head->waiter;
-    // advance the head
-    sem->head = sem->head->next;
-    // if the queue is now empty
-    if (sem->head == NULL)
-        sem->tail = NULL;
-
-    free(removed);
-    return result;
+    return 0;
 }
-static inline int semaphore_enqueue(semaphore_t *sem, semaphore_waiter_t *waiter)
+static void semaphore_drain(semaphore_t *sem);
+static inline void semaphore_shard_put(semaphore_t *sem, semaphore_shard_t *shard, size_t permits)
 {
-    semaphore_node_t *node = malloc(sizeof(semaphore_node_t));
-    if (!node)
-        return FALSE;
-
-    node->waiter = waiter;
-    node->next = NULL;
-
-    pthread_mutex_lock(&sem->queue_mutex);
-
-    // case 1: semaphore already closed
-    if (is_semaphore_closed(sem))
+    if (permits == 0)
+        return;
+    atomic_fetch_add(&shard->permits, permits);
+    if ((atomic_load(&sem->permits) & WAITERS_BIT) != 0)
+        semaphore_drain(sem);
+}
+static int semaphore_acquire_sharded(semaphore_t *sem, size_t permits)
+{
+    size_t current = atomic_load_explicit(&sem->permits, memory_order_acquire);
+    if ((current & CLOSE_BIT) != 0)
+        return SEMAPHORE_CLOSED;
+    // queued waiters come first
+    if ((current & WAITERS_BIT) != 0)
     {
-        pthread_mutex_unlock(&sem->queue_mutex);
-        waiter->wants |= CLOSE_BIT;
-        free(node);
-        return FALSE;
+        STATS_INC(&sem->stats, SEM_STAT_NOT_ENOUGH);
+        return SEMAPHORE_NOT_ENOUGH;
     }
-
-    // case 2 : maybe enough permits were just released before we locked
-    if (semaphore_acquire_many(sem, waiter->wants) == SEMAPHORE_OK)
+    semaphore_shard_t *local = semaphore_local_shard(sem);
+    size_t got = semaphore_shard_take(local, permits);
+    if (got == permits)
+        return SEMAPHORE_OK;
+    // the local shard is dry, steal from the central counter and then the other shards
+    STATS_INC(&sem->stats, SEM_STAT_STEAL);
+    got += semaphore_central_take(sem, permits - got);
+    size_t index = (size_t)(local - sem->shards);
+    for (size_t i = 1; got < permits && i <= sem->shard_mask; i++)
     {
-        pthread_mutex_unlock(&sem->queue_mutex);
-        free(node);
-        return FALSE; // acquired immediately, no need to park
+        semaphore_shard_t *victim = &sem->shards[(index + i) & sem->shard_mask];
+        size_t available = atomic_load_explicit(&victim->permits, memory_order_relaxed);
+        if (available == 0)
+            continue;
+        // rebalance : half of what the victim has beyond our need moves to our shard
+        size_t need = permits - got;
+        size_t want = available > need ? need + (available - need) / 2 : need;
+        got += semaphore_shard_take(victim, want);
     }
+    if (got >= permits)
+    {
+        semaphore_shard_put(sem, local, got - permits);
+        return SEMAPHORE_OK;
+    }
+    // NOTE : other stealers may hold the rest for a moment, a blocking acquire queues up
+    // and the drain pass sweeps every shard, so nothing is lost
+    semaphore_shard_put(sem, local, got);
+    STATS_INC(&sem->stats, SEM_STAT_NOT_ENOUGH);
+    return SEMAPHORE_NOT_ENOUGH;
+}
 
-    // case 3: actually enqueue
-    if (sem->tail == NULL)
+// -- waiter queue, Vyukov's intrusive MPSC queue --
+// producers only exchange the tail, the single consumer (the drainer) owns the head.
+static inline void semaphore_push(semaphore_t *sem, semaphore_waiter_t *waiter)
+{
+    atomic_store_explicit(&waiter->next, NULL, memory_order_relaxed);
+    semaphore_waiter_t *prev = atomic_exchange_explicit(&sem->tail, waiter, memory_order_acq_rel);
+    // NOTE : between the exchange and this store the queue looks cut in two, pop sees nothing past prev
+    atomic_store_explicit(&prev->next, waiter, memory_order_release);
+}
+// returns NULL if the queue is empty or the next waiter is still being linked.
+// a popped waiter is never written by producers anymore.
+static semaphore_waiter_t *semaphore_pop(semaphore_t *sem)
+{
+    semaphore_waiter_t *head = sem->head;
+    semaphore_waiter_t *next = atomic_load_explicit(&head->next, memory_order_acquire);
+    if (head == &sem->stub)
     {
-        sem->head = sem->tail = node;
+        if (next == NULL)
+            return NULL;
+        sem->head = next;
+        head = next;
+        next = atomic_load_explicit(&next->next, memory_order_acquire);
     }
-    else
+    if (next != NULL)
     {
-        sem->tail->next = node;
-        sem->tail = node;
+        sem->head = next;
+        return head;
     }
-
-    pthread_mutex_unlock(&sem->queue_mutex);
-
-    return TRUE;
+    if (head != atomic_load_explicit(&sem->tail, memory_order_acquire))
+        return NULL;
+    // head is the last waiter, push the stub behind it so it can be unlinked
+    semaphore_push(sem, &sem->stub);
+    next = atomic_load_explicit(&head->next, memory_order_acquire);
+    if (next != NULL)
+    {
+        sem->head = next;
+        return head;
+    }
+    return NULL;
 }
-
-static inline void semaphore_release_permits(semaphore_t *sem, size_t *released)
+// FALSE while a push is still in progress
+static inline int semaphore_queue_empty(semaphore_t *sem)
+{
+    return sem->pending == NULL && sem->head == &sem->stub &&
+           atomic_load_explicit(&sem->stub.next, memory_order_acquire) == NULL &&
+           atomic_load_explicit(&sem->tail, memory_order_acquire) == &sem->stub;
+}
+static inline void semaphore_wake(semaphore_t *sem, semaphore_waiter_t *waiter, int closed)
 {
-    pthread_mutex_lock(&sem->queue_mutex);
-    while (*released > 0)
+    if (closed)
     {
-        if (sem->head == NULL)
-        {
-            break;
-        }
-        semaphore_node_t *removed = sem->head;
-        semaphore_waiter_t *waiter = sem->head->waiter;
-        // advance the head
-        sem->head = sem->head->next;
-        if (waiter->wants > *released)
-        {
-            waiter->wants -= *released;
-            *released = 0;
-        }
-        else
-        {
-            *released -= removed->waiter->wants;
-            unpark(&removed->waiter->parker);
-            free(removed);
-        }
+        waiter->wants |= CLOSE_BIT;
+        STATS_INC(&sem->stats, SEM_STAT_CLOSE_WAKEUP);
+    }
+    STATS_INC(&sem->stats, SEM_STAT_UNPARK);
+#ifdef SYNC_STATS
+    waiter->woken_ns = stats_now_ns();
+#else
+    (void)sem;
+#endif
+    // NOTE : the node is on the waiter's stack, it must not be touched after unpark
+    unpark(waiter->parker);
+}
 
-        // if the queue is now empty
-        if (sem->head == NULL)
+// one drain pass, only ever run by the drainer :
+// hand the permits sitting in the counter to the queued waiters in FIFO order
+static void semaphore_release_permits(semaphore_t *sem)
+{
+    STATS_INC(&sem->stats, SEM_STAT_DRAIN);
+    // route releases to us while someone is queued, the bit may have been cleared by
+    // an earlier pass that ran before the last push completed
+    if (!semaphore_queue_empty(sem))
+        atomic_fetch_or(&sem->permits, WAITERS_BIT);
+    // take every available permit, the flag bits stay as they are
+    size_t current = atomic_load_explicit(&sem->permits, memory_order_relaxed);
+    while (!atomic_compare_exchange_weak_explicit(&sem->permits, &current, current & ~MAX_PERMITS,
+                                                  memory_order_acq_rel, memory_order_relaxed))
+        ;
+    size_t released = current & MAX_PERMITS;
+    if (sem->shards != NULL)
+    {
+        for (size_t i = 0; i <= sem->shard_mask; i++)
+            released += atomic_exchange(&sem->shards[i].permits, 0);
+    }
+    int closed = (current & CLOSE_BIT) != 0;
+    semaphore_waiter_t *waiter = sem->pending;
+    sem->pending = NULL;
+    if (waiter == NULL)
+        waiter = semaphore_pop(sem);
+    while (waiter != NULL)
+    {
+        if (!closed)
         {
-            sem->tail = NULL;
-            break;
+            if (released == 0)
+            {
+                sem->pending = waiter;
+                break;
+            }
+            if (waiter->wants > released)
+            {
+                // partial grant, the waiter keeps its place at the front
+                STATS_INC(&sem->stats, SEM_STAT_PARTIAL_GRANT);
+                waiter->wants -= released;
+                released = 0;
+                sem->pending = waiter;
+                break;
+            }
+            released -= waiter->wants;
         }
+        semaphore_wake(sem, waiter, closed);
+        waiter = semaphore_pop(sem);
     }
-    atomic_fetch_add_explicit(&sem->permits, *released, memory_order_release);
-    pthread_mutex_unlock(&sem->queue_mutex);
+    if (semaphore_queue_empty(sem))
+        atomic_fetch_and_explicit(&sem->permits, ~WAITERS_BIT, memory_order_acq_rel);
+    atomic_fetch_add_explicit(&sem->permits, released, memory_order_release);
+}
+// run a drain pass now or make the current drainer run one more, so every request
+// is followed by a pass that starts after it, no lock is ever held
+static void semaphore_drain(semaphore_t *sem)
+{
+    size_t requests = 1;
+    if (atomic_fetch_add_explicit(&sem->drain, 1, memory_order_acq_rel) != 0)
+        return;
+    do
+    {
+        semaphore_release_permits(sem);
+    } while ((requests = atomic_fetch_sub_explicit(&sem->drain, requests, memory_order_acq_rel) - requests) != 0);
+}
+static inline int semaphore_enqueue(semaphore_t *sem, semaphore_waiter_t *waiter)
+{
+    if ((atomic_load_explicit(&sem->permits, memory_order_acquire) & CLOSE_BIT) != 0)
+    {
+        waiter->wants |= CLOSE_BIT;
+        return FALSE;
+    }
+    STATS_INC(&sem->stats, SEM_STAT_ENQUEUE);
+    semaphore_push(sem, waiter);
+    atomic_fetch_or(&sem->permits, WAITERS_BIT);
+    // permits released before the bit was set are still in the counter, the drain picks them up.
+    // it also catches a close that raced with us
+    semaphore_drain(sem);
+    return TRUE;
 }
 
 int semaphore_init(semaphore_t *sem, size_t permits)
+{
+    return semaphore_init_wait(sem, permits, wait_hybrid());
+}
+
+int semaphore_init_wait(semaphore_t *sem, size_t permits, wait_strategy_t strategy)
 {
     if (sem == NULL || permits > MAX_PERMITS)
         return SEMAPHORE_INIT_FAILED;
-    pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
-    if (pthread_mutex_init(&mutex, NULL) < 0)
-        return SEMAPHORE_INIT_FAILED;
 
     atomic_store_explicit(&sem->permits, permits, memory_order_relaxed);
-    sem->tail = NULL;
-    sem->head = NULL;
-    sem->queue_mutex = mutex;
+    atomic_store_explicit(&sem->stub.next, NULL, memory_order_relaxed);
+    atomic_store_explicit(&sem->tail, &sem->stub, memory_order_relaxed);
+    atomic_store_explicit(&sem->drain, 0, memory_order_relaxed);
+    sem->head = &sem->stub;
+    sem->pending = NULL;
     sem->capacity = permits;
+    sem->shards = NULL;
+    sem->shard_mask = 0;
+    adaptive_init(&sem->wait, strategy);
+#ifdef SYNC_STATS
+    stats_init(&sem->stats);
+#endif
     return SEMAPHORE_OK;
 }
 
-int semaphore_acquire_many(semaphore_t *sem, size_t permits)
+int semaphore_init_sharded(semaphore_t *sem, size_t permits, int shards, wait_strategy_t strategy)
 {
+    if (semaphore_init_wait(sem, permits, strategy) != SEMAPHORE_OK)
+        return SEMAPHORE_INIT_FAILED;
+    if (shards <= 0)
+        shards = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    size_t count = 1;
+    while (count < (size_t)shards && count < SEMAPHORE_MAX_SHARDS)
+        count <<= 1;
+    sem->shards = aligned_alloc(alignof(semaphore_shard_t), count * sizeof(semaphore_shard_t));
+    if (sem->shards == NULL)
+        return SEMAPHORE_INIT_FAILED;
+    sem->shard_mask = count - 1;
+    // spread the permits evenly, the remainder stays in the central counter
+    for (size_t i = 0; i < count; i++)
+        atomic_store_explicit(&sem->shards[i].permits, permits / count, memory_order_relaxed);
+    atomic_store_explicit(&sem->permits, permits % count, memory_order_relaxed);
+    return SEMAPHORE_OK;
+}
 
+int semaphore_acquire_many(semaphore_t *sem, size_t permits)
+{
+    if (sem->shards != NULL)
+        return semaphore_acquire_sharded(sem, permits);
     size_t current = atomic_load_explicit(&sem->permits, memory_order_acquire);
     spin_t spin = SEM_SPIN;
     while (1)
@@ -147,8 +341,10 @@ int semaphore_acquire_many(semaphore_t *sem, size_t permits)
         {
             return SEMAPHORE_CLOSED;
         }
-        if ((current & ~CLOSE_BIT) < permits)
+        // queued waiters come first
+        if ((current & WAITERS_BIT) != 0 || (current & MAX_PERMITS) < permits)
         {
+            STATS_INC(&sem->stats, SEM_STAT_NOT_ENOUGH);
             return SEMAPHORE_NOT_ENOUGH;
         }
         size_t new = current - permits;
@@ -157,37 +353,90 @@ int semaphore_acquire_many(semaphore_t *sem, size_t permits)
         {
             return SEMAPHORE_OK;
         }
+        STATS_INC(&sem->stats, SEM_STAT_CAS_RETRY);
         spin_next(&spin);
     }
 }
+// arguments and result of an acquire retried by adaptive_spin
+typedef struct
+{
+    semaphore_t *sem;
+    size_t permits;
+    int result;
+} semaphore_try_t;
+static int semaphore_try_acquire(void *ctx)
+{
+    semaphore_try_t *attempt = ctx;
+    attempt->result = semaphore_acquire_many(attempt->sem, attempt->permits);
+    return attempt->result != SEMAPHORE_NOT_ENOUGH;
+}
 int semaphore_acquire_many_block(semaphore_t *sem, size_t permits)
 {
     int result = semaphore_acquire_many(sem, permits);
     if (result == SEMAPHORE_NOT_ENOUGH)
     {
-        semaphore_waiter_t *waiter = malloc(sizeof(semaphore_waiter_t));
-        parker_init(&waiter->parker);
-        waiter->wants = permits;
-        if (semaphore_enqueue(sem, waiter))
-            park(&waiter->parker);
-
-        parker_destroy(&waiter->parker);
-        int result = SEMAPHORE_OK;
-        if ((waiter->wants & CLOSE_BIT) != 0)
-            result = SEMAPHORE_CLOSED;
-        free(waiter);
-        return result;
+        // permits usually come back within microseconds, spin and yield before queuing up.
+        // NOTE : acquire_many fails while waiters are queued, so spinning never jumps the queue
+        semaphore_try_t attempt = {sem, permits, result};
+        if (adaptive_spin(&sem->wait, semaphore_try_acquire, &attempt))
+            return attempt.result;
+
+        semaphore_waiter_t waiter;
+        waiter.parker = semaphore_thread_parker();
+        waiter.wants = permits;
+        if (semaphore_enqueue(sem, &waiter))
+        {
+            STATS_INC(&sem->stats, SEM_STAT_PARK);
+            park(waiter.parker);
+            STATS_ADD(&sem->stats, SEM_STAT_WAKE_NS, stats_now_ns() - waiter.woken_ns);
+            // a closed semaphore refuses the waiter without parking it, that says nothing about the spin
+            adaptive_parked(&sem->wait);
+        }
+
+        if ((waiter.wants & CLOSE_BIT) != 0)
+            return SEMAPHORE_CLOSED;
+        return SEMAPHORE_OK;
     }
     else
         return result;
 }
 int semaphore_release_many(semaphore_t *sem, size_t permits)
 {
-
-    semaphore_release_permits(sem, &permits);
+    // sharded : back to the local shard, unless waiters need them right away
+    if (sem->shards != NULL && (atomic_load(&sem->permits) & WAITERS_BIT) == 0)
+    {
+        semaphore_shard_put(sem, semaphore_local_shard(sem), permits);
+        return 0;
+    }
+    size_t prev = atomic_fetch_add_explicit(&sem->permits, permits, memory_order_release);
+    // fast path : nobody is queued, the fetch_add alone gave the permits back
+    if ((prev & WAITERS_BIT) != 0)
+        semaphore_drain(sem);
 
     return 0;
 }
+void semaphore_wait_stats(semaphore_t *sem, adaptive_stats_t *stats)
+{
+    adaptive_stats(&sem->wait, stats);
+}
+void semaphore_stats_snapshot(semaphore_t *sem, semaphore_stats_t *stats)
+{
+#ifdef SYNC_STATS
+    stats->cas_retry = stats_sum(&sem->stats, SEM_STAT_CAS_RETRY);
+    stats->not_enough = stats_sum(&sem->stats, SEM_STAT_NOT_ENOUGH);
+    stats->steal = stats_sum(&sem->stats, SEM_STAT_STEAL);
+    stats->enqueue = stats_sum(&sem->stats, SEM_STAT_ENQUEUE);
+    stats->park = stats_sum(&sem->stats, SEM_STAT_PARK);
+    stats->unpark = stats_sum(&sem->stats, SEM_STAT_UNPARK);
+    stats->wake_ns = stats_sum(&sem->stats, SEM_STAT_WAKE_NS);
+    stats->partial_grant = stats_sum(&sem->stats, SEM_STAT_PARTIAL_GRANT);
+    stats->close_wakeup = stats_sum(&sem->stats, SEM_STAT_CLOSE_WAKEUP);
+    stats->drain = stats_sum(&sem->stats, SEM_STAT_DRAIN);
+#else
+    (void)sem;
+    memset(stats, 0, sizeof(*stats));
+#endif
+}
 static inline int set_semaphore_closed(semaphore_t *sem)
 {
     return (atomic_fetch_or(&sem->permits, CLOSE_BIT) & CLOSE_BIT) != 0;
@@ -197,18 +446,12 @@ void semaphore_destroy(semaphore_t *sem)
 {
     if (!set_semaphore_closed(sem))
     {
-
-        pthread_mutex_lock(&sem->queue_mutex);
-        semaphore_waiter_t *node = semaphore_dequeue_locked(sem);
-        while (node != NULL)
-        {
-            // SAFETY -> wants isn't atomic but because of the mutex gaurded queue
-            // we know only one thread can remove this node and the thread who "waiter" node is in wating state
-            // so only this thread have "mut" acess to the node
-            node->wants |= CLOSE_BIT;
-            unpark(&node->parker);
-            node = semaphore_dequeue_locked(sem);
-        }
-        pthread_mutex_unlock(&sem->queue_mutex);
+        // the drain pass that follows sees the close bit and wakes every waiter
+        semaphore_drain(sem);
+        // another thread may be the drainer, nobody may touch `sem` once we return
+        while (atomic_load(&sem->drain) != 0)
+            sched_yield();
     }
+    free(sem->shards);
+    sem->shards = NULL;
 }
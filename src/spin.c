@@ -0,0 +1,30 @@
+#include <stdatomic.h>
+#include <stdint.h>
+#include "spin.h"
+
+// one measurement for the whole process, a static in the inline header would make every
+// translation unit calibrate again
+static atomic_int cached;
+
+int spin_hint_ps(void)
+{
+    int ps = atomic_load_explicit(&cached, memory_order_relaxed);
+    if (ps != 0)
+        return ps;
+    // best of a few runs, a preemption in the middle of one would make hints look slow
+    uint64_t best = UINT64_MAX;
+    for (int run = 0; run < 3; run++)
+    {
+        uint64_t start = spin_clock_ns();
+        for (int i = 0; i < 256; i++)
+            CPU_HINT_LOOP();
+        uint64_t elapsed = spin_clock_ns() - start;
+        if (elapsed < best)
+            best = elapsed;
+    }
+    ps = (int)(best * 1000 / 256);
+    if (ps < 1)
+        ps = 1;
+    atomic_store_explicit(&cached, ps, memory_order_relaxed);
+    return ps;
+}
@@ -0,0 +1,13 @@
+#include <stdatomic.h>
+#include "stats.h"
+
+// one counter and one slot per thread for the whole process, statics in the inline header
+// would give every translation unit its own, and the threads of one unit the same shards
+static atomic_uint next_slot;
+_Thread_local unsigned stats_slot;
+
+unsigned stats_assign_slot(void)
+{
+    stats_slot = atomic_fetch_add_explicit(&next_slot, 1, memory_order_relaxed) + 1;
+    return stats_slot;
+}
@@ -0,0 +1,122 @@
+#include <stdio.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "adaptive.h"
+#include "mpmc.h"
+
+// long enough for the consumer to run out of spins and yields and park
+#define PRODUCER_DELAY_US 100000
+
+int failures;
+
+#define CHECK(cond, ...)                  \
+    do                                    \
+    {                                     \
+        if (!(cond))                      \
+        {                                 \
+            fprintf(stderr, __VA_ARGS__); \
+            failures++;                   \
+        }                                 \
+    } while (0)
+
+// succeeds on the call that brings the counter down to 0
+static int countdown(void *ctx)
+{
+    int *left = ctx;
+    return --*left <= 0;
+}
+static int budget(adaptive_t *adaptive)
+{
+    return atomic_load(&adaptive->budget);
+}
+
+// the budget moves by a fraction of the difference and stays within its bounds
+static void check_learning(void)
+{
+    adaptive_t adaptive;
+    adaptive_init(&adaptive, wait_hybrid());
+    CHECK(budget(&adaptive) == ADAPTIVE_SPIN_MIN, "The budget starts at %d\n", budget(&adaptive));
+    adaptive_learn(&adaptive, ADAPTIVE_SPIN_MIN + 2 * ADAPTIVE_WEIGHT);
+    CHECK(budget(&adaptive) == ADAPTIVE_SPIN_MIN + 2, "One wait moved the budget to %d\n", budget(&adaptive));
+    for (int i = 0; i < 100; i++)
+        adaptive_learn(&adaptive, 1000);
+    CHECK(budget(&adaptive) == ADAPTIVE_SPIN_MAX, "Long waits took the budget to %d\n", budget(&adaptive));
+    for (int i = 0; i < 100; i++)
+        adaptive_parked(&adaptive);
+    CHECK(budget(&adaptive) == ADAPTIVE_SPIN_MIN, "Parks took the budget to %d\n", budget(&adaptive));
+    adaptive_stats_t stats;
+    adaptive_stats(&adaptive, &stats);
+    CHECK(stats.spin == 0 && stats.yield == 0 && stats.park == 100, "Counted %lu/%lu/%lu waits\n", stats.spin,
+          stats.yield, stats.park);
+}
+
+// a wait that ends while spinning or yielding is counted there, one that doesn't is left to park
+static void check_spin(void)
+{
+    adaptive_t adaptive;
+    adaptive_stats_t stats;
+    adaptive_init(&adaptive, wait_hybrid());
+
+    int left = 2;
+    CHECK(adaptive_spin(&adaptive, countdown, &left) == TRUE, "A short wait wasn't spun out\n");
+    adaptive_stats(&adaptive, &stats);
+    // a single cpu skips the spinning, the wait is then satisfied by a yield
+    if (adaptive_single_cpu())
+        CHECK(stats.spin == 0 && stats.yield == 1, "Counted %lu spins and %lu yields\n", stats.spin, stats.yield);
+    else
+        CHECK(stats.spin == 1 && stats.yield == 0, "Counted %lu spins and %lu yields\n", stats.spin, stats.yield);
+
+    // every spin round and every yield tries once, there are never more tries than that
+    left = 1000000;
+    CHECK(adaptive_spin(&adaptive, countdown, &left) == FALSE, "A wait that never ends wasn't left to park\n");
+    CHECK(1000000 - left <= ADAPTIVE_SPIN_MAX + ADAPTIVE_YIELDS, "Tried %d times\n", 1000000 - left);
+    adaptive_stats(&adaptive, &stats);
+    CHECK(stats.spin + stats.yield == 1 && stats.park == 0, "A failed spin was counted\n");
+}
+
+mpmc_t queue;
+
+void *late_producer(void *arg)
+{
+    (void)arg;
+    int item = 42;
+    usleep(PRODUCER_DELAY_US);
+    mpmc_send_block(&queue, &item);
+    return NULL;
+}
+
+// a receiver waiting on a late producer parks, and says so in the wait stats
+static void check_queue_park(void)
+{
+    pthread_t producer;
+    adaptive_stats_t send, recv;
+    int item = 0;
+    if (mpmc_init(&queue, 4, sizeof(int)) != MPMC_OK)
+    {
+        CHECK(0, "Failed to initialize the queue\n");
+        return;
+    }
+    pthread_create(&producer, NULL, late_producer, NULL);
+    CHECK(mpmc_recv_block(&queue, &item) == MPMC_OK && item == 42, "Received %d\n", item);
+    pthread_join(producer, NULL);
+    mpmc_wait_stats(&queue, &send, &recv);
+    CHECK(recv.park == 1 && recv.spin == 0 && recv.yield == 0, "The receiver counted %lu/%lu/%lu waits\n", recv.spin,
+          recv.yield, recv.park);
+    CHECK(send.spin == 0 && send.yield == 0 && send.park == 0, "The sender never waited but counted some\n");
+    destroy_mpmc(&queue);
+}
+
+int main()
+{
+    check_learning();
+    check_spin();
+    check_queue_park();
+    if (failures != 0)
+    {
+        fprintf(stderr, "Adaptive waiting failed %d checks\n", failures);
+        return 1;
+    }
+    printf("Every wait was counted where it ended.\n");
+    return 0;
+}
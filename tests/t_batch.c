@@ -0,0 +1,156 @@
+#include <stdio.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include "mpmc.h"
+
+#define NUM_PRODUCERS 3
+#define NUM_CONSUMERS 3
+#define BATCHES_PER_PRODUCER 2000
+#define BATCH 7
+
+mpmc_t queue;
+long long sums[NUM_CONSUMERS];
+int failures;
+
+#define CHECK(cond, ...)                  \
+    do                                    \
+    {                                     \
+        if (!(cond))                      \
+        {                                 \
+            fprintf(stderr, __VA_ARGS__); \
+            failures++;                   \
+        }                                 \
+    } while (0)
+
+// a batch stops at the queue boundaries : only the free cells are sent, only the ready ones received
+static void check_boundaries(int capacity)
+{
+    long items[16], out[16];
+    long next = 0, expected = 0;
+    mpmc_t q;
+    if (mpmc_init(&q, capacity, sizeof(long)) != MPMC_OK)
+    {
+        CHECK(0, "Failed to initialize a queue of %d\n", capacity);
+        return;
+    }
+    CHECK(mpmc_send_many(&q, items, 0) == 0, "An empty batch sent messages\n");
+    CHECK(mpmc_recv_many(&q, out, 4) == 0, "Received from an empty queue\n");
+    // several laps, so the batches cross the end of the ring (and the mask / modulo)
+    for (int lap = 0; lap < 3 * capacity; lap++)
+    {
+        for (int i = 0; i < 16; i++)
+            items[i] = next + i;
+        int sent = mpmc_send_many(&q, items, capacity - 1);
+        CHECK(sent == capacity - 1, "Capacity %d : sent %d of %d into an empty queue\n", capacity, sent, capacity - 1);
+        next += sent;
+        for (int i = 0; i < 16; i++)
+            items[i] = next + i;
+        // only one cell left
+        sent = mpmc_send_many(&q, items, 5);
+        CHECK(sent == 1, "Capacity %d : sent %d into a single free cell\n", capacity, sent);
+        next += sent;
+        CHECK(mpmc_send_many(&q, items, 5) == 0, "Capacity %d : sent into a full queue\n", capacity);
+        // a short read, then more than what is left
+        int got = mpmc_recv_many(&q, out, 2);
+        CHECK(got == 2, "Capacity %d : received %d of 2\n", capacity, got);
+        got += mpmc_recv_many(&q, out + 2, 16);
+        CHECK(got == capacity, "Capacity %d : received %d of %d\n", capacity, got, capacity);
+        for (int i = 0; i < got; i++, expected++)
+            CHECK(out[i] == expected, "Capacity %d : received %ld instead of %ld\n", capacity, out[i], expected);
+        CHECK(mpmc_recv_many(&q, out, 16) == 0, "Capacity %d : received from a drained queue\n", capacity);
+        // a lap that isn't aligned on the capacity
+        CHECK(mpmc_send_many(&q, &next, 1) == 1, "Capacity %d : single send failed\n", capacity);
+        CHECK(mpmc_recv_many(&q, out, 16) == 1 && out[0] == expected, "Capacity %d : single recv failed\n", capacity);
+        next++, expected++;
+    }
+    destroy_mpmc(&q);
+}
+
+void *producer(void *arg)
+{
+    int id = *(int *)arg;
+    long items[BATCH];
+    for (int b = 0; b < BATCHES_PER_PRODUCER; b++)
+    {
+        for (int i = 0; i < BATCH; i++)
+            items[i] = ((long)id * BATCHES_PER_PRODUCER + b) * BATCH + i;
+        mpmc_send_many_block(&queue, items, BATCH);
+    }
+    return NULL;
+}
+void *consumer(void *arg)
+{
+    int id = *(int *)arg;
+    long items[BATCH + 2];
+    long last[NUM_PRODUCERS];
+    for (int i = 0; i < NUM_PRODUCERS; i++)
+        last[i] = -1;
+    long total = (long)NUM_PRODUCERS * BATCHES_PER_PRODUCER * BATCH / NUM_CONSUMERS;
+    for (long received = 0; received < total;)
+    {
+        long max = total - received < BATCH + 2 ? total - received : BATCH + 2;
+        int got = mpmc_recv_many_block(&queue, items, (int)max);
+        for (int i = 0; i < got; i++)
+        {
+            // every producer's messages come out in the order it sent them
+            int from = (int)(items[i] / ((long)BATCHES_PER_PRODUCER * BATCH));
+            if (items[i] <= last[from])
+                sums[id] = -1;
+            last[from] = items[i];
+            if (sums[id] >= 0)
+                sums[id] += items[i];
+        }
+        received += got;
+    }
+    return NULL;
+}
+
+int main()
+{
+    pthread_t producers[NUM_PRODUCERS], consumers[NUM_CONSUMERS];
+    int ids[NUM_PRODUCERS], consumer_ids[NUM_CONSUMERS];
+
+    check_boundaries(8);
+    check_boundaries(6);
+
+    // batches larger than the queue, sent and received in pieces
+    if (mpmc_init(&queue, 5, sizeof(long)) != MPMC_OK)
+    {
+        fprintf(stderr, "Failed to initialize queue\n");
+        return 1;
+    }
+    for (int i = 0; i < NUM_CONSUMERS; i++)
+    {
+        consumer_ids[i] = i;
+        pthread_create(&consumers[i], NULL, consumer, &consumer_ids[i]);
+    }
+    for (int i = 0; i < NUM_PRODUCERS; i++)
+    {
+        ids[i] = i;
+        pthread_create(&producers[i], NULL, producer, &ids[i]);
+    }
+    for (int i = 0; i < NUM_PRODUCERS; i++)
+        pthread_join(producers[i], NULL);
+    for (int i = 0; i < NUM_CONSUMERS; i++)
+        pthread_join(consumers[i], NULL);
+    destroy_mpmc(&queue);
+
+    long long total = (long long)NUM_PRODUCERS * BATCHES_PER_PRODUCER * BATCH;
+    long long sum = 0;
+    for (int i = 0; i < NUM_CONSUMERS; i++)
+    {
+        if (sums[i] < 0)
+        {
+            fprintf(stderr, "Consumer %d saw a producer out of order\n", i);
+            return 1;
+        }
+        sum += sums[i];
+    }
+    if (failures != 0 || sum != total * (total - 1) / 2)
+    {
+        fprintf(stderr, "Batches lost or duplicated messages\n");
+        return 1;
+    }
+    printf("Every batch was delivered.\n");
+    return 0;
+}
@@ -0,0 +1,89 @@
+#include <stdio.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "broadcast.h"
+
+#define NUM_RECEIVERS 3
+#define MESSAGES 200000
+#define CHANNEL_CAPACITY 256
+
+broadcast_t channel;
+broadcast_receiver_t receivers[NUM_RECEIVERS];
+int failures;
+
+// every receiver must see increasing messages, and what it got plus what it missed
+// must add up to everything that was sent
+void *receiver(void *arg)
+{
+    int id = *(int *)arg;
+    long expected = 0, received = 0;
+    size_t missed = 0;
+    while (expected < MESSAGES)
+    {
+        long message;
+        size_t lagged;
+        if (broadcast_recv_block(&receivers[id], &message, &lagged) == BROADCAST_LAGGED)
+        {
+            missed += lagged;
+            expected += lagged;
+            continue;
+        }
+        if (message != expected)
+        {
+            fprintf(stderr, "Receiver %d got %ld instead of %ld\n", id, message, expected);
+            failures++;
+            break;
+        }
+        expected++;
+        received++;
+        // the last receiver is slow, it falls behind and lags
+        if (id == NUM_RECEIVERS - 1 && received % 1000 == 0)
+            usleep(1000);
+    }
+    printf("Receiver %d received %ld messages and missed %zu\n", id, received, missed);
+    broadcast_unsubscribe(&receivers[id]);
+    return NULL;
+}
+
+int main()
+{
+    pthread_t threads[NUM_RECEIVERS];
+    int ids[NUM_RECEIVERS];
+
+    if (broadcast_init(&channel, CHANNEL_CAPACITY, sizeof(long)) != MPMC_OK)
+    {
+        fprintf(stderr, "Failed to initialize channel\n");
+        return 1;
+    }
+    // subscribe before sending, so every receiver starts at message 0
+    for (int i = 0; i < NUM_RECEIVERS; i++)
+    {
+        ids[i] = i;
+        broadcast_subscribe(&channel, &receivers[i]);
+        pthread_create(&threads[i], NULL, receiver, &ids[i]);
+    }
+    for (long i = 0; i < MESSAGES; i++)
+    {
+        broadcast_send(&channel, &i);
+        // give the fast receivers a chance to keep up on a single cpu
+        if (i % CHANNEL_CAPACITY == 0)
+            sched_yield();
+    }
+    for (int i = 0; i < NUM_RECEIVERS; i++)
+    {
+        pthread_join(threads[i], NULL);
+    }
+    if (broadcast_subscribers(&channel) != 0)
+    {
+        fprintf(stderr, "Subscribers left behind\n");
+        failures++;
+    }
+    broadcast_destroy(&channel);
+    if (failures != 0)
+    {
+        return 1;
+    }
+    printf("Every receiver saw the messages in order.\n");
+    return 0;
+}
@@ -0,0 +1,88 @@
+#include <stdio.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include "deque.h"
+
+#define NUM_THIEVES 3
+#define ITEMS 200000
+#define DEQUE_CAPACITY 64
+
+deque_t deque;
+// every item must be taken exactly once, by the owner or by a thief
+atomic_int taken[ITEMS];
+atomic_int done;
+
+void *thief(void *arg)
+{
+    (void)arg;
+    while (!atomic_load(&done))
+    {
+        void *item;
+        if (deque_steal(&deque, &item) == MPMC_OK)
+            atomic_fetch_add(&taken[(long)item - 1], 1);
+    }
+    return NULL;
+}
+
+int main()
+{
+    pthread_t threads[NUM_THIEVES];
+    long popped = 0;
+    void *item;
+
+    if (deque_init(&deque, DEQUE_CAPACITY) != MPMC_OK)
+    {
+        fprintf(stderr, "Failed to initialize deque\n");
+        return 1;
+    }
+    // single thread : lifo at the bottom, fifo at the top
+    for (long i = 1; i <= 3; i++)
+        deque_push(&deque, (void *)i);
+    if (deque_pop(&deque, &item) != MPMC_OK || (long)item != 3 ||
+        deque_steal(&deque, &item) != MPMC_OK || (long)item != 1 ||
+        deque_pop(&deque, &item) != MPMC_OK || (long)item != 2 ||
+        deque_pop(&deque, &item) != MPMC_EMPTY || deque_steal(&deque, &item) != MPMC_EMPTY)
+    {
+        fprintf(stderr, "Wrong order on a single thread\n");
+        return 1;
+    }
+
+    for (int i = 0; i < NUM_THIEVES; i++)
+    {
+        pthread_create(&threads[i], NULL, thief, NULL);
+    }
+    // the owner pushes bursts and pops part of them back, the thieves race it for the rest
+    for (long next = 1; next <= ITEMS;)
+    {
+        while (next <= ITEMS && deque_push(&deque, (void *)next) == MPMC_OK)
+            next++;
+        for (int i = 0; i < DEQUE_CAPACITY / 2 && deque_pop(&deque, &item) == MPMC_OK; i++)
+        {
+            atomic_fetch_add(&taken[(long)item - 1], 1);
+            popped++;
+        }
+    }
+    while (deque_pop(&deque, &item) == MPMC_OK)
+    {
+        atomic_fetch_add(&taken[(long)item - 1], 1);
+        popped++;
+    }
+    atomic_store(&done, 1);
+    for (int i = 0; i < NUM_THIEVES; i++)
+    {
+        pthread_join(threads[i], NULL);
+    }
+    deque_destroy(&deque);
+
+    for (int i = 0; i < ITEMS; i++)
+    {
+        if (atomic_load(&taken[i]) != 1)
+        {
+            fprintf(stderr, "Item %d was taken %d times\n", i + 1, atomic_load(&taken[i]));
+            return 1;
+        }
+    }
+    printf("Every item was taken once, %ld by the owner.\n", popped);
+    return 0;
+}
@@ -0,0 +1,129 @@
+#include <stdio.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include "disruptor.h"
+
+#define NUM_PRODUCERS 2
+#define ITEMS_PER_PRODUCER 50000
+#define RING_CAPACITY 64
+#define BATCH 16
+
+// a diamond : `twice` and `thrice` annotate every event in place, `check` depends on both,
+// `count` sees the same stream on its own
+typedef struct
+{
+    long value;
+    long doubled;
+    long tripled;
+} event_t;
+
+disruptor_t ring;
+disruptor_consumer_t twice, thrice, check, count;
+long long check_sum, count_sum;
+int mismatches;
+
+void *producer(void *arg)
+{
+    int id = *(int *)arg;
+    for (int i = 0; i < ITEMS_PER_PRODUCER;)
+    {
+        // one producer publishes batches in place, the other one copies
+        if (id == 0)
+        {
+            size_t seq;
+            int want = ITEMS_PER_PRODUCER - i < BATCH ? ITEMS_PER_PRODUCER - i : BATCH;
+            int claimed = disruptor_claim_block(&ring, want, &seq);
+            for (int j = 0; j < claimed; j++)
+            {
+                event_t *event = disruptor_get(&ring, seq + j);
+                event->value = (long)id * ITEMS_PER_PRODUCER + i + j;
+            }
+            disruptor_publish(&ring, seq, claimed);
+            i += claimed;
+        }
+        else
+        {
+            event_t event = {.value = (long)id * ITEMS_PER_PRODUCER + i};
+            disruptor_send_block(&ring, &event);
+            i++;
+        }
+    }
+    return NULL;
+}
+
+void *stage(void *arg)
+{
+    disruptor_consumer_t *consumer = arg;
+    long long sum = 0;
+    for (long seen = 0; seen < (long)NUM_PRODUCERS * ITEMS_PER_PRODUCER;)
+    {
+        size_t seq;
+        int got = disruptor_poll_block(consumer, BATCH, &seq);
+        for (int j = 0; j < got; j++)
+        {
+            event_t *event = disruptor_get(&ring, seq + j);
+            if (consumer == &twice)
+                event->doubled = 2 * event->value;
+            else if (consumer == &thrice)
+                event->tripled = 3 * event->value;
+            else if (consumer == &check && (event->doubled != 2 * event->value || event->tripled != 3 * event->value))
+                mismatches++;
+            sum += event->value;
+        }
+        disruptor_release(consumer, got);
+        seen += got;
+    }
+    if (consumer == &check)
+        check_sum = sum;
+    if (consumer == &count)
+        count_sum = sum;
+    return NULL;
+}
+
+int main()
+{
+    pthread_t producers[NUM_PRODUCERS];
+    pthread_t stages[4];
+    int ids[NUM_PRODUCERS];
+    disruptor_consumer_t *consumers[4] = {&twice, &thrice, &check, &count};
+
+    if (disruptor_init(&ring, RING_CAPACITY, sizeof(event_t), MPMC_MODE_MPMC) != MPMC_OK)
+    {
+        fprintf(stderr, "Failed to initialize ring\n");
+        return 1;
+    }
+    disruptor_consumer_t *annotators[2] = {&twice, &thrice};
+    disruptor_add_consumer(&ring, &twice, NULL, 0);
+    disruptor_add_consumer(&ring, &thrice, NULL, 0);
+    disruptor_add_consumer(&ring, &check, annotators, 2);
+    disruptor_add_consumer(&ring, &count, NULL, 0);
+
+    for (int i = 0; i < 4; i++)
+    {
+        pthread_create(&stages[i], NULL, stage, consumers[i]);
+    }
+    for (int i = 0; i < NUM_PRODUCERS; i++)
+    {
+        ids[i] = i;
+        pthread_create(&producers[i], NULL, producer, &ids[i]);
+    }
+    for (int i = 0; i < NUM_PRODUCERS; i++)
+    {
+        pthread_join(producers[i], NULL);
+    }
+    for (int i = 0; i < 4; i++)
+    {
+        pthread_join(stages[i], NULL);
+    }
+    disruptor_destroy(&ring);
+
+    long long total = (long long)NUM_PRODUCERS * ITEMS_PER_PRODUCER;
+    long long expected = total * (total - 1) / 2;
+    if (check_sum != expected || count_sum != expected || mismatches != 0)
+    {
+        fprintf(stderr, "Checksum mismatch (%d events seen before their annotations)\n", mismatches);
+        return 1;
+    }
+    printf("Every stage saw every event.\n");
+    return 0;
+}
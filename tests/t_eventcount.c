@@ -0,0 +1,122 @@
+#include <stdio.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include "parker.h"
+
+#define NUM_SLEEPERS 3
+#define PING_PONG_ROUNDS 50000
+
+eventcount_t event;
+atomic_int turn, ready, asleep;
+int failures;
+
+#define CHECK(cond, ...)                  \
+    do                                    \
+    {                                     \
+        if (!(cond))                      \
+        {                                 \
+            fprintf(stderr, __VA_ARGS__); \
+            failures++;                   \
+        }                                 \
+    } while (0)
+
+static uint64_t waiters(void)
+{
+    return atomic_load(&event.state) & EVENTCOUNT_WAITERS;
+}
+
+// prepare registers, cancel and commit unregister, a notify only moves the epoch for a waiter
+static void check_single_thread(void)
+{
+    eventcount_init(&event);
+    eventcount_notify_all(&event);
+    uint32_t key = eventcount_prepare_wait(&event);
+    CHECK(key == 0, "Notify without waiters moved the epoch to %u\n", key);
+    CHECK(waiters() == 1, "Prepare registered %lu waiters\n", (unsigned long)waiters());
+    eventcount_cancel_wait(&event);
+    CHECK(waiters() == 0, "Cancel left %lu waiters\n", (unsigned long)waiters());
+
+    // a notify between prepare and commit : the commit returns at once
+    key = eventcount_prepare_wait(&event);
+    eventcount_notify_one(&event);
+    eventcount_commit_wait(&event, key);
+    CHECK(waiters() == 0, "Commit left %lu waiters\n", (unsigned long)waiters());
+    CHECK(eventcount_prepare_wait(&event) == key + 1, "Notify didn't move the epoch\n");
+    eventcount_cancel_wait(&event);
+    eventcount_destroy(&event);
+}
+
+// two threads hand a turn back and forth, a lost wakeup hangs until the test times out
+void *ping_pong(void *arg)
+{
+    int me = *(int *)arg;
+    for (int i = 0; i < PING_PONG_ROUNDS; i++)
+    {
+        while (atomic_load(&turn) != me)
+        {
+            uint32_t key = eventcount_prepare_wait(&event);
+            if (atomic_load(&turn) == me)
+                eventcount_cancel_wait(&event);
+            else
+                eventcount_commit_wait(&event, key);
+        }
+        atomic_store(&turn, 1 - me);
+        eventcount_notify_all(&event);
+    }
+    return NULL;
+}
+
+// sleeps until `ready` is set
+void *sleeper(void *arg)
+{
+    (void)arg;
+    while (!atomic_load(&ready))
+    {
+        uint32_t key = eventcount_prepare_wait(&event);
+        if (atomic_load(&ready))
+            eventcount_cancel_wait(&event);
+        else
+        {
+            atomic_fetch_add(&asleep, 1);
+            eventcount_commit_wait(&event, key);
+        }
+    }
+    return NULL;
+}
+
+int main()
+{
+    pthread_t threads[NUM_SLEEPERS];
+    int ids[2] = {0, 1};
+
+    check_single_thread();
+
+    eventcount_init(&event);
+    pthread_create(&threads[0], NULL, ping_pong, &ids[0]);
+    pthread_create(&threads[1], NULL, ping_pong, &ids[1]);
+    pthread_join(threads[0], NULL);
+    pthread_join(threads[1], NULL);
+    CHECK(waiters() == 0, "Ping pong left %lu waiters\n", (unsigned long)waiters());
+
+    // a notify of more than the registered waiters wakes every one of them
+    for (int i = 0; i < NUM_SLEEPERS; i++)
+        pthread_create(&threads[i], NULL, sleeper, NULL);
+    while (atomic_load(&asleep) < NUM_SLEEPERS)
+        sched_yield();
+    atomic_store(&ready, 1);
+    eventcount_notify_many(&event, NUM_SLEEPERS + 5);
+    for (int i = 0; i < NUM_SLEEPERS; i++)
+        pthread_join(threads[i], NULL);
+    CHECK(waiters() == 0, "Sleepers left %lu waiters\n", (unsigned long)waiters());
+    eventcount_destroy(&event);
+
+    if (failures != 0)
+    {
+        fprintf(stderr, "Eventcount failed %d checks\n", failures);
+        return 1;
+    }
+    printf("Every waiter was woken.\n");
+    return 0;
+}
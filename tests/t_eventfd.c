@@ -0,0 +1,118 @@
+#include <stdio.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include "mpmc.h"
+
+#define NUM_PRODUCERS 3
+#define ITEMS_PER_PRODUCER 50000
+#define QUEUE_CAPACITY 64
+#define BATCH 16
+
+mpmc_t queue;
+int failures;
+
+void *producer(void *arg)
+{
+    int id = *(int *)arg;
+    for (int i = 0; i < ITEMS_PER_PRODUCER; i++)
+    {
+        long item = (long)id * ITEMS_PER_PRODUCER + i;
+        mpmc_send_block(&queue, &item);
+    }
+    return NULL;
+}
+
+// many sends between two acks write the fd once
+static void check_coalescing(void)
+{
+    int fd = mpmc_eventfd(&queue, MPMC_EVENTFD_READ);
+    uint64_t count = 0;
+    for (long i = 0; i < QUEUE_CAPACITY; i++)
+        mpmc_send(&queue, &i);
+    if (read(fd, &count, sizeof(count)) != sizeof(count) || count != 1)
+    {
+        fprintf(stderr, "%d sends wrote the eventfd %lu times\n", QUEUE_CAPACITY, (unsigned long)count);
+        failures++;
+    }
+    // the fd was read by hand, ack re-arms it
+    mpmc_eventfd_ack(&queue, MPMC_EVENTFD_READ);
+    long item;
+    while (mpmc_recv(&queue, &item) == MPMC_OK)
+        ;
+    mpmc_eventfd_ack(&queue, MPMC_EVENTFD_WRITE);
+}
+
+int main()
+{
+    pthread_t threads[NUM_PRODUCERS];
+    int ids[NUM_PRODUCERS];
+    struct epoll_event event = {.events = EPOLLIN};
+    long items[BATCH];
+    long long sum = 0;
+    long received = 0;
+    int wakeups = 0;
+
+    if (mpmc_init(&queue, QUEUE_CAPACITY, sizeof(long)) != MPMC_OK ||
+        mpmc_eventfd_enable(&queue, MPMC_EVENTFD_READ | MPMC_EVENTFD_WRITE) != MPMC_OK)
+    {
+        fprintf(stderr, "Failed to initialize queue\n");
+        return 1;
+    }
+    // an empty queue has room, only the write side starts ready
+    int epoll = epoll_create1(0);
+    event.data.u32 = MPMC_EVENTFD_WRITE;
+    epoll_ctl(epoll, EPOLL_CTL_ADD, mpmc_eventfd(&queue, MPMC_EVENTFD_WRITE), &event);
+    if (epoll_wait(epoll, &event, 1, 0) != 1)
+    {
+        fprintf(stderr, "An empty queue isn't writable\n");
+        failures++;
+    }
+    epoll_ctl(epoll, EPOLL_CTL_DEL, mpmc_eventfd(&queue, MPMC_EVENTFD_WRITE), NULL);
+    check_coalescing();
+
+    // the event loop drains the queue without ever blocking in it
+    event.events = EPOLLIN;
+    event.data.u32 = MPMC_EVENTFD_READ;
+    epoll_ctl(epoll, EPOLL_CTL_ADD, mpmc_eventfd(&queue, MPMC_EVENTFD_READ), &event);
+    for (int i = 0; i < NUM_PRODUCERS; i++)
+    {
+        ids[i] = i;
+        pthread_create(&threads[i], NULL, producer, &ids[i]);
+    }
+    while (received < (long)NUM_PRODUCERS * ITEMS_PER_PRODUCER)
+    {
+        if (epoll_wait(epoll, &event, 1, 10000) != 1)
+        {
+            fprintf(stderr, "Timed out after %ld messages\n", received);
+            failures++;
+            break;
+        }
+        wakeups++;
+        mpmc_eventfd_ack(&queue, MPMC_EVENTFD_READ);
+        int got;
+        while ((got = mpmc_recv_many(&queue, items, BATCH)) > 0)
+        {
+            for (int i = 0; i < got; i++)
+                sum += items[i];
+            received += got;
+        }
+    }
+    for (int i = 0; i < NUM_PRODUCERS; i++)
+    {
+        pthread_join(threads[i], NULL);
+    }
+    close(epoll);
+    destroy_mpmc(&queue);
+
+    long long total = (long long)NUM_PRODUCERS * ITEMS_PER_PRODUCER;
+    if (failures != 0 || sum != total * (total - 1) / 2)
+    {
+        fprintf(stderr, "Checksum mismatch\n");
+        return 1;
+    }
+    printf("The event loop received %ld messages in %d wakeups.\n", received, wakeups);
+    return 0;
+}
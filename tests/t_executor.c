@@ -0,0 +1,70 @@
+#include <stdio.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include "executor.h"
+
+#define NUM_WORKERS 4
+#define DEPTH 16
+#define ROUNDS 3
+
+// a binary tree of fine grained tasks, every node spawns its two children from the worker
+// running it, only the root comes from outside the pool
+typedef struct
+{
+    executor_task_t task;
+    int depth;
+} node_t;
+
+executor_t executor;
+atomic_long leaves;
+parker_t finished;
+
+static void node_run(executor_task_t *task)
+{
+    node_t *node = (node_t *)task;
+    if (node->depth == DEPTH)
+    {
+        if (atomic_fetch_add(&leaves, 1) + 1 == 1L << DEPTH)
+            unpark(&finished);
+    }
+    else
+    {
+        for (int i = 0; i < 2; i++)
+        {
+            node_t *child = malloc(sizeof(node_t));
+            child->task.run = node_run;
+            child->depth = node->depth + 1;
+            executor_spawn(&executor, &child->task);
+        }
+    }
+    free(node);
+}
+
+int main()
+{
+    if (executor_init(&executor, NUM_WORKERS) != MPMC_OK)
+    {
+        fprintf(stderr, "Failed to start the pool\n");
+        return 1;
+    }
+    parker_init(&finished);
+    // the pool goes idle between rounds, the next root must wake it up
+    for (int round = 0; round < ROUNDS; round++)
+    {
+        atomic_store(&leaves, 0);
+        node_t *root = malloc(sizeof(node_t));
+        root->task.run = node_run;
+        root->depth = 0;
+        executor_spawn(&executor, &root->task);
+        park(&finished);
+        if (atomic_load(&leaves) != 1L << DEPTH)
+        {
+            fprintf(stderr, "Round %d ran %ld leaves\n", round, atomic_load(&leaves));
+            return 1;
+        }
+    }
+    executor_shutdown(&executor);
+    parker_destroy(&finished);
+    printf("Every round ran its %ld leaves.\n", 1L << DEPTH);
+    return 0;
+}
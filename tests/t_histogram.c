@@ -0,0 +1,107 @@
+#include <stdio.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include "histogram.h"
+#include "mpmc.h"
+
+#define NUM_THREADS 4
+#define VALUES_PER_THREAD 100000
+
+histogram_t histogram;
+
+// every thread records 1..VALUES_PER_THREAD
+void *recorder(void *arg)
+{
+    (void)arg;
+    for (uint64_t i = 1; i <= VALUES_PER_THREAD; i++)
+    {
+        histogram_record(&histogram, i);
+    }
+    return NULL;
+}
+
+// a percentile must land within one bucket (1/HISTOGRAM_SUB_BUCKETS) of the exact value
+int check_percentile(histogram_t *h, double percentile, uint64_t exact)
+{
+    uint64_t value = histogram_percentile(h, percentile);
+    uint64_t error = exact / HISTOGRAM_SUB_BUCKETS + 1;
+    printf("p%g = %llu (exact %llu)\n", percentile, (unsigned long long)value, (unsigned long long)exact);
+    return value + error >= exact && value <= exact + error;
+}
+
+int main()
+{
+    int ok = 1;
+    // every bucket starts where the previous one ends
+    for (int i = 0; i + 1 < HISTOGRAM_BUCKETS; i++)
+    {
+        uint64_t low = histogram_bucket_value(i);
+        if (histogram_bucket(low) != i || histogram_bucket(histogram_bucket_value(i + 1) - 1) != i)
+        {
+            fprintf(stderr, "Bucket %d is not contiguous\n", i);
+            ok = 0;
+            break;
+        }
+    }
+    if (histogram_bucket(UINT64_MAX) != HISTOGRAM_BUCKETS - 1)
+    {
+        fprintf(stderr, "UINT64_MAX is not in the last bucket\n");
+        ok = 0;
+    }
+
+    histogram_reset(&histogram);
+    pthread_t threads[NUM_THREADS];
+    for (int i = 0; i < NUM_THREADS; i++)
+    {
+        pthread_create(&threads[i], NULL, recorder, NULL);
+    }
+    for (int i = 0; i < NUM_THREADS; i++)
+    {
+        pthread_join(threads[i], NULL);
+    }
+    ok &= histogram_count(&histogram) == (uint64_t)NUM_THREADS * VALUES_PER_THREAD;
+    ok &= histogram_max(&histogram) == VALUES_PER_THREAD;
+    ok &= check_percentile(&histogram, 50, VALUES_PER_THREAD / 2);
+    ok &= check_percentile(&histogram, 99, VALUES_PER_THREAD / 100 * 99);
+    ok &= check_percentile(&histogram, 99.9, VALUES_PER_THREAD / 1000 * 999);
+
+    // merging doubles every count and keeps the percentiles
+    histogram_t *merged = malloc(sizeof(histogram_t));
+    histogram_reset(merged);
+    histogram_merge(merged, &histogram);
+    histogram_merge(merged, &histogram);
+    ok &= histogram_count(merged) == 2 * histogram_count(&histogram);
+    ok &= histogram_percentile(merged, 50) == histogram_percentile(&histogram, 50);
+    free(merged);
+
+#ifdef MPMC_LATENCY
+    // every message that went through the queue is in its histogram
+    mpmc_t queue;
+    mpmc_init(&queue, 64, sizeof(long));
+    if (mpmc_latency_enable(&queue, 1) != MPMC_OK)
+    {
+        fprintf(stderr, "Failed to enable latency recording\n");
+        return 1;
+    }
+    for (long i = 0; i < 1000; i++)
+    {
+        long item;
+        mpmc_send(&queue, &i);
+        mpmc_recv(&queue, &item);
+    }
+    histogram_reset(&histogram);
+    mpmc_latency_read(&queue, &histogram);
+    printf("Queue latency : %llu messages, p50 %llu ns\n", (unsigned long long)histogram_count(&histogram),
+           (unsigned long long)histogram_percentile(&histogram, 50));
+    ok &= histogram_count(&histogram) == 1000;
+    destroy_mpmc(&queue);
+#endif
+
+    if (!ok)
+    {
+        fprintf(stderr, "Histogram mismatch\n");
+        return 1;
+    }
+    printf("All histogram checks passed.\n");
+    return 0;
+}
@@ -0,0 +1,162 @@
+#include <stdio.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include "mpmc.h"
+
+#define MAX_THREADS 3
+#define ITEMS_PER_PRODUCER 30000
+#define BATCH 4
+
+// a single side gets one thread, a shared side MAX_THREADS
+typedef struct
+{
+    const char *name;
+    int mode;
+    int capacity;
+} mode_case_t;
+
+mpmc_t queue;
+int producers, consumers;
+long long sums[MAX_THREADS];
+
+// every call of the api works in every mode, the threads go round them
+void *producer(void *arg)
+{
+    int id = *(int *)arg;
+    long next = (long)id * ITEMS_PER_PRODUCER, end = next + ITEMS_PER_PRODUCER;
+    for (int round = 0; next < end; round++)
+    {
+        if (round % 3 == 0)
+        {
+            mpmc_send_block(&queue, &next);
+            next++;
+        }
+        else if (round % 3 == 1)
+        {
+            long items[BATCH];
+            int count = end - next < BATCH ? (int)(end - next) : BATCH;
+            for (int i = 0; i < count; i++)
+                items[i] = next + i;
+            mpmc_send_many_block(&queue, items, count);
+            next += count;
+        }
+        else
+        {
+            void *slots[BATCH];
+            int count = mpmc_send_reserve_many_block(&queue, slots, end - next < BATCH ? (int)(end - next) : BATCH);
+            for (int i = 0; i < count; i++)
+                *(long *)slots[i] = next++;
+            mpmc_send_commit_many(&queue, slots, count);
+        }
+    }
+    return NULL;
+}
+void *consumer(void *arg)
+{
+    int id = *(int *)arg;
+    long last[MAX_THREADS];
+    long total = (long)producers * ITEMS_PER_PRODUCER / consumers;
+    for (int i = 0; i < MAX_THREADS; i++)
+        last[i] = -1;
+    for (long received = 0; received < total;)
+    {
+        long items[BATCH];
+        void *slots[BATCH];
+        int max = total - received < BATCH ? (int)(total - received) : BATCH;
+        int got;
+        if (received % 3 == 0)
+        {
+            got = mpmc_recv_block(&queue, items) == MPMC_OK;
+        }
+        else if (received % 3 == 1)
+        {
+            got = mpmc_recv_many_block(&queue, items, max);
+        }
+        else
+        {
+            got = mpmc_recv_peek_many_block(&queue, slots, max);
+            for (int i = 0; i < got; i++)
+                items[i] = *(long *)slots[i];
+            mpmc_recv_release_many(&queue, slots, got);
+        }
+        for (int i = 0; i < got; i++)
+        {
+            // every producer's messages come out in the order it sent them
+            int from = (int)(items[i] / ITEMS_PER_PRODUCER);
+            if (items[i] <= last[from])
+                sums[id] = -1;
+            last[from] = items[i];
+            if (sums[id] >= 0)
+                sums[id] += items[i];
+        }
+        received += got;
+    }
+    return NULL;
+}
+
+static int run(const mode_case_t *c)
+{
+    pthread_t producer_threads[MAX_THREADS], consumer_threads[MAX_THREADS];
+    int ids[MAX_THREADS];
+    producers = (c->mode & MPMC_SINGLE_PRODUCER) != 0 ? 1 : MAX_THREADS;
+    consumers = (c->mode & MPMC_SINGLE_CONSUMER) != 0 ? 1 : MAX_THREADS;
+    if (mpmc_init_mode(&queue, c->capacity, sizeof(long), c->mode) != MPMC_OK)
+    {
+        fprintf(stderr, "%s : failed to initialize the queue\n", c->name);
+        return -1;
+    }
+    for (int i = 0; i < MAX_THREADS; i++)
+    {
+        ids[i] = i;
+        sums[i] = 0;
+    }
+    for (int i = 0; i < consumers; i++)
+        pthread_create(&consumer_threads[i], NULL, consumer, &ids[i]);
+    for (int i = 0; i < producers; i++)
+        pthread_create(&producer_threads[i], NULL, producer, &ids[i]);
+    for (int i = 0; i < producers; i++)
+        pthread_join(producer_threads[i], NULL);
+    for (int i = 0; i < consumers; i++)
+        pthread_join(consumer_threads[i], NULL);
+    destroy_mpmc(&queue);
+
+    long long total = (long long)producers * ITEMS_PER_PRODUCER, sum = 0;
+    for (int i = 0; i < consumers; i++)
+    {
+        if (sums[i] < 0)
+        {
+            fprintf(stderr, "%s : consumer %d saw a producer out of order\n", c->name, i);
+            return -1;
+        }
+        sum += sums[i];
+    }
+    if (sum != total * (total - 1) / 2)
+    {
+        fprintf(stderr, "%s : checksum mismatch\n", c->name);
+        return -1;
+    }
+    return 0;
+}
+
+int main()
+{
+    // a power of two (mask) and another capacity (modulo) for every mode
+    static const mode_case_t cases[] = {
+        {"spsc", MPMC_MODE_SPSC, 16}, {"spsc", MPMC_MODE_SPSC, 10}, {"mpsc", MPMC_MODE_MPSC, 16},
+        {"mpsc", MPMC_MODE_MPSC, 10}, {"spmc", MPMC_MODE_SPMC, 16}, {"spmc", MPMC_MODE_SPMC, 10},
+        {"mpmc", MPMC_MODE_MPMC, 16}, {"mpmc", MPMC_MODE_MPMC, 10},
+    };
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++)
+    {
+        if (run(&cases[i]) != 0)
+            return 1;
+    }
+    mpmc_t bad;
+    if (mpmc_init_mode(&bad, 16, sizeof(long), 4) != MPMC_INIT_FAILED)
+    {
+        fprintf(stderr, "An unknown mode was accepted\n");
+        return 1;
+    }
+    printf("Every mode delivered its messages in order.\n");
+    return 0;
+}
@@ -0,0 +1,173 @@
+#include <stdio.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include "prio.h"
+
+#define NUM_LANES 3
+#define NUM_CONSUMERS 2
+#define ITEMS_PER_LANE 50000
+#define QUEUE_CAPACITY 64
+// single lane race : every round is drained before the next one is sent
+#define RACE_RECEIVERS 4
+#define RACE_ROUNDS 20000
+#define RACE_ITEMS 8
+
+prio_t queue;
+long long sums[NUM_CONSUMERS];
+
+void *producer(void *arg)
+{
+    int lane = *(int *)arg;
+    for (int i = 0; i < ITEMS_PER_LANE; i++)
+    {
+        long item = (long)lane * ITEMS_PER_LANE + i;
+        prio_send_block(&queue, lane, &item);
+    }
+    return NULL;
+}
+void *consumer(void *arg)
+{
+    int id = *(int *)arg;
+    for (int i = 0; i < NUM_LANES * ITEMS_PER_LANE / NUM_CONSUMERS; i++)
+    {
+        long item;
+        int lane = prio_recv_block(&queue, &item);
+        if (item / ITEMS_PER_LANE != lane)
+            sums[id] = -1;
+        if (sums[id] >= 0)
+            sums[id] += item;
+    }
+    return NULL;
+}
+
+// receivers of the single lane race, tickets bound the receives to what is sent
+prio_t single;
+atomic_long tickets, received, race_sum;
+void *race_receiver(void *arg)
+{
+    (void)arg;
+    while (atomic_fetch_add(&tickets, 1) < (long)RACE_ROUNDS * RACE_ITEMS)
+    {
+        long item;
+        prio_recv_block(&single, &item);
+        atomic_fetch_add(&race_sum, item);
+        atomic_fetch_add(&received, 1);
+    }
+    return NULL;
+}
+// NOTE : a receiver that takes the head cell while another checks the lane made it look
+// empty, the lane lost its bit and the rest of the round stayed queued with nobody to wake
+static int single_lane_race(void)
+{
+    pthread_t receivers[RACE_RECEIVERS];
+    if (prio_init(&single, 1, RACE_ITEMS / 2, sizeof(long)) != MPMC_OK)
+        return -1;
+    for (int i = 0; i < RACE_RECEIVERS; i++)
+        pthread_create(&receivers[i], NULL, race_receiver, NULL);
+    long next = 0;
+    for (long round = 1; round <= RACE_ROUNDS; round++)
+    {
+        for (int i = 0; i < RACE_ITEMS; i++, next++)
+            prio_send_block(&single, 0, &next);
+        // a stranded message hangs here, until the test times out
+        while (atomic_load(&received) < round * RACE_ITEMS)
+            sched_yield();
+    }
+    for (int i = 0; i < RACE_RECEIVERS; i++)
+        pthread_join(receivers[i], NULL);
+    prio_destroy(&single);
+    return atomic_load(&race_sum) == next * (next - 1) / 2 ? 0 : -1;
+}
+
+// fill the lanes from the lowest priority up, then read back `count` lanes
+static int drain_order(int *lanes, int count)
+{
+    for (long lane = NUM_LANES - 1; lane >= 0; lane--)
+    {
+        for (int i = 0; i < QUEUE_CAPACITY; i++)
+            prio_send(&queue, (int)lane, &lane);
+    }
+    long item;
+    for (int i = 0; i < count; i++)
+    {
+        lanes[i] = prio_recv(&queue, &item);
+        if (lanes[i] != item)
+            return -1;
+    }
+    while (prio_recv(&queue, &item) >= 0)
+        ;
+    return 0;
+}
+
+int main()
+{
+    pthread_t producers[NUM_LANES], consumers[NUM_CONSUMERS];
+    int ids[NUM_LANES], consumer_ids[NUM_CONSUMERS];
+    int lanes[8];
+
+    if (prio_init(&queue, NUM_LANES, QUEUE_CAPACITY, sizeof(long)) != MPMC_OK)
+    {
+        fprintf(stderr, "Failed to initialize queue\n");
+        return 1;
+    }
+    // strict : the control lane comes first however much bulk is queued behind it
+    if (drain_order(lanes, 2) != 0 || lanes[0] != 0 || lanes[1] != 0)
+    {
+        fprintf(stderr, "Strict priority read lanes %d %d\n", lanes[0], lanes[1]);
+        return 1;
+    }
+    // weighted 4:2:1, every round of 7 reads every lane
+    int weights[NUM_LANES] = {4, 2, 1};
+    int expected[7] = {0, 0, 0, 0, 1, 1, 2};
+    prio_set_weights(&queue, weights);
+    if (drain_order(lanes, 7) != 0)
+    {
+        fprintf(stderr, "Weighted reads returned the wrong lane\n");
+        return 1;
+    }
+    for (int i = 0; i < 7; i++)
+    {
+        if (lanes[i] != expected[i])
+        {
+            fprintf(stderr, "Weighted read %d came from lane %d\n", i, lanes[i]);
+            return 1;
+        }
+    }
+
+    // blocked consumers must be woken by a send on any lane
+    for (int i = 0; i < NUM_CONSUMERS; i++)
+    {
+        consumer_ids[i] = i;
+        pthread_create(&consumers[i], NULL, consumer, &consumer_ids[i]);
+    }
+    for (int i = 0; i < NUM_LANES; i++)
+    {
+        ids[i] = i;
+        pthread_create(&producers[i], NULL, producer, &ids[i]);
+    }
+    for (int i = 0; i < NUM_LANES; i++)
+    {
+        pthread_join(producers[i], NULL);
+    }
+    for (int i = 0; i < NUM_CONSUMERS; i++)
+    {
+        pthread_join(consumers[i], NULL);
+    }
+    prio_destroy(&queue);
+
+    long long total = (long long)NUM_LANES * ITEMS_PER_LANE;
+    if (sums[0] < 0 || sums[1] < 0 || sums[0] + sums[1] != total * (total - 1) / 2)
+    {
+        fprintf(stderr, "Checksum mismatch\n");
+        return 1;
+    }
+    if (single_lane_race() != 0)
+    {
+        fprintf(stderr, "Single lane race lost messages\n");
+        return 1;
+    }
+    printf("Every lane was delivered.\n");
+    return 0;
+}
@@ -0,0 +1,89 @@
+#include <stdio.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include "segqueue.h"
+
+#define NUM_PRODUCERS 3
+#define NUM_CONSUMERS 3
+// several segments worth of items per producer, so segments get linked, drained and recycled
+#define ITEMS_PER_PRODUCER (3 * SEGQUEUE_SEGMENT_CELLS + 7)
+
+segqueue_t queue;
+atomic_llong received_sum;
+
+// Producer thread function
+void *producer(void *arg)
+{
+    int id = *(int *)arg;
+    for (int i = 0; i < ITEMS_PER_PRODUCER; i++)
+    {
+        long item = (long)id * ITEMS_PER_PRODUCER + i;
+        segqueue_send_block(&queue, &item);
+    }
+    printf("Producer %d sent %d items\n", id, ITEMS_PER_PRODUCER);
+    return NULL;
+}
+
+// Consumer thread function
+void *consumer(void *arg)
+{
+    int id = *(int *)arg;
+    long long sum = 0;
+    for (int i = 0; i < ITEMS_PER_PRODUCER; i++)
+    {
+        long item;
+        segqueue_recv_block(&queue, &item);
+        sum += item;
+    }
+    atomic_fetch_add(&received_sum, sum);
+    printf("Consumer %d received %d items\n", id, ITEMS_PER_PRODUCER);
+    return NULL;
+}
+
+int main()
+{
+    pthread_t producers[NUM_PRODUCERS];
+    pthread_t consumers[NUM_CONSUMERS];
+    int producer_ids[NUM_PRODUCERS];
+    int consumer_ids[NUM_CONSUMERS];
+
+    if (segqueue_init(&queue, sizeof(long)) != MPMC_OK)
+    {
+        fprintf(stderr, "Failed to initialize segmented queue\n");
+        return 1;
+    }
+
+    // consumers first, so they block on the empty queue
+    for (int i = 0; i < NUM_CONSUMERS; i++)
+    {
+        consumer_ids[i] = i;
+        pthread_create(&consumers[i], NULL, consumer, &consumer_ids[i]);
+    }
+    for (int i = 0; i < NUM_PRODUCERS; i++)
+    {
+        producer_ids[i] = i;
+        pthread_create(&producers[i], NULL, producer, &producer_ids[i]);
+    }
+
+    for (int i = 0; i < NUM_PRODUCERS; i++)
+    {
+        pthread_join(producers[i], NULL);
+    }
+    for (int i = 0; i < NUM_CONSUMERS; i++)
+    {
+        pthread_join(consumers[i], NULL);
+    }
+
+    long long total = (long long)NUM_PRODUCERS * ITEMS_PER_PRODUCER;
+    long long expected = total * (total - 1) / 2;
+    long item;
+    int leftover = segqueue_recv(&queue, &item) == MPMC_OK;
+    segqueue_destroy(&queue);
+    if (atomic_load(&received_sum) != expected || leftover)
+    {
+        fprintf(stderr, "Checksum mismatch\n");
+        return 1;
+    }
+    printf("All producers and consumers finished.\n");
+    return 0;
+}
@@ -0,0 +1,205 @@
+#include <stdio.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include "mpmc.h"
+
+#define NUM_QUEUES 8
+#define ITEMS_PER_QUEUE 20000
+#define QUEUE_CAPACITY 16
+// selector and plain receiver racing on one queue, every round drained before the next
+#define RACE_ROUNDS 20000
+#define RACE_ITEMS 4
+
+mpmc_t queues[NUM_QUEUES];
+int failures;
+
+void *producer(void *arg)
+{
+    int id = *(int *)arg;
+    for (int i = 0; i < ITEMS_PER_QUEUE; i++)
+    {
+        long item = (long)id * ITEMS_PER_QUEUE + i;
+        mpmc_send_block(&queues[id], &item);
+    }
+    return NULL;
+}
+
+// a hot queue that is always ready must not starve the others
+static void check_fairness(void)
+{
+    mpmc_selector_t selector;
+    long message;
+    int seen[NUM_QUEUES] = {0};
+    mpmc_selector_init(&selector);
+    for (int i = 0; i < NUM_QUEUES; i++)
+    {
+        long item = i;
+        mpmc_selector_add(&selector, &queues[i], MPMC_SELECT_RECV, &message);
+        mpmc_send(&queues[i], &item);
+    }
+    for (long i = 1; i < QUEUE_CAPACITY; i++)
+        mpmc_send(&queues[0], &i);
+    for (int i = 0; i < NUM_QUEUES; i++)
+    {
+        int index = mpmc_select(&selector);
+        if (index < 0 || seen[index]++ != 0)
+        {
+            fprintf(stderr, "Select %d picked case %d again\n", i, index);
+            failures++;
+        }
+    }
+    while (mpmc_select(&selector) >= 0)
+        ;
+    mpmc_selector_destroy(&selector);
+}
+
+// a send case completes once its queue has room again
+static void check_send(void)
+{
+    mpmc_selector_t selector;
+    long in, out = 42;
+    mpmc_selector_init(&selector);
+    mpmc_selector_add(&selector, &queues[0], MPMC_SELECT_RECV, &in);
+    int send = mpmc_selector_add(&selector, &queues[1], MPMC_SELECT_SEND, &out);
+    for (long i = 0; i < QUEUE_CAPACITY; i++)
+        mpmc_send(&queues[1], &i);
+    if (mpmc_select(&selector) != MPMC_EMPTY)
+    {
+        fprintf(stderr, "Select completed a case on an empty and a full queue\n");
+        failures++;
+    }
+    mpmc_recv(&queues[1], &in);
+    if (mpmc_select(&selector) != send)
+    {
+        fprintf(stderr, "Select missed the free cell\n");
+        failures++;
+    }
+    while (mpmc_recv(&queues[1], &in) == MPMC_OK)
+        ;
+    if (in != 42)
+    {
+        fprintf(stderr, "Select sent %ld\n", in);
+        failures++;
+    }
+    mpmc_selector_destroy(&selector);
+}
+
+// the selector and a plain receiver take turns on queues[0], tickets bound the receives
+atomic_long tickets, received;
+static int race_ticket(void)
+{
+    return atomic_fetch_add(&tickets, 1) < (long)RACE_ROUNDS * RACE_ITEMS;
+}
+void *race_selector(void *arg)
+{
+    (void)arg;
+    mpmc_selector_t selector;
+    long message;
+    mpmc_selector_init(&selector);
+    mpmc_selector_add(&selector, &queues[0], MPMC_SELECT_RECV, &message);
+    while (race_ticket())
+    {
+        mpmc_select_block(&selector);
+        atomic_fetch_add(&received, 1);
+    }
+    mpmc_selector_destroy(&selector);
+    return NULL;
+}
+void *race_receiver(void *arg)
+{
+    (void)arg;
+    long message;
+    while (race_ticket())
+    {
+        mpmc_recv_block(&queues[0], &message);
+        atomic_fetch_add(&received, 1);
+    }
+    return NULL;
+}
+// NOTE : the receiver taking the head cell while the selector checks the queue made it look
+// empty, the selector slept with the rest of the round queued
+static void check_race(void)
+{
+    pthread_t selector, receiver;
+    pthread_create(&selector, NULL, race_selector, NULL);
+    pthread_create(&receiver, NULL, race_receiver, NULL);
+    long item = 0;
+    for (long round = 1; round <= RACE_ROUNDS; round++)
+    {
+        for (int i = 0; i < RACE_ITEMS; i++, item++)
+            mpmc_send_block(&queues[0], &item);
+        // a stranded message hangs here, until the test times out
+        while (atomic_load(&received) < round * RACE_ITEMS)
+            sched_yield();
+    }
+    pthread_join(selector, NULL);
+    pthread_join(receiver, NULL);
+}
+
+int main()
+{
+    pthread_t threads[NUM_QUEUES];
+    int ids[NUM_QUEUES];
+    mpmc_selector_t selector;
+    long message;
+    long long sum = 0;
+    long last[NUM_QUEUES];
+
+    for (int i = 0; i < NUM_QUEUES; i++)
+    {
+        if (mpmc_init(&queues[i], QUEUE_CAPACITY, sizeof(long)) != MPMC_OK)
+        {
+            fprintf(stderr, "Failed to initialize queue %d\n", i);
+            return 1;
+        }
+    }
+    check_fairness();
+    check_send();
+    check_race();
+
+    // one dispatcher thread serves every queue
+    mpmc_selector_init(&selector);
+    for (int i = 0; i < NUM_QUEUES; i++)
+    {
+        mpmc_selector_add(&selector, &queues[i], MPMC_SELECT_RECV, &message);
+        last[i] = -1;
+    }
+    for (int i = 0; i < NUM_QUEUES; i++)
+    {
+        ids[i] = i;
+        pthread_create(&threads[i], NULL, producer, &ids[i]);
+    }
+    for (long i = 0; i < (long)NUM_QUEUES * ITEMS_PER_QUEUE; i++)
+    {
+        int index = mpmc_select_block(&selector);
+        // every queue keeps its own order
+        if (message / ITEMS_PER_QUEUE != index || message <= last[index])
+        {
+            fprintf(stderr, "Case %d received %ld after %ld\n", index, message, last[index]);
+            failures++;
+            break;
+        }
+        last[index] = message;
+        sum += message;
+    }
+    for (int i = 0; i < NUM_QUEUES; i++)
+    {
+        pthread_join(threads[i], NULL);
+    }
+    mpmc_selector_destroy(&selector);
+    for (int i = 0; i < NUM_QUEUES; i++)
+    {
+        destroy_mpmc(&queues[i]);
+    }
+
+    long long total = (long long)NUM_QUEUES * ITEMS_PER_QUEUE;
+    if (failures != 0 || sum != total * (total - 1) / 2)
+    {
+        fprintf(stderr, "Select lost messages\n");
+        return 1;
+    }
+    printf("The dispatcher received every message.\n");
+    return 0;
+}
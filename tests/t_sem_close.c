@@ -0,0 +1,51 @@
+#include <stdio.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include "semaphore.h"
+
+#define NUM_WAITERS 16
+#define GRANTED 8
+
+semaphore_t sem;
+atomic_int granted, closed;
+
+void *waiter(void *arg)
+{
+    (void)arg;
+    int result = semaphore_acquire_block(&sem);
+    if (result == SEMAPHORE_OK)
+        atomic_fetch_add(&granted, 1);
+    else if (result == SEMAPHORE_CLOSED)
+        atomic_fetch_add(&closed, 1);
+    return NULL;
+}
+
+// the waiters queue on an empty semaphore, a release serves as many of them as it
+// can and the destroy wakes the rest. a waiter that shows up after the destroy is
+// refused the same way, so the counts don't depend on the timing
+int main()
+{
+    pthread_t threads[NUM_WAITERS];
+
+    semaphore_init_wait(&sem, 0, wait_park());
+    for (int i = 0; i < NUM_WAITERS; i++)
+        pthread_create(&threads[i], NULL, waiter, NULL);
+    semaphore_release_many(&sem, GRANTED);
+    // the permits must all be handed out before the close, or they would go unused
+    while (atomic_load(&granted) < GRANTED)
+        sched_yield();
+    semaphore_destroy(&sem);
+    for (int i = 0; i < NUM_WAITERS; i++)
+        pthread_join(threads[i], NULL);
+
+    if (atomic_load(&granted) != GRANTED || atomic_load(&closed) != NUM_WAITERS - GRANTED)
+    {
+        fprintf(stderr, "%d waiters were served and %d refused, expected %d and %d\n", atomic_load(&granted),
+                atomic_load(&closed), GRANTED, NUM_WAITERS - GRANTED);
+        return 1;
+    }
+    printf("Every waiter was served or refused.\n");
+    return 0;
+}
@@ -0,0 +1,126 @@
+#include <stdio.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "semaphore.h"
+
+#define NUM_WAITERS 3
+#define NUM_THREADS 16
+#define ROUNDS 2000
+#define CAPACITY 4
+// time for a started waiter to reach the queue, it parks right away (wait_park)
+#define QUEUE_DELAY_US 50000
+
+typedef struct
+{
+    int id;
+    size_t wants;
+} request_t;
+
+semaphore_t sem;
+atomic_int started, woken;
+int order[NUM_WAITERS];
+atomic_int failures;
+
+#define CHECK(cond, ...)                  \
+    do                                    \
+    {                                     \
+        if (!(cond))                      \
+        {                                 \
+            fprintf(stderr, __VA_ARGS__); \
+            failures++;                   \
+        }                                 \
+    } while (0)
+
+void *waiter(void *arg)
+{
+    request_t *request = arg;
+    atomic_fetch_add(&started, 1);
+    if (semaphore_acquire_many_block(&sem, request->wants) == SEMAPHORE_OK)
+        order[atomic_fetch_add(&woken, 1)] = request->id;
+    return NULL;
+}
+static void wait_woken(int count)
+{
+    while (atomic_load(&woken) < count)
+        usleep(1000);
+}
+
+// waiters are served in the order they queued, the front one keeps its place while
+// it is only partially served, and the others can't jump ahead of it
+static void check_fifo(void)
+{
+    pthread_t threads[NUM_WAITERS];
+    request_t requests[NUM_WAITERS] = {{0, 2}, {1, 1}, {2, 3}};
+    semaphore_init_wait(&sem, 0, wait_park());
+    for (int i = 0; i < NUM_WAITERS; i++)
+    {
+        pthread_create(&threads[i], NULL, waiter, &requests[i]);
+        while (atomic_load(&started) <= i)
+            usleep(1000);
+        usleep(QUEUE_DELAY_US);
+    }
+    // 1 of the 2 permits the front waiter wants, nobody may run yet
+    semaphore_release_many(&sem, 1);
+    usleep(QUEUE_DELAY_US);
+    CHECK(atomic_load(&woken) == 0, "A waiter ran on a partial grant\n");
+    CHECK(semaphore_acquire_many(&sem, 1) == SEMAPHORE_NOT_ENOUGH, "Acquired ahead of the queued waiters\n");
+    semaphore_release_many(&sem, 1);
+    wait_woken(1);
+    // enough for both others, in queue order
+    semaphore_release_many(&sem, 4);
+    wait_woken(NUM_WAITERS);
+    for (int i = 0; i < NUM_WAITERS; i++)
+    {
+        pthread_join(threads[i], NULL);
+        CHECK(order[i] == i, "Waiter %d was served in position %d\n", order[i], i);
+    }
+    CHECK(semaphore_acquire_many(&sem, 1) == SEMAPHORE_NOT_ENOUGH, "Permits were left over\n");
+    semaphore_destroy(&sem);
+}
+
+// many threads block with their waiter node on the stack, no permit may be lost or made up
+void *worker(void *arg)
+{
+    size_t wants = (size_t)(*(int *)arg % 3) + 1;
+    for (int i = 0; i < ROUNDS; i++)
+    {
+        if (semaphore_acquire_many_block(&sem, wants) != SEMAPHORE_OK)
+        {
+            failures++;
+            return NULL;
+        }
+        semaphore_release_many(&sem, wants);
+    }
+    return NULL;
+}
+static void check_stress(void)
+{
+    pthread_t threads[NUM_THREADS];
+    int ids[NUM_THREADS];
+    semaphore_init(&sem, CAPACITY);
+    for (int i = 0; i < NUM_THREADS; i++)
+    {
+        ids[i] = i;
+        pthread_create(&threads[i], NULL, worker, &ids[i]);
+    }
+    for (int i = 0; i < NUM_THREADS; i++)
+        pthread_join(threads[i], NULL);
+    CHECK(semaphore_acquire_many(&sem, CAPACITY) == SEMAPHORE_OK, "Permits were lost\n");
+    CHECK(semaphore_acquire_many(&sem, 1) == SEMAPHORE_NOT_ENOUGH, "Permits were made up\n");
+    semaphore_destroy(&sem);
+}
+
+int main()
+{
+    check_fifo();
+    check_stress();
+    if (failures != 0)
+    {
+        fprintf(stderr, "Semaphore FIFO failed %d checks\n", atomic_load(&failures));
+        return 1;
+    }
+    printf("Every waiter was served in order.\n");
+    return 0;
+}
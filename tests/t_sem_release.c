@@ -0,0 +1,85 @@
+#include <stdio.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include "semaphore.h"
+
+#define NUM_ACQUIRERS 6
+#define NUM_RELEASERS 2
+#define ACQUIRES_PER_THREAD 5000
+
+semaphore_t sem;
+int failures;
+
+void *acquirer(void *arg)
+{
+    (void)arg;
+    for (int i = 0; i < ACQUIRES_PER_THREAD; i++)
+        semaphore_acquire_block(&sem);
+    return NULL;
+}
+// every permit an acquirer takes comes from here, one release at a time
+void *releaser(void *arg)
+{
+    (void)arg;
+    for (int i = 0; i < NUM_ACQUIRERS * ACQUIRES_PER_THREAD / NUM_RELEASERS; i++)
+    {
+        semaphore_release(&sem);
+        if (i % 64 == 0)
+            sched_yield();
+    }
+    return NULL;
+}
+
+// releases race the waiters queueing up and each other, a permit handed to nobody
+// leaves an acquirer parked until the test times out
+static int run(const char *name, wait_strategy_t strategy)
+{
+    pthread_t acquirers[NUM_ACQUIRERS], releasers[NUM_RELEASERS];
+    adaptive_stats_t stats;
+    semaphore_init_wait(&sem, 0, strategy);
+    for (int i = 0; i < NUM_ACQUIRERS; i++)
+        pthread_create(&acquirers[i], NULL, acquirer, NULL);
+    for (int i = 0; i < NUM_RELEASERS; i++)
+        pthread_create(&releasers[i], NULL, releaser, NULL);
+    for (int i = 0; i < NUM_RELEASERS; i++)
+        pthread_join(releasers[i], NULL);
+    for (int i = 0; i < NUM_ACQUIRERS; i++)
+        pthread_join(acquirers[i], NULL);
+    int result = semaphore_acquire(&sem);
+    semaphore_wait_stats(&sem, &stats);
+    semaphore_destroy(&sem);
+    if (result != SEMAPHORE_NOT_ENOUGH)
+    {
+        fprintf(stderr, "%s : permits were made up\n", name);
+        return -1;
+    }
+    // the acquirers start on an empty semaphore, the first of them has to queue
+    if (strategy.kind == WAIT_PARK && stats.park == 0)
+    {
+        fprintf(stderr, "%s : no acquire ever waited in the queue\n", name);
+        return -1;
+    }
+    return 0;
+}
+
+int main()
+{
+    // nobody queued : a release is a plain add, acquires take the permits right back
+    semaphore_init(&sem, 0);
+    semaphore_release_many(&sem, 3);
+    if (semaphore_acquire_many(&sem, 3) != SEMAPHORE_OK || semaphore_acquire(&sem) != SEMAPHORE_NOT_ENOUGH)
+    {
+        fprintf(stderr, "The fast path lost or made up permits\n");
+        failures++;
+    }
+    semaphore_destroy(&sem);
+
+    // parking waiters always queue, the hybrid ones only once spinning failed
+    if (run("park", wait_park()) != 0 || run("hybrid", wait_hybrid()) != 0)
+        failures++;
+    if (failures != 0)
+        return 1;
+    printf("Every release reached a waiter.\n");
+    return 0;
+}
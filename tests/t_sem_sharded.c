@@ -0,0 +1,113 @@
+#include <stdio.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include "semaphore.h"
+
+#define NUM_THREADS 8
+#define ROUNDS 5000
+#define CAPACITY 6
+#define SHARDS 4
+
+semaphore_t sem;
+atomic_int failures;
+
+#define CHECK(cond, ...)                  \
+    do                                    \
+    {                                     \
+        if (!(cond))                      \
+        {                                 \
+            fprintf(stderr, __VA_ARGS__); \
+            failures++;                   \
+        }                                 \
+    } while (0)
+
+// the local shard only holds a share of the permits, the rest has to be stolen.
+// a failed steal hands back what it took, the total stays exact
+static void check_steal(void)
+{
+    semaphore_init_sharded(&sem, 8, 3, wait_hybrid());
+    CHECK(sem.shard_mask == SHARDS - 1, "3 shards were rounded to %zu\n", sem.shard_mask + 1);
+    CHECK(semaphore_acquire_many(&sem, 8) == SEMAPHORE_OK, "Couldn't steal every permit\n");
+    CHECK(semaphore_acquire(&sem) == SEMAPHORE_NOT_ENOUGH, "Acquired from an empty semaphore\n");
+    semaphore_release_many(&sem, 8);
+    CHECK(semaphore_acquire_many(&sem, 9) == SEMAPHORE_NOT_ENOUGH, "Acquired more than there is\n");
+    CHECK(semaphore_acquire_many(&sem, 8) == SEMAPHORE_OK, "A failed steal lost permits\n");
+    semaphore_destroy(&sem);
+
+    // the remainder of the split starts in the central counter
+    semaphore_init_sharded(&sem, 10, SHARDS, wait_hybrid());
+    CHECK(semaphore_acquire_many(&sem, 10) == SEMAPHORE_OK, "The remainder wasn't stolen\n");
+    CHECK(semaphore_acquire(&sem) == SEMAPHORE_NOT_ENOUGH, "Permits were made up by the split\n");
+    semaphore_destroy(&sem);
+
+    // 0 shards : one per online cpu
+    semaphore_init_sharded(&sem, 5, 0, wait_hybrid());
+    CHECK(semaphore_acquire_many(&sem, 5) == SEMAPHORE_OK, "Couldn't acquire from the per-cpu shards\n");
+    semaphore_destroy(&sem);
+}
+
+// a waiter queued behind dry shards gets the permits released on any of them
+void *waiter(void *arg)
+{
+    CHECK(semaphore_acquire_many_block(&sem, *(size_t *)arg) == SEMAPHORE_OK, "The queued waiter wasn't served\n");
+    return NULL;
+}
+static void check_waiter(void)
+{
+    pthread_t thread;
+    size_t wants = 3;
+    semaphore_init_sharded(&sem, 0, SHARDS, wait_park());
+    pthread_create(&thread, NULL, waiter, &wants);
+    for (size_t i = 0; i < wants; i++)
+        semaphore_release(&sem);
+    pthread_join(thread, NULL);
+    CHECK(semaphore_acquire(&sem) == SEMAPHORE_NOT_ENOUGH, "Permits were left over\n");
+    semaphore_destroy(&sem);
+}
+
+// threads move around while they acquire and release, no permit may be lost or made up
+void *worker(void *arg)
+{
+    size_t wants = (size_t)(*(int *)arg % 3) + 1;
+    for (int i = 0; i < ROUNDS; i++)
+    {
+        if (semaphore_acquire_many_block(&sem, wants) != SEMAPHORE_OK)
+        {
+            failures++;
+            return NULL;
+        }
+        semaphore_release_many(&sem, wants);
+    }
+    return NULL;
+}
+static void check_stress(void)
+{
+    pthread_t threads[NUM_THREADS];
+    int ids[NUM_THREADS];
+    semaphore_init_sharded(&sem, CAPACITY, SHARDS, wait_hybrid());
+    for (int i = 0; i < NUM_THREADS; i++)
+    {
+        ids[i] = i;
+        pthread_create(&threads[i], NULL, worker, &ids[i]);
+    }
+    for (int i = 0; i < NUM_THREADS; i++)
+        pthread_join(threads[i], NULL);
+    CHECK(semaphore_acquire_many(&sem, CAPACITY) == SEMAPHORE_OK, "Permits were lost\n");
+    CHECK(semaphore_acquire(&sem) == SEMAPHORE_NOT_ENOUGH, "Permits were made up\n");
+    semaphore_destroy(&sem);
+}
+
+int main()
+{
+    check_steal();
+    check_waiter();
+    check_stress();
+    if (failures != 0)
+    {
+        fprintf(stderr, "Sharded semaphore failed %d checks\n", atomic_load(&failures));
+        return 1;
+    }
+    printf("Every permit was accounted for across the shards.\n");
+    return 0;
+}
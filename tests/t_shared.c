@@ -0,0 +1,85 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "mpmc.h"
+
+#define NUM_PRODUCERS 3
+#define ITEMS_PER_PRODUCER 50000
+#define QUEUE_CAPACITY 8
+
+// every producer maps the queue again, at another address than the one inherited from fork
+static int producer(int fd, int id)
+{
+    mpmc_t *queue;
+    if (mpmc_shared_attach(fd, &queue) != MPMC_OK)
+    {
+        fprintf(stderr, "Producer %d failed to attach\n", id);
+        return 1;
+    }
+    close(fd);
+    for (int i = 0; i < ITEMS_PER_PRODUCER; i++)
+    {
+        long item = (long)id * ITEMS_PER_PRODUCER + i;
+        mpmc_send_block(queue, &item);
+    }
+    mpmc_shared_detach(queue);
+    return 0;
+}
+
+int main()
+{
+    mpmc_t *queue;
+    pid_t children[NUM_PRODUCERS];
+    int failures = 0;
+    long long sum = 0;
+    mpmc_selector_t selector;
+
+    int fd = mpmc_shared_create("t_shared", QUEUE_CAPACITY, sizeof(long), MPMC_MODE_MPMC, &queue);
+    if (fd < 0)
+    {
+        fprintf(stderr, "Failed to create the shared queue\n");
+        return 1;
+    }
+    // per-process features are refused
+    mpmc_selector_init(&selector);
+    if (mpmc_selector_add(&selector, queue, MPMC_SELECT_RECV, &sum) != MPMC_INIT_FAILED ||
+        mpmc_eventfd_enable(queue, MPMC_EVENTFD_READ) != MPMC_INIT_FAILED)
+    {
+        fprintf(stderr, "A shared queue accepted a selector or an eventfd\n");
+        failures++;
+    }
+    mpmc_selector_destroy(&selector);
+
+    for (int i = 0; i < NUM_PRODUCERS; i++)
+    {
+        children[i] = fork();
+        if (children[i] == 0)
+            _exit(producer(fd, i));
+    }
+    close(fd);
+    // the queue is small, producers and consumer both end up sleeping on the shared futexes
+    for (long i = 0; i < (long)NUM_PRODUCERS * ITEMS_PER_PRODUCER; i++)
+    {
+        long item;
+        mpmc_recv_block(queue, &item);
+        sum += item;
+    }
+    for (int i = 0; i < NUM_PRODUCERS; i++)
+    {
+        int status;
+        waitpid(children[i], &status, 0);
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+            failures++;
+    }
+    mpmc_shared_detach(queue);
+
+    long long total = (long long)NUM_PRODUCERS * ITEMS_PER_PRODUCER;
+    if (failures != 0 || sum != total * (total - 1) / 2)
+    {
+        fprintf(stderr, "Checksum mismatch\n");
+        return 1;
+    }
+    printf("Every message crossed the process boundary.\n");
+    return 0;
+}
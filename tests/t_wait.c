@@ -0,0 +1,157 @@
+#include <stdio.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include "mpmc.h"
+#include "semaphore.h"
+
+#define NUM_PRODUCERS 2
+#define NUM_CONSUMERS 2
+#define ITEMS_PER_PRODUCER 1000
+#define QUEUE_CAPACITY 4
+#define NUM_THREADS 4
+#define ROUNDS 200
+#define TIMED_PARK_NS 100000
+
+typedef struct
+{
+    const char *name;
+    wait_strategy_t strategy;
+} strategy_case_t;
+
+mpmc_t queue;
+semaphore_t sem;
+long long sums[NUM_CONSUMERS];
+// a counter only the permit holder touches
+long held, in_use;
+
+void *producer(void *arg)
+{
+    int id = *(int *)arg;
+    for (long i = 0; i < ITEMS_PER_PRODUCER; i++)
+    {
+        long item = (long)id * ITEMS_PER_PRODUCER + i;
+        mpmc_send_block(&queue, &item);
+    }
+    return NULL;
+}
+void *consumer(void *arg)
+{
+    int id = *(int *)arg;
+    for (int i = 0; i < NUM_PRODUCERS * ITEMS_PER_PRODUCER / NUM_CONSUMERS; i++)
+    {
+        long item;
+        mpmc_recv_block(&queue, &item);
+        sums[id] += item;
+    }
+    return NULL;
+}
+void *worker(void *arg)
+{
+    (void)arg;
+    for (int i = 0; i < ROUNDS; i++)
+    {
+        semaphore_acquire_block(&sem);
+        if (in_use++ != 0)
+            held = -1;
+        else if (held >= 0)
+            held++;
+        in_use--;
+        semaphore_release(&sem);
+    }
+    return NULL;
+}
+
+// a strategy never waits in a phase it doesn't have
+static int check_stats(const strategy_case_t *c, const char *what, adaptive_stats_t *stats)
+{
+    int ok = TRUE;
+    switch (c->strategy.kind)
+    {
+    case WAIT_BUSY_SPIN:
+        ok = stats->yield == 0 && stats->park == 0;
+        break;
+    case WAIT_YIELD:
+        ok = stats->park == 0;
+        break;
+    case WAIT_PARK:
+    case WAIT_TIMED_PARK:
+        ok = stats->spin == 0 && stats->yield == 0;
+        break;
+    }
+    if (!ok)
+        fprintf(stderr, "%s : the %s waits ended %lu/%lu/%lu in spin/yield/park\n", c->name, what, stats->spin,
+                stats->yield, stats->park);
+    return ok;
+}
+
+static int run(const strategy_case_t *c)
+{
+    pthread_t producers[NUM_PRODUCERS], consumers[NUM_CONSUMERS], workers[NUM_THREADS];
+    int ids[NUM_PRODUCERS > NUM_CONSUMERS ? NUM_PRODUCERS : NUM_CONSUMERS];
+    adaptive_stats_t send, recv, acquire;
+    int ok = TRUE;
+
+    if (mpmc_init_wait(&queue, QUEUE_CAPACITY, sizeof(long), MPMC_MODE_MPMC, c->strategy) != MPMC_OK)
+    {
+        fprintf(stderr, "%s : failed to initialize the queue\n", c->name);
+        return -1;
+    }
+    for (int i = 0; i < NUM_CONSUMERS; i++)
+    {
+        ids[i] = i;
+        sums[i] = 0;
+        pthread_create(&consumers[i], NULL, consumer, &ids[i]);
+    }
+    for (int i = 0; i < NUM_PRODUCERS; i++)
+        pthread_create(&producers[i], NULL, producer, &ids[i]);
+    for (int i = 0; i < NUM_PRODUCERS; i++)
+        pthread_join(producers[i], NULL);
+    for (int i = 0; i < NUM_CONSUMERS; i++)
+        pthread_join(consumers[i], NULL);
+    mpmc_wait_stats(&queue, &send, &recv);
+    destroy_mpmc(&queue);
+    long long total = (long long)NUM_PRODUCERS * ITEMS_PER_PRODUCER;
+    if (sums[0] + sums[1] != total * (total - 1) / 2)
+    {
+        fprintf(stderr, "%s : checksum mismatch\n", c->name);
+        ok = FALSE;
+    }
+    ok &= check_stats(c, "send", &send) & check_stats(c, "recv", &recv);
+
+    // a single permit : the holders must never overlap
+    held = 0;
+    in_use = 0;
+    semaphore_init_wait(&sem, 1, c->strategy);
+    for (int i = 0; i < NUM_THREADS; i++)
+        pthread_create(&workers[i], NULL, worker, NULL);
+    for (int i = 0; i < NUM_THREADS; i++)
+        pthread_join(workers[i], NULL);
+    semaphore_wait_stats(&sem, &acquire);
+    semaphore_destroy(&sem);
+    if (held != NUM_THREADS * ROUNDS)
+    {
+        fprintf(stderr, "%s : two threads held the permit at once\n", c->name);
+        ok = FALSE;
+    }
+    ok &= check_stats(c, "acquire", &acquire);
+    return ok ? 0 : -1;
+}
+
+int main()
+{
+    const strategy_case_t cases[] = {
+        {"hybrid", wait_hybrid()}, {"busy spin", wait_busy_spin()},
+        {"yield", wait_yield()},   {"park", wait_park()},
+        {"timed park", wait_timed_park(TIMED_PARK_NS)},
+    };
+    int failures = 0;
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++)
+    {
+        if (run(&cases[i]) != 0)
+            failures++;
+    }
+    if (failures != 0)
+        return 1;
+    printf("Every wait strategy delivered its messages and permits.\n");
+    return 0;
+}
@@ -0,0 +1,148 @@
+#include <stdio.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include "mpmc.h"
+
+#define NUM_PRODUCERS 2
+#define NUM_CONSUMERS 2
+#define ITEMS_PER_PRODUCER 20000
+#define QUEUE_CAPACITY 8
+#define PAYLOAD 256
+
+// a large message, written and read in place
+typedef struct
+{
+    long id;
+    unsigned char payload[PAYLOAD];
+} message_t;
+
+mpmc_t queue;
+long long sums[NUM_CONSUMERS];
+int failures;
+
+#define CHECK(cond, ...)                  \
+    do                                    \
+    {                                     \
+        if (!(cond))                      \
+        {                                 \
+            fprintf(stderr, __VA_ARGS__); \
+            failures++;                   \
+        }                                 \
+    } while (0)
+
+// reserved cells stay invisible until committed, peeked cells stay taken until released
+static void check_single_thread(void)
+{
+    mpmc_t q;
+    void *slots[QUEUE_CAPACITY], *slot, *extra;
+    if (mpmc_init(&q, 4, sizeof(long)) != MPMC_OK)
+    {
+        CHECK(0, "Failed to initialize the queue\n");
+        return;
+    }
+    CHECK(mpmc_send_reserve(&q, &slots[0]) == MPMC_OK, "Reserve failed on an empty queue\n");
+    CHECK(mpmc_send_reserve(&q, &slots[1]) == MPMC_OK, "Second reserve failed\n");
+    CHECK(mpmc_recv_peek(&q, &slot) == MPMC_EMPTY, "Peeked a cell that wasn't committed\n");
+    // cells are consumed in order, the second commit waits for the first
+    *(long *)slots[1] = 2;
+    mpmc_send_commit(&q, slots[1]);
+    CHECK(mpmc_recv_peek(&q, &slot) == MPMC_EMPTY, "Peeked past an uncommitted cell\n");
+    *(long *)slots[0] = 1;
+    mpmc_send_commit(&q, slots[0]);
+    // the last free cells, reserved in one claim
+    CHECK(mpmc_send_reserve_many(&q, &slots[2], 8) == 2, "Reserved more than the free cells\n");
+    CHECK(mpmc_send_reserve(&q, &extra) == MPMC_FULL, "Reserved from a full queue\n");
+    *(long *)slots[2] = 3;
+    *(long *)slots[3] = 4;
+    mpmc_send_commit_many(&q, &slots[2], 2);
+
+    CHECK(mpmc_recv_peek(&q, &slot) == MPMC_OK && *(long *)slot == 1, "Peeked the wrong message\n");
+    // a peeked cell isn't free until it is released
+    CHECK(mpmc_send_reserve(&q, &extra) == MPMC_FULL, "Reserved a cell that is still peeked\n");
+    mpmc_recv_release(&q, slot);
+    CHECK(mpmc_send_reserve(&q, &extra) == MPMC_OK, "Released cell wasn't handed back\n");
+    *(long *)extra = 5;
+    mpmc_send_commit(&q, extra);
+
+    int got = mpmc_recv_peek_many(&q, slots, 8);
+    CHECK(got == 4, "Peeked %d of 4 messages\n", got);
+    for (int i = 0; i < got; i++)
+        CHECK(*(long *)slots[i] == i + 2, "Peeked %ld instead of %d\n", *(long *)slots[i], i + 2);
+    CHECK(mpmc_recv_peek(&q, &slot) == MPMC_EMPTY, "Peeked from a drained queue\n");
+    mpmc_recv_release_many(&q, slots, got);
+    CHECK(mpmc_send_reserve_many(&q, slots, 8) == 4, "Release many didn't free every cell\n");
+    mpmc_send_commit_many(&q, slots, 4);
+    destroy_mpmc(&q);
+}
+
+void *producer(void *arg)
+{
+    int id = *(int *)arg;
+    for (int i = 0; i < ITEMS_PER_PRODUCER; i++)
+    {
+        message_t *slot;
+        mpmc_send_reserve_block(&queue, (void **)&slot);
+        slot->id = (long)id * ITEMS_PER_PRODUCER + i;
+        memset(slot->payload, (int)(slot->id & 0xff), PAYLOAD);
+        mpmc_send_commit(&queue, slot);
+    }
+    return NULL;
+}
+void *consumer(void *arg)
+{
+    int id = *(int *)arg;
+    for (int i = 0; i < NUM_PRODUCERS * ITEMS_PER_PRODUCER / NUM_CONSUMERS; i++)
+    {
+        message_t *slot;
+        mpmc_recv_peek_block(&queue, (void **)&slot);
+        // the whole message was written before the commit published it
+        for (int j = 0; j < PAYLOAD; j++)
+        {
+            if (slot->payload[j] != (slot->id & 0xff))
+                sums[id] = -1;
+        }
+        if (sums[id] >= 0)
+            sums[id] += slot->id;
+        mpmc_recv_release(&queue, slot);
+    }
+    return NULL;
+}
+
+int main()
+{
+    pthread_t producers[NUM_PRODUCERS], consumers[NUM_CONSUMERS];
+    int ids[NUM_PRODUCERS], consumer_ids[NUM_CONSUMERS];
+
+    check_single_thread();
+
+    if (mpmc_init(&queue, QUEUE_CAPACITY, sizeof(message_t)) != MPMC_OK)
+    {
+        fprintf(stderr, "Failed to initialize queue\n");
+        return 1;
+    }
+    for (int i = 0; i < NUM_CONSUMERS; i++)
+    {
+        consumer_ids[i] = i;
+        pthread_create(&consumers[i], NULL, consumer, &consumer_ids[i]);
+    }
+    for (int i = 0; i < NUM_PRODUCERS; i++)
+    {
+        ids[i] = i;
+        pthread_create(&producers[i], NULL, producer, &ids[i]);
+    }
+    for (int i = 0; i < NUM_PRODUCERS; i++)
+        pthread_join(producers[i], NULL);
+    for (int i = 0; i < NUM_CONSUMERS; i++)
+        pthread_join(consumers[i], NULL);
+    destroy_mpmc(&queue);
+
+    long long total = (long long)NUM_PRODUCERS * ITEMS_PER_PRODUCER;
+    if (failures != 0 || sums[0] < 0 || sums[1] < 0 || sums[0] + sums[1] != total * (total - 1) / 2)
+    {
+        fprintf(stderr, "Zero-copy messages were lost or torn\n");
+        return 1;
+    }
+    printf("Every message was read in place.\n");
+    return 0;
+}